@@ -13,9 +13,11 @@
 #include "../lib/include/x86_64.h"
 #include "../kalloc/kalloc.h"
 #include "../paging/paging.h"
+#include "../paging/pat.h"
 #include "../memlayout.h"
 #include "../sched/percpu.h"
 #include "../sched/smp_sched.h"
+#include "../sched/fpu.h"
 #include "../idt/idt.h"
 
 // External symbols from trampoline assembly
@@ -64,6 +66,12 @@ void ap_entry(void)
     // Initialize per-CPU data for this AP
     percpu_init_ap(my_index);
 
+    // PAT must match the BSP before this CPU touches write-combining mappings
+    pat_init();
+
+    // Same FPU/XSAVE setup as the BSP, with CR0.TS set for lazy switching
+    fpu_init_cpu();
+
     // Initialize LAPIC for this AP
     lapic_init();
 
@@ -108,7 +116,7 @@ static void setup_trampoline(void *page_table)
     map_low_memory((pagetable_t) page_table, 0x0, PGSIZE * 16); // Map first 64KB
     LOG_SERIAL("AP", "Mapped low memory for trampoline");
 
-    uint8_t *trampoline_dest = (uint8_t *) AP_TRAMPOLINE_ADDR;
+    uint8_t *trampoline_dest = (uint8_t *) P2V(AP_TRAMPOLINE_ADDR);
     size_t trampoline_size = ap_trampoline_end - ap_trampoline_start;
 
     // Copy trampoline code to low memory
@@ -128,11 +136,12 @@ static void setup_trampoline(void *page_table)
     uint64_t *stack_ptr = (uint64_t *) (trampoline_dest + 0xE8);
     uint64_t *entry_ptr = (uint64_t *) (trampoline_dest + 0xF0);
 
-    *cr3_ptr = (uint64_t) page_table;
+    // The trampoline loads CR3 before paging is on, so it needs the physical address
+    *cr3_ptr = V2P(page_table);
     *stack_ptr = 0; // Will be set per-AP
     *entry_ptr = (uint64_t) ap_entry;
 
-    LOG_SERIAL("AP", "CR3: 0x%llx, Entry: 0x%llx", (uint64_t) page_table, (uint64_t) ap_entry);
+    LOG_SERIAL("AP", "CR3: 0x%llx, Entry: 0x%llx", V2P(page_table), (uint64_t) ap_entry);
 }
 
 /**
@@ -141,7 +150,7 @@ static void setup_trampoline(void *page_table)
 static bool start_ap(uint8_t apic_id, void *stack)
 {
     // Set stack pointer in trampoline at fixed offset 0xE8
-    uint64_t *stack_ptr = (uint64_t *) (AP_TRAMPOLINE_ADDR + 0xE8);
+    uint64_t *stack_ptr = (uint64_t *) P2V(AP_TRAMPOLINE_ADDR + 0xE8);
     *stack_ptr = (uint64_t) stack + AP_STACK_SIZE;
 
     LOG_SERIAL("AP", "Starting AP with APIC ID %d, stack at 0x%llx",
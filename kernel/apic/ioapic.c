@@ -8,6 +8,8 @@
 #include "ioapic.h"
 #include "../desc/madt.h"
 #include "../lib/include/logging.h"
+#include "../memlayout.h"
+#include "../paging/ioremap.h"
 #include <stddef.h>
 
 #define MAX_IOAPICS 8
@@ -102,8 +104,14 @@ void ioapic_init(void)
             ioapics[ioapic_count].address = entry->IOAPICAddr;
             ioapics[ioapic_count].gsi_base = entry->GSIBase;
 
-            // Map the I/O APIC registers (identity mapping assumed for now)
-            ioapics[ioapic_count].regs = (volatile uint32_t *) (uintptr_t) entry->IOAPICAddr;
+            // Map the I/O APIC registers
+            ioapics[ioapic_count].regs = (volatile uint32_t *) ioremap(entry->IOAPICAddr, PGSIZE);
+            if (ioapics[ioapic_count].regs == NULL)
+            {
+                LOG_SERIAL("IOAPIC", "Failed to map I/O APIC at 0x%x", entry->IOAPICAddr);
+                entry_ptr += header->Length;
+                continue;
+            }
 
             // Read the version register to get max redirection entries
             uint32_t ver = ioapic_read(ioapics[ioapic_count].regs, IOAPIC_REG_VER);
@@ -9,6 +9,8 @@
 #include "../desc/madt.h"
 #include "../lib/include/logging.h"
 #include "../lib/include/x86_64.h"
+#include "../memlayout.h"
+#include "../paging/ioremap.h"
 #include <stddef.h>
 
 // Virtual address where LAPIC registers are mapped
@@ -66,9 +68,16 @@ void lapic_init(void)
         return;
     }
 
-    // For now, directly map the physical address (identity mapping assumed)
-    // In a more complete system, you'd use proper virtual memory mapping
-    lapic = (volatile uint32_t *) (uintptr_t) lapic_phys;
+    // The registers are mapped once by the BSP; APs share the same window
+    if (lapic == NULL)
+    {
+        lapic = (volatile uint32_t *) ioremap(lapic_phys, PGSIZE);
+        if (lapic == NULL)
+        {
+            LOG_SERIAL("LAPIC", "ERROR: Failed to map LAPIC registers");
+            return;
+        }
+    }
 
     LOG_SERIAL("LAPIC", "Physical address: 0x%x", lapic_phys);
 
@@ -43,8 +43,13 @@
 #define LAPIC_SVR_FOCUS 0x00000200  // Focus Processor Checking
 
 // Timer Register bits
-#define LAPIC_TIMER_PERIODIC 0x00020000 // Timer mode: periodic
-#define LAPIC_TIMER_MASKED 0x00010000   // Interrupt masked
+#define LAPIC_TIMER_ONESHOT 0x00000000      // Timer mode: one-shot
+#define LAPIC_TIMER_PERIODIC 0x00020000     // Timer mode: periodic
+#define LAPIC_TIMER_TSC_DEADLINE 0x00040000 // Timer mode: TSC-deadline
+#define LAPIC_TIMER_MASKED 0x00010000       // Interrupt masked
+
+// TSC-deadline timer: the LAPIC fires when the TSC reaches this MSR
+#define MSR_IA32_TSC_DEADLINE 0x6E0
 
 // Interrupt Command Register bits
 #define LAPIC_ICR_INIT 0x00000500    // INIT IPI
@@ -0,0 +1,94 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Kernel command line from the multiboot2 information structure.
+//
+
+#include <stdint.h>
+#include "cmdline.h"
+#include "../memlayout.h"
+#include "../lib/include/memcmp.h"
+#include "../lib/include/str_utils.h"
+#include "../lib/include/logging.h"
+
+#define MULTIBOOT_TAG_END     0
+#define MULTIBOOT_TAG_CMDLINE 1
+
+// Saved by boot.asm from ebx
+extern uint32_t multiboot_info_phys;
+
+struct multiboot_tag
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+// Words are split in place, so the buffer holds NUL-separated options
+static char cmdline[CMDLINE_MAX];
+static uint32_t cmdline_len;
+
+void cmdline_init(void)
+{
+    if (multiboot_info_phys == 0)
+    {
+        return;
+    }
+
+    uint8_t *info = P2V(multiboot_info_phys);
+    uint32_t total_size = *(uint32_t *) info;
+
+    // Tags follow the 8-byte header, each padded to 8 bytes
+    for (uint32_t off = 8; off + sizeof(struct multiboot_tag) <= total_size;)
+    {
+        struct multiboot_tag *tag = (struct multiboot_tag *) (info + off);
+        if (tag->type == MULTIBOOT_TAG_END)
+        {
+            break;
+        }
+        if (tag->type == MULTIBOOT_TAG_CMDLINE)
+        {
+            const char *src = (const char *) (tag + 1);
+            while (cmdline_len < CMDLINE_MAX - 1 && src[cmdline_len] != '\0')
+            {
+                cmdline[cmdline_len] = src[cmdline_len];
+                cmdline_len++;
+            }
+            cmdline[cmdline_len] = '\0';
+            LOG_SERIAL("CMDLINE", "Kernel command line: %s", cmdline);
+        }
+        off += (tag->size + 7) & ~7u;
+    }
+
+    for (uint32_t i = 0; i < cmdline_len; i++)
+    {
+        if (cmdline[i] == ' ')
+        {
+            cmdline[i] = '\0';
+        }
+    }
+}
+
+const char *cmdline_get(const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *value = 0;
+
+    for (uint32_t i = 0; i < cmdline_len; i += strlen(&cmdline[i]) + 1)
+    {
+        const char *word = &cmdline[i];
+        if (memcmp(word, key, key_len) != 0)
+        {
+            continue;
+        }
+        if (word[key_len] == '=')
+        {
+            value = word + key_len + 1;
+        }
+        else if (word[key_len] == '\0')
+        {
+            value = word + key_len;
+        }
+    }
+    return value;
+}
@@ -0,0 +1,32 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Kernel command line from the multiboot2 information structure.
+// Options are space separated `key=value` words, e.g. `sched=fair`.
+//
+
+#ifndef SHIPOS_CMDLINE_H
+#define SHIPOS_CMDLINE_H
+
+// Longest command line kept; the rest is ignored
+#define CMDLINE_MAX 256
+
+/**
+ * @brief Copy the command line out of the multiboot2 information
+ *
+ * Must run before kinit(), which may hand out the pages the boot loader
+ * left the information structure in.
+ */
+void cmdline_init(void);
+
+/**
+ * @brief Look up an option
+ *
+ * @param key Option name without the '='
+ * @return Value of the last `key=value` word, "" for a bare `key`, or
+ *         NULL if the option is not present
+ */
+const char *cmdline_get(const char *key);
+
+#endif // SHIPOS_CMDLINE_H
@@ -3,8 +3,9 @@
 
 #include "../lib/include/memcmp.h"
 #include "../lib/include/logging.h"
+#include "../memlayout.h"
 
-#define EBDA_SEG ((uint16_t *) 0x40E)
+#define EBDA_SEG ((uint16_t *) P2V(0x40E))
 #define BIOS_MEM_START (0x000E0000)
 #define BIOS_MEM_END (0x00100000)
 #define ONE_KB 1024
@@ -62,12 +63,12 @@ struct RSDP_t *scan_rsdp(uintptr_t start, uintptr_t end)
  */
 void init_rsdp()
 {
-    uintptr_t ebda_addr = ((uintptr_t) (*EBDA_SEG)) << 4;
+    uintptr_t ebda_addr = (uintptr_t) P2V(((uintptr_t) (*EBDA_SEG)) << 4);
     struct RSDP_t *found_rsdp = scan_rsdp(ebda_addr, ebda_addr + ONE_KB);
 
     if (found_rsdp == NULL)
     {
-        found_rsdp = scan_rsdp(BIOS_MEM_START, BIOS_MEM_END);
+        found_rsdp = scan_rsdp((uintptr_t) P2V(BIOS_MEM_START), (uintptr_t) P2V(BIOS_MEM_END));
     }
 
     if (found_rsdp)
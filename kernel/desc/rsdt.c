@@ -4,12 +4,28 @@
 #include "../lib/include/memcmp.h"
 #include "../lib/include/memset.h"
 #include "../paging/paging.h"
+#include "../paging/ioremap.h"
 #include "../kalloc/kalloc.h"
 #include "../memlayout.h"
 
 static void *rsdt_root_ptr = NULL;
 static bool extended = false;
 
+/**
+ * @brief Mapping of a table referenced from the RSDT
+ *
+ * The header is mapped on the first lookup that reaches the entry and the
+ * whole table once its signature has matched. Both stay mapped, so repeated
+ * lookups never go back to ioremap.
+ */
+struct rsdt_table_ref
+{
+    struct ACPISDTHeader *header;
+    bool full;
+};
+
+static struct rsdt_table_ref table_refs[RSDT_MAX_TABLES];
+
 /**
  * @brief Getter function to get rsdt table root pointer
  */
@@ -55,31 +71,27 @@ void init_rsdt(struct RSDP_t *rsdp_ptr)
         LOG_SERIAL("RSDT", "Using RSDT at 0x%lx", rsdt_phys);
     }
 
-    // First, map one page to read the header length
-    LOG_SERIAL("RSDT", "Mapping first page to read header");
-    void *header_mapped = map_mmio(rsdt_phys, PGSIZE);
+    // First, map the header to read the table length
+    LOG_SERIAL("RSDT", "Mapping header");
+    void *header_mapped = ioremap_cache(rsdt_phys, sizeof(struct ACPISDTHeader));
     if (header_mapped == NULL)
     {
-        LOG_SERIAL("RSDT", "Failed to map RSDT header page");
+        LOG_SERIAL("RSDT", "Failed to map RSDT header");
         return;
     }
     
-    struct RSDT_t *rsdt_ptr_mapped = (struct RSDT_t *) header_mapped;
-    uint32_t table_length = rsdt_ptr_mapped->header.Length;
+    uint32_t table_length = ((struct RSDT_t *) header_mapped)->header.Length;
     LOG_SERIAL("RSDT", "table_length = %d", table_length);
 
-    // If table is larger than one page, map the full table
-    if (table_length > PGSIZE)
+    // Map the full table; it is a registry hit when it fits in the header page
+    void *mapped = ioremap_cache(rsdt_phys, table_length);
+    iounmap(header_mapped);
+    if (mapped == NULL)
     {
-        LOG_SERIAL("RSDT", "Table larger than one page, remapping %d bytes", table_length);
-        void *mapped = map_mmio(rsdt_phys, table_length);
-        if (mapped == NULL)
-        {
-            LOG_SERIAL("RSDT", "Failed to map full RSDT (size=%d)", table_length);
-            return;
-        }
-        rsdt_ptr_mapped = (struct RSDT_t *) mapped;
+        LOG_SERIAL("RSDT", "Failed to map full RSDT (size=%d)", table_length);
+        return;
     }
+    struct RSDT_t *rsdt_ptr_mapped = (struct RSDT_t *) mapped;
 
     if (!acpi_checksum_ok(&rsdt_ptr_mapped->header, table_length))
     {
@@ -96,6 +108,10 @@ void init_rsdt(struct RSDP_t *rsdp_ptr)
     rsdt_root_ptr = rsdt_ptr_mapped;
 
     LOG_SERIAL("RSDT", "Initialized: %d entries, xsdt=%s", entries, is_xsdt_table ? "yes" : "no");
+    if (entries > RSDT_MAX_TABLES)
+    {
+        LOG_SERIAL("RSDT", "Only the first %d entries are searched", RSDT_MAX_TABLES);
+    }
 }
 
 uint32_t rsdt_get_entry_count()
@@ -110,6 +126,40 @@ uint32_t rsdt_get_entry_count()
     return (rsdt->header.Length - sizeof(struct ACPISDTHeader)) / entry_size;
 }
 
+/**
+ * @brief Map the table referenced by an RSDT entry
+ *
+ * The mapping is made once and reused, so callers never release it.
+ *
+ * @param index RSDT entry index, below RSDT_MAX_TABLES
+ * @param phys_addr Physical address stored in the entry
+ * @param full Map the whole table instead of just its header
+ */
+static struct ACPISDTHeader *rsdt_map_entry(uint32_t index, uint64_t phys_addr, bool full)
+{
+    struct rsdt_table_ref *ref = &table_refs[index];
+
+    if (ref->header != NULL && (ref->full || !full))
+    {
+        return ref->header;
+    }
+
+    struct ACPISDTHeader *header = ref->header != NULL
+        ? ref->header
+        : ioremap_cache(phys_addr, sizeof(struct ACPISDTHeader));
+    if (header == NULL || !full)
+    {
+        ref->header = header;
+        return header;
+    }
+
+    struct ACPISDTHeader *table = ioremap_cache(phys_addr, header->Length);
+    iounmap(header);
+    ref->header = table;
+    ref->full = table != NULL;
+    return table;
+}
+
 struct ACPISDTHeader *rsdt_find_table(const char *signature)
 {
     if (rsdt_root_ptr == NULL)
@@ -119,6 +169,10 @@ struct ACPISDTHeader *rsdt_find_table(const char *signature)
     }
 
     uint32_t entries = rsdt_get_entry_count();
+    if (entries > RSDT_MAX_TABLES)
+    {
+        entries = RSDT_MAX_TABLES;
+    }
 
     for (uint32_t i = 0; i < entries; i++)
     {
@@ -140,34 +194,31 @@ struct ACPISDTHeader *rsdt_find_table(const char *signature)
             continue;
         }
 
-        struct ACPISDTHeader *header;
-        void *mapped = map_mmio(phys_addr, PGSIZE);
-        if (mapped == NULL)
+        struct ACPISDTHeader *header = rsdt_map_entry(i, phys_addr, false);
+        if (header == NULL)
         {
             continue;
         }
-        header = (struct ACPISDTHeader *) mapped;
 
-        if (memcmp(header->Signature, signature, 4) == 0)
+        if (memcmp(header->Signature, signature, 4) != 0)
         {
-            uint32_t table_len = header->Length;
-
-            void *mapped = map_mmio(phys_addr, table_len);
-            if (mapped == NULL)
-            {
-                LOG_SERIAL("RSDT", "Failed to map full table at 0x%x", (uint32_t) phys_addr);
-                return NULL;
-            }
-            header = (struct ACPISDTHeader *) mapped;
-
-            if (!acpi_checksum_ok(header, table_len))
-            {
-                LOG_SERIAL("RSDT", "Table '%.4s' checksum failed", signature);
-                return NULL;
-            }
-
-            return header;
+            continue;
+        }
+
+        header = rsdt_map_entry(i, phys_addr, true);
+        if (header == NULL)
+        {
+            LOG_SERIAL("RSDT", "Failed to map full table at 0x%x", (uint32_t) phys_addr);
+            return NULL;
         }
+
+        if (!acpi_checksum_ok(header, header->Length))
+        {
+            LOG_SERIAL("RSDT", "Table '%.4s' checksum failed", signature);
+            return NULL;
+        }
+
+        return header;
     }
 
     LOG_SERIAL("RSDT", "Table '%.4s' not found", signature);
@@ -15,6 +15,10 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+// RSDT/XSDT entries searched by rsdt_find_table(), each with a cached
+// mapping; firmware tables list a few dozen at most
+#define RSDT_MAX_TABLES 256
+
 struct RSDT_t
 {
     struct ACPISDTHeader header;
@@ -36,6 +40,9 @@ bool is_xsdt();
 /**
  * @brief Find an ACPI table by signature in RSDT/XSDT
  *
+ * The table stays mapped for later lookups and must not be passed to
+ * iounmap(). Only the first RSDT_MAX_TABLES entries are searched.
+ *
  * @param signature 4-character signature (e.g., "APIC", "FACP")
  * @return Pointer to the table header, or NULL if not found
  */
@@ -14,13 +14,11 @@
 #include "../pic/pic.h"
 #include "../apic/lapic.h"
 #include "../apic/ioapic.h"
+#include "../time/clockevent.h"
+#include "../time/tick.h"
 
 #define MAX_INTERRUPTS 256 // Total number of interrupt vectors
 
-// APIC interrupt vectors
-#define APIC_TIMER_VECTOR 32    // Timer interrupt
-#define APIC_KEYBOARD_VECTOR 33 // Keyboard interrupt (IRQ1)
-
 // Shared IDT - used by all CPUs
 struct InterruptDescriptor64 shared_idt[MAX_INTERRUPTS];
 
@@ -68,8 +66,10 @@ void setup_idt()
     }
 
     // Setup specific hardware interrupt handlers for APIC
-    make_interrupt(idt, APIC_TIMER_VECTOR, (uintptr_t) timer_interrupt);
-    make_interrupt(idt, APIC_KEYBOARD_VECTOR, (uintptr_t) keyboard_handler);
+    make_interrupt(idt, APIC_TIMER_VECTOR, (uintptr_t) interrupt_handler_32);
+    make_interrupt(idt, APIC_KEYBOARD_VECTOR, (uintptr_t) interrupt_handler_33);
+    make_interrupt(idt, APIC_RESCHED_VECTOR, (uintptr_t) interrupt_handler_34);
+    make_interrupt(idt, APIC_TLB_VECTOR, (uintptr_t) interrupt_handler_35);
 
     // Setup CPU exception handlers (vectors 0-31)
     make_interrupt(idt, 0, (uintptr_t) interrupt_handler_0);
@@ -140,8 +140,9 @@ void setup_idt()
     
     LOG_SERIAL("IDT", "PS/2 keyboard enabled, config=0x%x", config);
 
-    // Start APIC timer (10000000 initial count for periodic interrupts)
-    lapic_timer_start(APIC_TIMER_VECTOR, 10000000);
+    // Calibrate the APIC timer against the PIT and start the tick
+    clockevent_init();
+    tick_init_cpu();
 
     // Enable interrupts
     asm("sti");
@@ -166,7 +167,6 @@ void setup_idt_ap()
     // Load IDTR register
     asm volatile("lidt %0" : : "m"(idtr));
 
-    // Initialize this AP's LAPIC (already done in ap_entry, but ensure it)
-    // Start APIC timer for this AP
-    lapic_timer_start(APIC_TIMER_VECTOR, 10000000);
+    // Start the tick on this AP; the BSP already calibrated the timer
+    tick_init_cpu();
 }
@@ -13,6 +13,12 @@
 
 #define NUM_IDT_ENTRIES 256 // Total number of entries in the IDT
 
+// APIC interrupt vectors
+#define APIC_TIMER_VECTOR 32    // Timer interrupt
+#define APIC_KEYBOARD_VECTOR 33 // Keyboard interrupt (IRQ1)
+#define APIC_RESCHED_VECTOR 34  // Reschedule IPI between CPUs
+#define APIC_TLB_VECTOR 35      // TLB flush IPI between CPUs
+
 /**
  * @brief IDTR structure used by lidt instruction
  *
@@ -53,7 +59,7 @@ void setup_idt();
  * @brief Load the IDT on an Application Processor
  *
  * APs share the same IDT as the BSP, but each must load it via LIDT.
- * Also starts the local APIC timer for scheduling.
+ * Also starts the scheduler tick on the AP's local APIC timer.
  */
 void setup_idt_ap();
 
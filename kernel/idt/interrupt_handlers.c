@@ -4,10 +4,12 @@
 //
 // This file contains interrupt handlers for the ShipOS kernel,
 // including keyboard, timer, and default/unhandled interrupts.
-// It also defines error messages for CPU exceptions.
+// It also defines error messages for CPU exceptions. Handlers only
+// acknowledge the hardware; the rest runs in softirqs and workqueues.
 //
 
 #include "interrupt_handlers.h"
+#include "idt.h"
 
 #include "../lib/include/x86_64.h"
 #include "../lib/include/logging.h"
@@ -17,28 +19,47 @@
 #include "../sched/scheduler.h"
 #include "../sched/percpu.h"
 #include "../sched/smp_sched.h"
+#include "../sched/fpu.h"
 #include "../pit/pit.h"
+#include "../vm/vma.h"
+#include "../paging/paging.h"
+#include "../time/tick.h"
+#include "../time/timer.h"
+#include "../sched/softirq.h"
+#include "../sched/workqueue.h"
 
 #define F1 0x3B
 
+// Scancodes read by the interrupt and not yet handled, a power of two
+#define KEYBOARD_RING_SIZE 64
+
 struct interrupt_frame;
 
+static uint8_t keyboard_ring[KEYBOARD_RING_SIZE];
+static uint32_t keyboard_head; // Next scancode to handle
+static uint32_t keyboard_tail; // Next free entry
+static struct spinlock keyboard_lock;
+
 /**
- * @brief Keyboard interrupt handler
+ * @brief Handle the scancodes queued by keyboard_handler()
  *
- * Handles key presses from the keyboard. Switches virtual terminals
- * when function keys F1-F7 are pressed. Other key codes are printed
- * to the current terminal.
- *
- * @param frame Pointer to interrupt frame (automatically passed by CPU)
+ * Runs on a worker thread. Switches virtual terminals when function
+ * keys F1-F7 are pressed. Other key codes are printed to the current
+ * terminal.
  */
-__attribute__((interrupt)) void keyboard_handler(struct interrupt_frame *frame)
+static void keyboard_work_func(void *arg)
 {
-    uint8_t status = inb(0x64);
-    
-    while (status & 1)
+    while (1)
     {
-        uint8_t res = inb(0x60);
+        acquire_spinlock(&keyboard_lock);
+        if (keyboard_head == keyboard_tail)
+        {
+            release_spinlock(&keyboard_lock);
+            break;
+        }
+        uint8_t res = keyboard_ring[keyboard_head++ % KEYBOARD_RING_SIZE];
+        release_spinlock(&keyboard_lock);
+
         LOG_SERIAL("KEYBOARD", "Scancode: 0x%x on CPU %d", res, mycpu()->cpu_index);
 
         if (res >= F1 && res < F1 + TERMINALS_NUMBER)
@@ -49,13 +70,39 @@ __attribute__((interrupt)) void keyboard_handler(struct interrupt_frame *frame)
         {
             printf("%x ", res);
         }
-        
-        status = inb(0x64);
     }
 
     print("\n");
+}
+
+static struct work keyboard_work = {.function = keyboard_work_func};
+
+/**
+ * @brief Keyboard interrupt handler
+ *
+ * Drains the controller's output buffer into the scancode ring and
+ * queues keyboard_work_func() on a worker. Scancodes beyond the ring's
+ * capacity are dropped.
+ */
+void keyboard_handler()
+{
+    uint8_t status = inb(0x64);
+
+    acquire_spinlock(&keyboard_lock);
+    while (status & 1)
+    {
+        uint8_t res = inb(0x60);
+        if (keyboard_tail - keyboard_head < KEYBOARD_RING_SIZE)
+        {
+            keyboard_ring[keyboard_tail++ % KEYBOARD_RING_SIZE] = res;
+        }
+        status = inb(0x64);
+    }
+    release_spinlock(&keyboard_lock);
 
     lapic_eoi();
+
+    queue_work(&keyboard_work);
 }
 
 __attribute__((interrupt)) void default_handler(struct interrupt_frame *frame)
@@ -63,18 +110,26 @@ __attribute__((interrupt)) void default_handler(struct interrupt_frame *frame)
     print("unknown interrupt\n");
 }
 
-__attribute__((interrupt)) void timer_interrupt(struct interrupt_frame *frame)
+void timer_interrupt()
 {
     struct percpu *cpu = mycpu();
 
-    // Increment per-CPU timer tick counter
-    cpu->timer_ticks++;
+    // A CPU started after the last TLB flush IPI catches up here
+    pt_flush_check();
+
+    // A due timer is left out of the re-arm below; the TIMER softirq runs
+    // the wheel and arms the device for the next one
+    timer_irq_due();
+
+    // Re-arm the one-shot timer and count the tick periods that passed
+    uint64_t ticks = tick_handle_interrupt();
+    cpu->timer_ticks += ticks;
 
     // Send EOI first to acknowledge the interrupt
     lapic_eoi();
 
     // Use SMP scheduler if ready, otherwise skip scheduling
-    if (cpu->scheduler_ready)
+    if (ticks != 0 && cpu->scheduler_ready)
     {
         sched_tick();
     }
@@ -140,3 +195,50 @@ void interrupt_handler(uint64_t error_code, uint64_t interrupt_number)
     {
     }
 }
+
+void trap(struct trap_frame *tf)
+{
+    switch (tf->vector)
+    {
+    case 14:
+        if (!handle_page_fault(rcr2(), tf->error_code))
+        {
+            LOG_SERIAL("EXCEPTION", "Unhandled page fault at rip 0x%lx", tf->rip);
+            interrupt_handler(tf->error_code, tf->vector);
+        }
+        return;
+    case 7:
+        // Device not available: first FPU/SIMD use since the last switch
+        fpu_trap();
+        return;
+    case APIC_TIMER_VECTOR:
+        timer_interrupt();
+        break;
+    case APIC_KEYBOARD_VECTOR:
+        keyboard_handler();
+        break;
+    case APIC_RESCHED_VECTOR:
+        sched_resched_interrupt();
+        break;
+    case APIC_TLB_VECTOR:
+        pt_flush_check();
+        lapic_eoi();
+        break;
+    default:
+        interrupt_handler(tf->error_code, tf->vector);
+        return;
+    }
+
+    // Bottom halves raised by the handler, with interrupts enabled again
+    if (tf->rflags & FL_IF)
+    {
+        softirq_run_pending();
+    }
+
+    // Preempt only code that could have been interrupted anyway, i.e. ran
+    // with interrupts enabled, outside any preempt_disable() section
+    if ((tf->rflags & FL_IF) && sched_need_preempt())
+    {
+        sched_preempt();
+    }
+}
@@ -23,16 +23,18 @@ void keyboard_handler_wrapper();
 /**
  * @brief Keyboard interrupt handler
  *
- * Handles key presses from the keyboard. Switches virtual terminals
- * when function keys F1-F7 are pressed. Other key codes are printed.
+ * Reads the pending scancodes, sends EOI and queues work that switches
+ * virtual terminals on F1-F7 and prints the other key codes.
  */
 void keyboard_handler();
 
 /**
  * @brief Timer interrupt handler
  *
- * Sends timing information to the scheduler, performs context switching
- * between threads, and sends End-of-Interrupt (EOI) to the PIC.
+ * Counts the tick, raises the TIMER softirq if a timer is due, sends
+ * End-of-Interrupt (EOI) to the LAPIC and charges the tick to the running
+ * thread's time slice. The switch itself happens in trap() on the way out
+ * of the interrupt.
  */
 void timer_interrupt();
 
@@ -57,6 +59,53 @@ void default_handler();
  */
 void interrupt_handler(uint64_t, uint64_t);
 
+/**
+ * @brief Register state saved by the interrupt stubs
+ *
+ * Built on the interrupted stack by common_interrupt_handler in
+ * interrupt_stub.asm; field order mirrors the push order in reverse.
+ */
+struct trap_frame
+{
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t r11;
+    uint64_t r10;
+    uint64_t r9;
+    uint64_t r8;
+    uint64_t rsi;
+    uint64_t rdi;
+    uint64_t rbp;
+    uint64_t rdx;
+    uint64_t rcx;
+    uint64_t rbx;
+    uint64_t rax;
+
+    uint64_t vector;     // Pushed by the stub
+    uint64_t error_code; // Pushed by the CPU, or 0 by the stub
+
+    // Pushed by the CPU
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+};
+
+/**
+ * @brief Common C entry point for all stub-based interrupts
+ *
+ * Dispatches on tf->vector: page faults go to the demand pager, the
+ * LAPIC timer and keyboard to their handlers, and any other exception is
+ * fatal. Before returning from a hardware interrupt the pending softirqs
+ * run and the current thread is preempted if its time slice has expired.
+ *
+ * @param tf Trap frame on the interrupted stack
+ */
+void trap(struct trap_frame *tf);
+
 void interrupt_handler_0();
 void interrupt_handler_1();
 void interrupt_handler_2();
@@ -89,5 +138,9 @@ void interrupt_handler_28();
 void interrupt_handler_29();
 void interrupt_handler_30();
 void interrupt_handler_31();
+void interrupt_handler_32();
+void interrupt_handler_33();
+void interrupt_handler_34();
+void interrupt_handler_35();
 
 #endif // UNTITLED_OS_INTERRUPT_HANDLERS_H
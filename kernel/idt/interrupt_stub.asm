@@ -7,11 +7,14 @@
 ; saving/restoring CPU registers before calling the C handler.
 ; -------------------------------------------------------------------
 
-extern interrupt_handler    ; declare the common C interrupt handler
+extern trap                 ; declare the common C interrupt handler
 
 ; -------------------------------------------------------------------
 ; Macros for defining interrupt handlers
 ; -------------------------------------------------------------------
+; Every stub builds a struct trap_frame (see interrupt_handlers.h):
+; general-purpose registers, vector number, error code and the frame
+; pushed by the CPU, so the C side can inspect and resume any context.
 
 ; -------------------------------------------------------------------
 ; no_error_code_interrupt_handler <INT_NUM>
@@ -23,8 +26,8 @@ extern interrupt_handler    ; declare the common C interrupt handler
 %macro no_error_code_interrupt_handler 1
 global interrupt_handler_%1
 interrupt_handler_%1:
-    mov rdi, qword 0             ; push 0 as error code
-    mov rsi, qword %1            ; push the interrupt number
+    push qword 0                 ; push 0 as error code
+    push qword %1                ; push the interrupt number
     jmp common_interrupt_handler
 %endmacro
 
@@ -32,22 +35,25 @@ interrupt_handler_%1:
 ; error_code_interrupt_handler <INT_NUM>
 ; -------------------------------------------------------------------
 ; Generates a handler for interrupts/exceptions that automatically
-; push an error code on the stack. Pops the error code into rdi
-; and pushes the interrupt number into rsi for the C handler.
+; push an error code on the stack. The error code is left in place
+; and the interrupt number is pushed after it.
 
 %macro error_code_interrupt_handler 1
 global interrupt_handler_%1
 interrupt_handler_%1:
-    pop rdi                      ; retrieve error code
-    mov rsi, qword %1            ; push the interrupt number
+    push qword %1                ; push the interrupt number
     jmp common_interrupt_handler
 %endmacro
 
 ; -------------------------------------------------------------------
 ; common_interrupt_handler
 ; -------------------------------------------------------------------
-; Saves all general-purpose registers, calls the common C handler,
-; then restores registers and returns from the interrupt.
+; Saves all general-purpose registers, calls trap() with a pointer to
+; the frame, then restores registers and returns from the interrupt.
+; trap() may switch to another thread before returning; the frame stays
+; on this thread's stack until it is resumed.
+; The CPU aligns RSP to 16 bytes before pushing its frame, and the
+; 22 quadwords pushed in total keep it aligned for the call.
 
 common_interrupt_handler:
     ; Save general-purpose registers
@@ -68,7 +74,8 @@ common_interrupt_handler:
     push r15
 
     ; Call C interrupt handler
-    call interrupt_handler
+    mov rdi, rsp
+    call trap
 
     ; Restore general-purpose registers
     pop r15
@@ -87,8 +94,11 @@ common_interrupt_handler:
     pop rbx
     pop rax
 
+    ; Drop the interrupt number and error code
+    add rsp, 16
+
     ; Return to interrupted code
-    iret
+    iretq
 
 ; -------------------------------------------------------------------
 ; Instantiate all interrupt handlers
@@ -126,3 +136,9 @@ no_error_code_interrupt_handler 28
 error_code_interrupt_handler    29
 error_code_interrupt_handler    30
 no_error_code_interrupt_handler 31
+
+; Local APIC timer, keyboard, reschedule IPI and TLB flush IPI interrupts
+no_error_code_interrupt_handler 32
+no_error_code_interrupt_handler 33
+no_error_code_interrupt_handler 34
+no_error_code_interrupt_handler 35
@@ -19,17 +19,18 @@ struct {
 void kinit(uint64_t start, uint64_t stop) {
     // TODO Race Cond.
     //  init_spinlock(&kmem.lock, "kmem");
-    char *p;
-    p = (char *) PGROUNDUP(start);
+    uint64_t p;
+    p = PGROUNDUP(start);
     for (; p + PGSIZE < stop; p += PGSIZE)
-        kfree(p);
+        kfree(P2V(p));
 }
 
 void kfree(void *pa) {
     // TODO Race Cond.
     struct run *r;
 
-    if (((uint64_t) pa % PGSIZE) != 0 || (char *) pa < end || (uint64_t) pa >= PHYSTOP) {
+    if (((uint64_t) pa % PGSIZE) != 0 || (uint64_t) pa < DIRECT_MAP_BASE ||
+        V2P(pa) < V2P(end) || V2P(pa) >= PHYSTOP) {
         LOG("Panic while trying to free memory\nPA: %p END: %p PHYSTOP: %p", pa, end, PHYSTOP);
         panic("kfree");
     }
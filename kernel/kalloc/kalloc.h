@@ -4,7 +4,9 @@
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
 
+// Adds physical range [start, stop) to the allocator
 void kinit(uint64_t, uint64_t);
+// Returns a page addressed through the direct map (see P2V)
 void *kalloc(void);
 void kfree(void*);
 uint64_t count_pages();
@@ -0,0 +1,158 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Physical memory map from the multiboot2 information structure.
+//
+
+#include "memmap.h"
+#include "kalloc.h"
+#include "../memlayout.h"
+#include "../lib/include/logging.h"
+
+#define MULTIBOOT_TAG_END  0
+#define MULTIBOOT_TAG_MMAP 6
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+#define MEMMAP_ALIGN (2 * 1024 * 1024)
+
+// Saved by boot.asm from ebx
+extern uint32_t multiboot_info_phys;
+
+struct multiboot_tag
+{
+    uint32_t type;
+    uint32_t size;
+};
+
+struct multiboot_mmap_entry
+{
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+struct multiboot_tag_mmap
+{
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+};
+
+uint64_t phystop = MEMMAP_DEFAULT_TOP;
+
+static struct memmap_region ram[MEMMAP_MAX_REGIONS];
+static int nr_ram;
+
+/**
+ * @brief Keep the part of [start, end) the direct map can cover
+ *
+ * Below BOOT_DIRECT_MAP_END boot.asm maps everything; above it kvminit()
+ * maps whole 2 MB pages, so a partial page at either end is dropped.
+ */
+static void add_ram(uint64_t start, uint64_t end)
+{
+    start = PGROUNDUP(start);
+    end = PGROUNDDOWN(end);
+    if (end > DIRECT_MAP_SIZE)
+    {
+        end = DIRECT_MAP_SIZE;
+    }
+    if (start > BOOT_DIRECT_MAP_END)
+    {
+        start = (start + MEMMAP_ALIGN - 1) & ~(uint64_t) (MEMMAP_ALIGN - 1);
+    }
+    if (end > BOOT_DIRECT_MAP_END)
+    {
+        // Still at least BOOT_DIRECT_MAP_END, which is 2 MB aligned
+        end &= ~(uint64_t) (MEMMAP_ALIGN - 1);
+    }
+    if (start >= end)
+    {
+        return;
+    }
+    if (nr_ram == MEMMAP_MAX_REGIONS)
+    {
+        LOG_SERIAL("MEMMAP", "Too many RAM regions, ignoring 0x%llx-0x%llx", start, end);
+        return;
+    }
+
+    ram[nr_ram].start = start;
+    ram[nr_ram].end = end;
+    nr_ram++;
+}
+
+void memmap_init(void)
+{
+    if (multiboot_info_phys != 0)
+    {
+        uint8_t *info = P2V(multiboot_info_phys);
+        uint32_t total_size = *(uint32_t *) info;
+
+        // Tags follow the 8-byte header, each padded to 8 bytes
+        for (uint32_t off = 8; off + sizeof(struct multiboot_tag) <= total_size;)
+        {
+            struct multiboot_tag *tag = (struct multiboot_tag *) (info + off);
+            if (tag->type == MULTIBOOT_TAG_END)
+            {
+                break;
+            }
+            if (tag->type == MULTIBOOT_TAG_MMAP)
+            {
+                struct multiboot_tag_mmap *mmap = (struct multiboot_tag_mmap *) tag;
+                for (uint32_t e = sizeof(*mmap); e + sizeof(struct multiboot_mmap_entry) <= mmap->size;
+                     e += mmap->entry_size)
+                {
+                    struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *) ((uint8_t *) mmap + e);
+                    if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+                    {
+                        add_ram(entry->base, entry->base + entry->length);
+                    }
+                }
+            }
+            off += (tag->size + 7) & ~7u;
+        }
+    }
+
+    if (nr_ram == 0)
+    {
+        LOG_SERIAL("MEMMAP", "No memory map from the boot loader, assuming RAM up to 0x%llx",
+                   (uint64_t) MEMMAP_DEFAULT_TOP);
+        add_ram(0, MEMMAP_DEFAULT_TOP);
+    }
+
+    uint64_t total = 0;
+    phystop = 0;
+    for (int i = 0; i < nr_ram; i++)
+    {
+        LOG_SERIAL("MEMMAP", "RAM 0x%llx-0x%llx", ram[i].start, ram[i].end);
+        total += ram[i].end - ram[i].start;
+        if (ram[i].end > phystop)
+        {
+            phystop = ram[i].end;
+        }
+    }
+    LOG_SERIAL("MEMMAP", "%llu MB of RAM in %d regions, PHYSTOP 0x%llx", total >> 20, nr_ram, phystop);
+}
+
+int memmap_ram(const struct memmap_region **regions)
+{
+    *regions = ram;
+    return nr_ram;
+}
+
+void memmap_kinit(uint64_t start, uint64_t end)
+{
+    for (int i = 0; i < nr_ram; i++)
+    {
+        uint64_t lo = ram[i].start > start ? ram[i].start : start;
+        uint64_t hi = ram[i].end < end ? ram[i].end : end;
+        if (lo < hi)
+        {
+            kinit(lo, hi);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Physical memory map from the multiboot2 information structure: the RAM
+// the direct map covers and kalloc() may hand out.
+//
+
+#ifndef SHIPOS_MEMMAP_H
+#define SHIPOS_MEMMAP_H
+
+#include <stdint.h>
+
+// RAM regions kept from the boot loader's map; the rest are ignored
+#define MEMMAP_MAX_REGIONS 32
+
+// Assumed RAM when the boot loader passes no memory map
+#define MEMMAP_DEFAULT_TOP (128 * 1024 * 1024)   // 128 MB
+
+/**
+ * @brief Physical range [start, end) of usable RAM
+ */
+struct memmap_region
+{
+    uint64_t start;
+    uint64_t end;
+};
+
+/**
+ * @brief Copy the RAM regions out of the multiboot2 information
+ *
+ * Must run before kinit(), like cmdline_init(). Regions above the boot
+ * direct map are trimmed to 2 MB boundaries so kvminit() can map them
+ * with large pages, and PHYSTOP is set to the end of the highest one.
+ */
+void memmap_init(void);
+
+/**
+ * @brief Get the RAM regions, in boot loader order
+ *
+ * @param regions Set to the first region
+ * @return Number of regions
+ */
+int memmap_ram(const struct memmap_region **regions);
+
+/**
+ * @brief Hand the RAM inside [start, end) to the allocator
+ *
+ * Reserved ranges, ACPI tables and device windows in between are skipped.
+ */
+void memmap_kinit(uint64_t start, uint64_t end);
+
+#endif // SHIPOS_MEMMAP_H
@@ -0,0 +1,21 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// SIMD helpers, built from *_simd.c files with SSE enabled. Call them only
+// from threads: the first use faults in the thread's FPU state (fpu.h), so
+// they must not run in interrupt handlers or the scheduler loop.
+//
+
+#ifndef SHIP_OS_SIMD_H
+#define SHIP_OS_SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Sum 32-bit words, wrapping modulo 2^32
+ */
+uint32_t sum32_simd(const uint32_t *data, size_t count);
+
+#endif
@@ -8,27 +8,49 @@
 
 #include <stdint.h>
 
+// Frame saved by switch_context(): the callee-saved registers and the
+// return address. In a new thread's first frame it is followed by the
+// start function's arguments and address, consumed by thread_entry; on a
+// switched-out thread those slots are its live stack.
 struct __attribute__((packed, aligned(8))) context {
-    uint64_t rax;
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
     uint64_t rbx;
-    uint64_t rcx;
-    uint64_t rdx;
-    uint64_t rsi;
-    uint64_t rdi;
     uint64_t rbp;
-    uint64_t r8;
-    uint64_t r9;
-    uint64_t r10;
-    uint64_t r11;
-    uint64_t r12;
-    uint64_t r13;
-    uint64_t r14;
-    uint64_t r15;
     uint64_t rip;
+    uint64_t rdi;   // New thread only
+    uint64_t rsi;   // New thread only
+    uint64_t entry; // New thread only
 };
 
 extern void switch_context(struct context **old, struct context * new);
 
+// Start of every thread, see swtch.asm
+extern void thread_entry(void);
+
+// Where a returning start function lands: calls sched_exit()
+extern void thread_exit(void);
+
+// Interrupt flag in EFLAGS
+#define FL_IF 0x00000200
+
+static inline uint64_t
+read_eflags(void) {
+    uint64_t eflags;
+    asm volatile("pushfq; popq %0" : "=r"(eflags));
+    return eflags;
+}
+
+// Index of the least significant set bit; x must be non-zero
+static inline uint32_t
+bsf(uint32_t x) {
+    uint32_t index;
+    asm("bsf %1, %0" : "=r"(index) : "rm"(x));
+    return index;
+}
+
 static inline void
 cli(void) {
     asm volatile("cli");
@@ -97,6 +119,18 @@ rcr2(void) {
 }
 
 
+static inline uint64_t
+rcr0(void) {
+    uint64_t val;
+    asm volatile("mov %%cr0,%0" : "=r" (val));
+    return val;
+}
+
+static inline void
+wcr0(uint64_t val) {
+    asm volatile("mov %0,%%cr0" : : "r" (val) : "memory");
+}
+
 static inline uint64_t
 rcr3(void) {
     uint64_t val;
@@ -110,5 +144,54 @@ wcr3(uint64_t val) {
     asm("mov %rax, %cr3");
 }
 
+static inline uint64_t
+rcr4(void) {
+    uint64_t val;
+    asm volatile("mov %%cr4,%0" : "=r" (val));
+    return val;
+}
+
+static inline void
+wcr4(uint64_t val) {
+    asm volatile("mov %0,%%cr4" : : "r" (val) : "memory");
+}
+
+// regs receives eax, ebx, ecx, edx
+static inline void
+cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+    asm volatile("cpuid"
+                 : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                 : "a" (leaf), "c" (subleaf));
+}
+
+static inline uint64_t
+rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void
+wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)val), "d" ((uint32_t)(val >> 32)) : "memory");
+}
+
+static inline uint64_t
+rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void
+wbinvd(void) {
+    asm volatile("wbinvd" : : : "memory");
+}
+
+static inline void
+sfence(void) {
+    asm volatile("sfence" : : : "memory");
+}
+
 
 #endif // X86_64_H
\ No newline at end of file
@@ -0,0 +1,30 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "../include/simd.h"
+
+// Four lanes of one XMM register; loads need only the words' alignment
+typedef uint32_t u32x4 __attribute__((vector_size(16), aligned(4)));
+
+uint32_t sum32_simd(const uint32_t *data, size_t count)
+{
+    u32x4 acc0 = {0, 0, 0, 0};
+    u32x4 acc1 = {0, 0, 0, 0};
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 += *(const u32x4 *) (data + i);
+        acc1 += *(const u32x4 *) (data + i + 4);
+    }
+
+    acc0 += acc1;
+    uint32_t sum = acc0[0] + acc0[1] + acc0[2] + acc0[3];
+    for (; i < count; i++)
+    {
+        sum += data[i];
+    }
+    return sum;
+}
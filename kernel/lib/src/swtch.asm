@@ -1,55 +1,60 @@
 section .text
     global switch_context
+    global fiber_switch
+    global thread_entry
+    global thread_exit
+
+    extern sched_exit
 
 ; Контекстное переключение
 ;
 ;   void switch_context(struct context **old, struct context *new);
+;   void fiber_switch(struct fiber_frame **old, struct fiber_frame *new);
 ;
-; Сохраняет текущие значения регистров в стеке, создавая
-; структуру context, и сохраняет её адрес в *old.
-; Переключает стек на новый и извлекает ранее сохранённые значения регистров.
+; Сохраняет callee-saved регистры в стеке, создавая структуру context,
+; и сохраняет её адрес в *old. Переключает стек на новый и извлекает
+; ранее сохранённые значения регистров. Остальные регистры по ABI
+; вызывающий код уже считает испорченными, поэтому их не сохраняем.
+; Волокна (fibers) переключаются тем же кодом.
 
 switch_context:
-    ; Загружаем адрес структуры context из стека в eax
-
-    ; Загружаем адрес нового контекста из стека в rdx
-
-    ; Сохраняем значения callee-saved регистров
-    push r15
-    push r14
-    push r13
-    push r12
-    push r11
-    push r10
-    push r9
-    push r8
+fiber_switch:
     push rbp
-    push rdi
-    push rsi
-    push rdx
-    push rcx
     push rbx
-    push rax
+    push r12
+    push r13
+    push r14
+    push r15
 
     ; Переключаем стеки
     mov [rdi], rsp
     mov rsp, rsi
 
-    ; Восстанавливаем значения callee-saved регистров нового контекста
-    pop rax
+    ; Восстанавливаем callee-saved регистры нового контекста
+    pop r15
+    pop r14
+    pop r13
+    pop r12
     pop rbx
-    pop rcx
-    pop rdx
-    pop rsi
-    pop rdi
     pop rbp
-    pop r8
-    pop r9
-    pop r10
-    pop r11
-    pop r12
-    pop r13
-    pop r14
-    pop r15
     ; Возвращаемся из функции
-    ret
\ No newline at end of file
+    ret
+
+; Первый код нового потока: switch_context возвращается сюда, а аргументы
+; функции потока лежат в стеке сразу за сохранёнными регистрами
+; (поля rdi, rsi и entry структуры context).
+
+thread_entry:
+    ; Планировщик переключает потоки с выключенными прерываниями
+    sti
+    pop rdi
+    pop rsi
+    ret
+
+; Адрес возврата функции потока: если она вернулась, не вызвав sched_exit,
+; завершаем поток здесь. Сюда попадаем через ret, поэтому стек смещён
+; на 8 байт относительно вызова; выравниваем его перед call.
+
+thread_exit:
+    and rsp, -16
+    call sched_exit
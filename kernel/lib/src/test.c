@@ -10,6 +10,25 @@
 #include "../../paging/paging.h"
 #include "../../kalloc/kalloc.h"
 #include "../../memlayout.h"
+#include "../../paging/pat.h"
+#include "../../paging/ioremap.h"
+#include "../../vga/vga.h"
+#include "../../vm/vma.h"
+#include "../../sync/spinlock.h"
+#include "../../sched/percpu.h"
+#include "../../sched/smp_sched.h"
+#include "../../sched/topology.h"
+#include "../../sched/fiber.h"
+#include "../../sched/waitqueue.h"
+#include "../../sync/mutex.h"
+#include "../include/simd.h"
+#include "../../time/clockevent.h"
+#include "../../time/tick.h"
+#include "../../time/timer.h"
+#include "../../sync/futex.h"
+#include "../../sched/softirq.h"
+#include "../../sched/workqueue.h"
+#include "../../sched/parallel.h"
 
 int test_addition() {
     int a = 1;
@@ -115,7 +134,7 @@ int test_kalloc_kfree_consistency() {
  * mapped address (kernel code area).
  */
 int test_walk_existing_mapping() {
-    pagetable_t tbl = (pagetable_t)rcr3();
+    pagetable_t tbl = current_pagetable();
     
     // Walk to an address we know is mapped (kernel start area)
     uint64_t kernel_addr = KSTART;
@@ -138,7 +157,7 @@ int test_walk_existing_mapping() {
  * that a page table entry is created.
  */
 int test_walk_allocates_new_entry() {
-    pagetable_t tbl = (pagetable_t)rcr3();
+    pagetable_t tbl = current_pagetable();
     
     // Pick an address that's likely not mapped (high in virtual space)
     // Use a specific pattern that shouldn't conflict with kernel mappings
@@ -155,10 +174,46 @@ int test_walk_allocates_new_entry() {
         return 0;  // Failed: couldn't allocate
     }
     
+    // Release the tables allocated by the walk
+    unmap_page(tbl, test_va);
+    
     // Verify we got a valid entry pointer
     return entry_with_alloc != 0;
 }
 
+/**
+ * @brief Test that unmapping releases empty intermediate tables
+ * 
+ * Maps a page in an unused 512 GiB region, so a fresh PDPT, PD and PT
+ * are allocated, then checks that unmap_page returns all of them.
+ */
+int test_unmap_frees_page_tables() {
+    pagetable_t tbl = current_pagetable();
+    uint64_t test_va = 0x9000000000ULL;  // 576GB, PML4 slot 1
+    
+    void *phys_page = kalloc();
+    if (phys_page == 0) {
+        return 0;
+    }
+    
+    struct pagetable_stats before = get_pagetable_stats();
+    
+    if (map_page(tbl, test_va, V2P(phys_page), PTE_W) != 0) {
+        kfree(phys_page);
+        return 0;
+    }
+    
+    struct pagetable_stats mapped = get_pagetable_stats();
+    unmap_page(tbl, test_va);
+    struct pagetable_stats after = get_pagetable_stats();
+    
+    kfree(phys_page);
+    
+    return (mapped.in_use == before.in_use + 3) &&
+           (after.in_use == before.in_use) &&
+           (walk(tbl, test_va, 0) == 0);
+}
+
 /**
  * @brief Test that memory can be written and read back correctly
  * 
@@ -331,7 +386,7 @@ int test_memory_isolation() {
  * and verifies data can be written and read.
  */
 int test_map_page() {
-    pagetable_t tbl = (pagetable_t)rcr3();
+    pagetable_t tbl = current_pagetable();
     
     // Allocate a physical page
     void *phys_page = kalloc();
@@ -343,7 +398,7 @@ int test_map_page() {
     uint64_t test_va = 0x500000000ULL;  // 20GB virtual address
     
     // Map the page with read/write permissions
-    int result = map_page(tbl, test_va, (uint64_t)phys_page, PTE_W);
+    int result = map_page(tbl, test_va, V2P(phys_page), PTE_W);
     if (result != 0) {
         kfree(phys_page);
         return 0;
@@ -373,7 +428,7 @@ int test_map_page() {
  * Maps a page and verifies the translation returns the correct PA.
  */
 int test_va_to_pa() {
-    pagetable_t tbl = (pagetable_t)rcr3();
+    pagetable_t tbl = current_pagetable();
     
     void *phys_page = kalloc();
     if (phys_page == 0) {
@@ -381,7 +436,7 @@ int test_va_to_pa() {
     }
     
     uint64_t test_va = 0x600000000ULL;
-    uint64_t expected_pa = (uint64_t)phys_page;
+    uint64_t expected_pa = V2P(phys_page);
     
     if (map_page(tbl, test_va, expected_pa, PTE_W) != 0) {
         kfree(phys_page);
@@ -410,7 +465,7 @@ int test_va_to_pa() {
  * Maps a page, then unmaps it, and verifies the translation fails.
  */
 int test_unmap_page() {
-    pagetable_t tbl = (pagetable_t)rcr3();
+    pagetable_t tbl = current_pagetable();
     
     void *phys_page = kalloc();
     if (phys_page == 0) {
@@ -419,7 +474,7 @@ int test_unmap_page() {
     
     uint64_t test_va = 0x700000000ULL;
     
-    if (map_page(tbl, test_va, (uint64_t)phys_page, PTE_W) != 0) {
+    if (map_page(tbl, test_va, V2P(phys_page), PTE_W) != 0) {
         kfree(phys_page);
         return 0;
     }
@@ -449,7 +504,7 @@ int test_unmap_page() {
  * Maps multiple pages and verifies they're all accessible.
  */
 int test_map_pages_range() {
-    pagetable_t tbl = (pagetable_t)rcr3();
+    pagetable_t tbl = current_pagetable();
     
     // Allocate 3 contiguous pages
     void *phys_pages[3];
@@ -468,7 +523,7 @@ int test_map_pages_range() {
     // Map all 3 pages individually (map_pages expects contiguous physical memory)
     int success = 1;
     for (int i = 0; i < 3; i++) {
-        if (map_page(tbl, test_va + i * PGSIZE, (uint64_t)phys_pages[i], PTE_W) != 0) {
+        if (map_page(tbl, test_va + i * PGSIZE, V2P(phys_pages[i]), PTE_W) != 0) {
             success = 0;
             break;
         }
@@ -500,6 +555,1492 @@ int test_map_pages_range() {
     return success;
 }
 
+/**
+ * @brief Test that ioremap reuses and releases registered mappings
+ * 
+ * Maps two ranges inside one unused physical page, expecting one page-table
+ * edit and one registry hit, and checks that the page is unmapped only
+ * after the second iounmap.
+ */
+int test_ioremap_registry() {
+    pagetable_t tbl = current_pagetable();
+    uint64_t test_pa = 0xC0000000ULL;  // PCI hole, nothing mapped here
+    
+    struct ioremap_stats before = get_ioremap_stats();
+    struct pagetable_stats pt_before = get_pagetable_stats();
+    
+    void *first = ioremap(test_pa, 64);
+    void *second = ioremap(test_pa + 128, 64);
+    if (first == 0 || second == 0) {
+        return 0;
+    }
+    
+    struct ioremap_stats mapped = get_ioremap_stats();
+    page_entry_raw *pte = (page_entry_raw *)walk(tbl, (uint64_t)P2V(test_pa), 0);
+    int success = (mapped.misses == before.misses + 1) &&
+                  (mapped.hits == before.hits + 1) &&
+                  (second == P2V(test_pa + 128)) &&
+                  (pte != 0) && ((*pte & (PTE_P | PTE_PCD)) == (PTE_P | PTE_PCD));
+    
+    iounmap(first);
+    pte = (page_entry_raw *)walk(tbl, (uint64_t)P2V(test_pa), 0);
+    success = success && (pte != 0) && (*pte & PTE_P);
+    
+    iounmap(second);
+    success = success &&
+              (walk(tbl, (uint64_t)P2V(test_pa), 0) == 0) &&
+              (get_ioremap_stats().regions == before.regions) &&
+              (get_pagetable_stats().in_use == pt_before.in_use);
+    
+    return success;
+}
+
+/**
+ * @brief Test the higher-half layout and the physical direct map
+ * 
+ * Checks P2V/V2P round trips for the direct map and the kernel image,
+ * that a kalloc'd page translates back to its physical address, and that
+ * the low identity map is gone after AP bring-up.
+ */
+int test_direct_map() {
+    pagetable_t tbl = current_pagetable();
+    void *page = kalloc();
+    if (page == 0) {
+        return 0;
+    }
+    
+    uint64_t pa = V2P(page);
+    int success = ((uint64_t)page >= DIRECT_MAP_BASE) &&
+                  (P2V(pa) == page) &&
+                  (va_to_pa(tbl, (uint64_t)page) == pa) &&
+                  (V2P(KSTART) == 0x100000) &&
+                  (V2P(P2V(PHYSTOP - PGSIZE)) == PHYSTOP - PGSIZE) &&
+                  (mapping_size(tbl, (uint64_t)P2V(PHYSTOP - PGSIZE)) != 0) &&
+                  (mapping_size(tbl, 0x100000) == 0);
+    
+    kfree(page);
+    return success;
+}
+
+#define DEMAND_TEST_PAGES 16
+
+/**
+ * @brief Touch every page of a fresh anonymous region
+ * 
+ * @param fault_around Pages mapped per fault
+ * @param faults Set to the number of faults taken
+ * @return 1 if pages read back zero-filled and keep written values
+ */
+static int touch_anon_region(uint32_t fault_around, uint64_t *faults) {
+    struct address_space *as = current_address_space();
+    vm_set_fault_around(fault_around);
+    
+    uint64_t *region = vm_map_anon(as, DEMAND_TEST_PAGES * PGSIZE, VMA_READ | VMA_WRITE);
+    if (region == 0) {
+        return 0;
+    }
+    
+    uint64_t before = get_vm_fault_stats().faults;
+    int success = 1;
+    for (int i = 0; i < DEMAND_TEST_PAGES; i++) {
+        volatile uint64_t *word = (volatile uint64_t *)((uint64_t)region + i * PGSIZE);
+        success = success && (*word == 0);
+        *word = 0xD00D0000 + i;
+    }
+    *faults = get_vm_fault_stats().faults - before;
+    
+    for (int i = 0; i < DEMAND_TEST_PAGES; i++) {
+        volatile uint64_t *word = (volatile uint64_t *)((uint64_t)region + i * PGSIZE);
+        success = success && (*word == (uint64_t)(0xD00D0000 + i));
+    }
+    
+    success = success && (vm_unmap_anon(as, region) == 0) &&
+              (mapping_size(as->pgtbl, (uint64_t)region) == 0);
+    return success;
+}
+
+/**
+ * @brief Test demand-paged anonymous memory and fault-around
+ * 
+ * Sequentially touches a region with fault-around disabled (one fault per
+ * page) and with an 8-page window (one fault per window), and checks that
+ * unmapping returns every frame to the allocator.
+ */
+int test_demand_paging() {
+    uint64_t free_before = count_pages();
+    uint64_t single_faults = 0;
+    uint64_t around_faults = 0;
+    
+    int success = touch_anon_region(1, &single_faults) &&
+                  touch_anon_region(8, &around_faults);
+    vm_set_fault_around(VM_FAULT_AROUND_DEFAULT);
+    
+    log_vm_fault_stats();
+    LOG("Demand paging: %d faults without fault-around, %d with 8 pages",
+        single_faults, around_faults);
+    
+    return success &&
+           (single_faults == DEMAND_TEST_PAGES) &&
+           (around_faults == DEMAND_TEST_PAGES / 8) &&
+           (count_pages() == free_before);
+}
+
+#define CONSOLE_BENCH_ITERATIONS 256
+
+/**
+ * @brief Time full-screen redraws through the current VGA mapping
+ * 
+ * @param frame Screen contents to redraw
+ * @return TSC cycles spent in CONSOLE_BENCH_ITERATIONS write_buffer() calls
+ */
+static uint64_t bench_console_redraw(struct char_with_color *frame) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < CONSOLE_BENCH_ITERATIONS; i++) {
+        write_buffer(frame);
+    }
+    return rdtsc() - start;
+}
+
+/**
+ * @brief Console throughput with uncached vs write-combining VGA mappings
+ * 
+ * Redraws the current screen through an ioremap() mapping and then through
+ * the console's ioremap_wc() one, logging cycles per frame for both. Checks
+ * that the WC mapping selects PAT entry 4 and that the screen survives the
+ * remap.
+ */
+int test_console_write_combining() {
+    pagetable_t tbl = current_pagetable();
+    struct char_with_color *frame = kalloc();
+    if (frame == 0) {
+        return 0;
+    }
+    
+    struct char_with_color *screen = vga_buffer();
+    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
+        frame[i] = screen[i];
+    }
+    
+    // Borrow the console's write-combining region for the uncached run;
+    // vga_enable_write_combining() takes it back on every path. Both map
+    // the buffer at its direct-map address, where write_buffer() draws
+    iounmap(screen);
+    uint64_t uc_cycles = 0;
+    void *uc = ioremap(VGA_PHYS_ADDRESS, VGA_BUFFER_SIZE);
+    if (uc != 0) {
+        uc_cycles = bench_console_redraw(frame);
+        iounmap(uc);
+    }
+    int restored = vga_enable_write_combining() == 0;
+    uint64_t wc_cycles = restored ? bench_console_redraw(frame) : 0;
+    
+    LOG_SERIAL("BENCH", "console redraw: UC %llu cycles/frame, WC %llu cycles/frame",
+               uc_cycles / CONSOLE_BENCH_ITERATIONS, wc_cycles / CONSOLE_BENCH_ITERATIONS);
+    
+    page_entry_raw *pte = (page_entry_raw *)walk(tbl, (uint64_t)P2V(VGA_PHYS_ADDRESS), 0);
+    int success = (uc != 0) && restored && (pte != 0) &&
+                  ((*pte & (PTE_PAT | PTE_PCD | PTE_PWT)) == PTE_PAT);
+    
+    screen = vga_buffer();
+    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT && success; i++) {
+        success = (screen[i].character == frame[i].character) &&
+                  (screen[i].color == frame[i].color);
+    }
+    
+    kfree(frame);
+    return success;
+}
+
+/**
+ * @brief Test that spinlocks disable preemption while held
+ * 
+ * Nested spinlocks must raise preempt_count once each and block
+ * preemption even with a reschedule pending.
+ */
+int test_preempt_count() {
+    struct spinlock outer, inner;
+    init_spinlock(&outer, "test_outer");
+    init_spinlock(&inner, "test_inner");
+    
+    struct percpu *cpu = mycpu();
+    int base = cpu->preempt_count;
+    bool pending = cpu->need_resched;
+    
+    acquire_spinlock(&outer);
+    int success = (cpu->preempt_count == base + 1);
+    acquire_spinlock(&inner);
+    success = success && (cpu->preempt_count == base + 2);
+    cpu->need_resched = true;
+    success = success && !sched_need_preempt();
+    cpu->need_resched = pending;
+    release_spinlock(&inner);
+    success = success && (cpu->preempt_count == base + 1);
+    release_spinlock(&outer);
+    
+    return success && (cpu->preempt_count == base);
+}
+
+/**
+ * @brief Test that the run queue picks by priority, FIFO within a level
+ * 
+ * Queues four threads on this CPU and checks the dequeue order. Runs
+ * before the scheduler starts, so the queue is otherwise empty.
+ */
+int test_priority_pick_order() {
+    static const int prios[] = {20, 5, 10, 5};
+    static const int expected[] = {1, 3, 2, 0};
+    struct thread *threads[4];
+    struct percpu *cpu = mycpu();
+    uint32_t base_threads = cpu->num_threads;
+    
+    for (int i = 0; i < 4; i++) {
+        threads[i] = create_thread(0, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        threads[i]->priority = prios[i];
+        threads[i]->sched_class = &prio_sched_class;
+        sched_add_thread(threads[i], cpu->cpu_index);
+    }
+    
+    int success = 1;
+    for (int i = 0; i < 4; i++) {
+        struct thread *next = sched_get_next();
+        success = success && (next == threads[expected[i]]);
+    }
+    success = success && (cpu->prio.bitmap == 0) && (sched_get_next() == cpu->idle_thread);
+    
+    // Picked threads still count as running on this CPU
+    cpu->num_threads = base_threads;
+    for (int i = 0; i < 4; i++) {
+        kfree((void *)(threads[i]->stack - PGSIZE));
+        kfree((void *)(threads[i]->kstack - PGSIZE));
+        kfree(threads[i]);
+    }
+    return success;
+}
+
+/**
+ * @brief Test that queueing threads does not touch the page allocator
+ * 
+ * Adds and removes a thread repeatedly and checks that the free page
+ * count is unchanged and the embedded link is reset after removal.
+ */
+int test_runqueue_no_alloc() {
+    struct thread *thread = create_thread(0, 0, 0);
+    if (thread == 0) {
+        return 0;
+    }
+    thread->sched_class = &prio_sched_class;
+    
+    uint64_t free_before = count_pages();
+    int success = 1;
+    for (int i = 0; i < 8; i++) {
+        sched_add_thread(thread, mycpu()->cpu_index);
+        success = success && !lst_empty(&thread->rq_link);
+        sched_remove_thread(thread);
+        success = success && lst_empty(&thread->rq_link);
+    }
+    success = success && (count_pages() == free_before) && (mycpu()->nr_queued == 0);
+    
+    kfree((void *)(thread->stack - PGSIZE));
+    kfree((void *)(thread->kstack - PGSIZE));
+    kfree(thread);
+    return success;
+}
+
+/**
+ * @brief Test that wakeups go through the wakelist
+ * 
+ * Wakes two blocked threads and checks that they wait on the wakelist
+ * outside the run queue until the next pick drains them in wake order.
+ */
+int test_wakelist_drain() {
+    struct thread *threads[2];
+    struct percpu *cpu = mycpu();
+    uint32_t base_threads = cpu->num_threads;
+    
+    for (int i = 0; i < 2; i++) {
+        threads[i] = create_thread(0, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        threads[i]->state = WAIT;
+        threads[i]->cpu = cpu->cpu_index;
+        sched_wakeup(threads[i]);
+    }
+    sched_wakeup(threads[0]); // Already woken, must not be pushed twice
+    
+    int success = (cpu->wake_list == threads[1]) && (threads[1]->wake_next == threads[0]) &&
+                  (threads[0]->wake_next == 0) && (threads[0]->state == WAKING) &&
+                  (cpu->nr_queued == 0);
+    
+    for (int i = 0; i < 2; i++) {
+        struct thread *next = sched_get_next();
+        success = success && (next == threads[i]) && (next->state == RUNNABLE);
+    }
+    success = success && (cpu->wake_list == 0) && (sched_get_next() == cpu->idle_thread);
+    
+    cpu->num_threads = base_threads;
+    for (int i = 0; i < 2; i++) {
+        kfree((void *)(threads[i]->stack - PGSIZE));
+        kfree((void *)(threads[i]->kstack - PGSIZE));
+        kfree(threads[i]);
+    }
+    return success;
+}
+
+/**
+ * @brief Test that the fair class runs the smallest vruntime first
+ * 
+ * Queues eight fair threads with preset vruntimes, removes one from the
+ * middle of the tree and checks the pick order, FIFO among equal keys.
+ */
+int test_fair_pick_order() {
+    static const uint64_t vruntimes[] = {50, 10, 40, 10, 30, 20, 60, 0};
+    static const int expected[] = {7, 1, 3, 5, 4, 0, 6};
+    struct thread *threads[8];
+    struct percpu *cpu = mycpu();
+    uint32_t base_threads = cpu->num_threads;
+    
+    for (int i = 0; i < 8; i++) {
+        threads[i] = create_thread(0, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        threads[i]->sched_class = &fair_sched_class;
+        threads[i]->vruntime = cpu->cfs.min_vruntime + vruntimes[i];
+        sched_add_thread(threads[i], cpu->cpu_index);
+    }
+    sched_remove_thread(threads[2]);
+    
+    int success = (cpu->cfs.nr_running == 7) &&
+                  (cpu->cfs.load == 7 * SCHED_FAIR_WEIGHT_DEFAULT);
+    for (int i = 0; i < 7; i++) {
+        struct thread *next = sched_get_next();
+        success = success && (next == threads[expected[i]]);
+    }
+    success = success && (cpu->cfs.nr_running == 0) && (cpu->cfs.leftmost == 0) &&
+              (sched_get_next() == cpu->idle_thread);
+    
+    cpu->num_threads = base_threads;
+    for (int i = 0; i < 8; i++) {
+        kfree((void *)(threads[i]->stack - PGSIZE));
+        kfree((void *)(threads[i]->kstack - PGSIZE));
+        kfree(threads[i]);
+    }
+    return success;
+}
+
+/**
+ * @brief Test that the classes are served deadline, real-time, then normal
+ * 
+ * Queues one thread per class in reverse order of urgency, plus a second
+ * real-time thread, and checks the pick order.
+ */
+int test_class_pick_order() {
+    struct thread *threads[5];
+    static const int expected[] = {4, 3, 2, 1, 0};
+    struct percpu *cpu = mycpu();
+    uint32_t base_threads = cpu->num_threads;
+    
+    for (int i = 0; i < 5; i++) {
+        threads[i] = create_thread(0, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        threads[i]->cpu = cpu->cpu_index;
+    }
+    threads[0]->sched_class = &fair_sched_class;
+    threads[1]->sched_class = &prio_sched_class;
+    threads[1]->priority = 0;
+    sched_set_policy(threads[2], SCHED_RR, 20);
+    sched_set_policy(threads[3], SCHED_FIFO, 10);
+    int success = sched_set_deadline(threads[4], 1000, 10000, 10000);
+    for (int i = 0; i < 5; i++) {
+        sched_add_thread(threads[i], cpu->cpu_index);
+    }
+    
+    for (int i = 0; i < 5; i++) {
+        struct thread *next = sched_get_next();
+        success = success && (next == threads[expected[i]]);
+    }
+    success = success && (sched_get_next() == cpu->idle_thread);
+    
+    sched_set_policy(threads[4], SCHED_NORMAL, THREAD_PRIO_DEFAULT);
+    success = success && (cpu->dl.total_bw == 0);
+    
+    cpu->num_threads = base_threads;
+    for (int i = 0; i < 5; i++) {
+        kfree((void *)(threads[i]->stack - PGSIZE));
+        kfree((void *)(threads[i]->kstack - PGSIZE));
+        kfree(threads[i]);
+    }
+    return success;
+}
+
+/**
+ * @brief Test deadline admission control
+ * 
+ * Reservations on one CPU are accepted up to SCHED_DL_BW_LIMIT, invalid
+ * parameters are refused, a deadline shorter than the period reserves
+ * by density, and leaving the class releases the bandwidth.
+ */
+int test_deadline_admission() {
+    struct thread *threads[3];
+    struct percpu *cpu = mycpu();
+    
+    for (int i = 0; i < 3; i++) {
+        threads[i] = create_thread(0, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        threads[i]->cpu = cpu->cpu_index;
+    }
+    
+    int success = sched_set_deadline(threads[0], 5000, 10000, 10000) &&
+                  !sched_set_deadline(threads[1], 5000, 10000, 10000) &&
+                  sched_set_deadline(threads[1], 4000, 10000, 10000) &&
+                  !sched_set_deadline(threads[2], 1000, 10000, 10000) &&
+                  !sched_set_deadline(threads[2], 2000, 1000, 10000) &&
+                  (threads[2]->sched_class != &dl_sched_class);
+    
+    // Shrinking an admitted reservation makes room for another one
+    success = success && sched_set_deadline(threads[1], 2000, 10000, 10000) &&
+              sched_set_deadline(threads[2], 2000, 10000, 10000);
+    
+    // 20% of the period but half of the deadline: 0.5 + 0.2 + 0.5 > 0.95
+    success = success && !sched_set_deadline(threads[2], 2000, 4000, 10000);
+    
+    for (int i = 0; i < 3; i++) {
+        sched_set_policy(threads[i], SCHED_NORMAL, THREAD_PRIO_DEFAULT);
+    }
+    success = success && (cpu->dl.total_bw == 0);
+    
+    for (int i = 0; i < 3; i++) {
+        kfree((void *)(threads[i]->stack - PGSIZE));
+        kfree((void *)(threads[i]->kstack - PGSIZE));
+        kfree(threads[i]);
+    }
+    return success;
+}
+
+/**
+ * @brief Periodic deadline job for test_deadline_periodic
+ */
+struct periodic_task {
+    uint64_t runtime_us;
+    uint64_t deadline_us;
+    uint64_t period_us;
+    uint64_t work;          // TSC cycles each job spins for
+    uint32_t jobs;          // Jobs to run before exiting
+    volatile uint32_t done; // Jobs finished
+    volatile uint32_t misses; // Jobs finished after their deadline
+};
+
+static volatile bool periodic_stop;
+
+static void periodic_task_func(void *arg) {
+    struct periodic_task *task = arg;
+    uint32_t jobs = task->jobs;
+    
+    for (uint32_t i = 0; i < jobs; i++) {
+        uint64_t deadline = curthread()->dl_abs_deadline;
+        uint64_t start = rdtsc();
+        while (rdtsc() - start < task->work) {
+            asm volatile("pause");
+        }
+        if (rdtsc() > deadline) {
+            task->misses++;
+        }
+        task->done++;
+        
+        // Ends this period's job; the thread sleeps until the next one
+        sched_yield();
+    }
+    sched_exit();
+}
+
+static void periodic_hog_func(void *arg) {
+    (void) arg;
+    while (!periodic_stop) {
+        asm volatile("pause");
+    }
+    sched_exit();
+}
+
+/**
+ * @brief Periodic task harness: run deadline threads and count misses
+ * 
+ * Two deadline threads share the last AP with a CPU-bound normal thread
+ * for ten periods each. Every job spins for a quarter of its runtime and
+ * counts a miss if it finishes after its absolute deadline. The BSP does
+ * not run its scheduler yet, so it waits here and reports the result.
+ */
+int test_deadline_periodic() {
+    static struct periodic_task tasks[2] = {
+        {.runtime_us = 4000, .deadline_us = 20000, .period_us = 20000, .jobs = 10},
+        {.runtime_us = 4000, .deadline_us = 25000, .period_us = 30000, .jobs = 10},
+    };
+    struct percpu *cpu = &percpus[ncpu - 1];
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    if (!cpu->scheduler_ready || tsc_per_ms == 0) {
+        return 0;
+    }
+    
+    periodic_stop = false;
+    struct thread *hog = create_thread(periodic_hog_func, 0, 0);
+    if (hog == 0) {
+        return 0;
+    }
+    sched_add_thread(hog, cpu->cpu_index);
+    
+    // The hog must be stopped on every way out, or it keeps the AP busy
+    // for the rest of the tests
+    for (int i = 0; i < 2; i++) {
+        struct thread *thread = create_thread(periodic_task_func, 0, 0);
+        if (thread == 0) {
+            periodic_stop = true;
+            return 0;
+        }
+        tasks[i].work = tasks[i].runtime_us * tsc_per_ms / 4000;
+        tasks[i].done = 0;
+        tasks[i].misses = 0;
+        thread->context->rdi = (uint64_t) &tasks[i];
+        thread->cpu = cpu->cpu_index;
+        if (!sched_set_deadline(thread, tasks[i].runtime_us, tasks[i].deadline_us, tasks[i].period_us)) {
+            periodic_stop = true;
+            return 0;
+        }
+        sched_add_thread(thread, cpu->cpu_index);
+    }
+    
+    // Ten periods of the slower task, with room for emulator slowdown
+    uint64_t start = rdtsc();
+    while ((tasks[0].done < tasks[0].jobs || tasks[1].done < tasks[1].jobs) &&
+           rdtsc() - start < 2000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    periodic_stop = true;
+    
+    int success = 1;
+    for (int i = 0; i < 2; i++) {
+        LOG_SERIAL("TEST", "Deadline task %d (%llu/%llu/%llu us): %d/%d jobs, %d deadline misses",
+                   i, tasks[i].runtime_us, tasks[i].deadline_us, tasks[i].period_us,
+                   tasks[i].done, tasks[i].jobs, tasks[i].misses);
+        success = success && (tasks[i].done == tasks[i].jobs) && (tasks[i].misses == 0);
+    }
+    return success;
+}
+
+static volatile int32_t affinity_ran_on[2];
+
+static void affinity_record_func(void *arg) {
+    affinity_ran_on[(uint64_t) arg] = mycpu()->cpu_index;
+    sched_exit();
+}
+
+/**
+ * @brief Test that placement and migration honor affinity masks
+ * 
+ * One thread is pinned to the last CPU before it is added to the BSP's
+ * queue, another is pinned to the BSP, where idle APs must not steal it,
+ * and then re-pinned to the last CPU. Both must run there.
+ */
+int test_affinity() {
+    uint32_t last = ncpu - 1;
+    struct cpumask mask;
+    struct thread *threads[2];
+    
+    cpumask_clear(&mask);
+    int success = !sched_set_affinity(mycpu()->idle_thread, &mask);
+    
+    for (int i = 0; i < 2; i++) {
+        affinity_ran_on[i] = -1;
+        threads[i] = create_thread(affinity_record_func, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        threads[i]->context->rdi = i;
+    }
+    
+    cpumask_set_cpu(&mask, last);
+    success = success && sched_set_affinity(threads[0], &mask);
+    sched_add_thread(threads[0], 0);
+    success = success && (threads[0]->cpu == last);
+    
+    cpumask_clear(&mask);
+    cpumask_set_cpu(&mask, 0);
+    success = success && sched_set_affinity(threads[1], &mask);
+    sched_add_thread(threads[1], -1);
+    success = success && (threads[1]->cpu == 0);
+    
+    // Several ticks for idle APs to try stealing it
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < 50 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    success = success && (affinity_ran_on[1] == -1);
+    
+    cpumask_clear(&mask);
+    cpumask_set_cpu(&mask, last);
+    success = success && sched_set_affinity(threads[1], &mask);
+    
+    start = rdtsc();
+    while ((affinity_ran_on[0] == -1 || affinity_ran_on[1] == -1) &&
+           rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    return success && (affinity_ran_on[0] == (int32_t) last) && (affinity_ran_on[1] == (int32_t) last);
+}
+
+/**
+ * @brief Test that scheduling domains nest and cover the machine
+ * 
+ * For every started CPU, each domain must contain the CPU and be a strict
+ * subset of the next one, the SMT siblings must fit in the innermost
+ * domain, and the outermost domain must span every started CPU.
+ */
+int test_topology_domains() {
+    struct cpumask started;
+    cpumask_clear(&started);
+    for (uint32_t i = 0; i < ncpu; i++) {
+        if (percpus[i].started) {
+            cpumask_set_cpu(&started, i);
+        }
+    }
+    
+    for (uint32_t i = 0; i < ncpu; i++) {
+        if (!percpus[i].started) {
+            continue;
+        }
+        struct cpu_topology *t = &cpu_topology[i];
+        if (!cpumask_test_cpu(&t->siblings, i)) {
+            return 0;
+        }
+        if (t->nr_domains == 0) {
+            // Only a lone CPU has nothing to balance against
+            if (cpumask_weight(&started) > 1) {
+                return 0;
+            }
+            continue;
+        }
+        
+        for (uint32_t d = 0; d < t->nr_domains; d++) {
+            const struct cpumask *span = &t->domains[d].span;
+            if (!cpumask_test_cpu(span, i) || !cpumask_subset(span, &started)) {
+                return 0;
+            }
+            if (d + 1 < t->nr_domains &&
+                (!cpumask_subset(span, &t->domains[d + 1].span) ||
+                 cpumask_equal(span, &t->domains[d + 1].span))) {
+                return 0;
+            }
+        }
+        if (!cpumask_subset(&t->siblings, &t->domains[0].span) ||
+            !cpumask_equal(&t->domains[t->nr_domains - 1].span, &started)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Test that wakeups prefer the last CPU only while it is cache-hot
+ * 
+ * A thread that just ran on the busy BSP must be sent back to it. Once
+ * its cache is cold it must go to the idle last CPU instead and run there.
+ */
+int test_cache_hot_wakeup() {
+    struct percpu *cpu = mycpu();
+    uint32_t last = ncpu - 1;
+    uint32_t base_threads = cpu->num_threads;
+    uint64_t saved_window = sched_cache_hot_us;
+    
+    struct thread *t = create_thread(affinity_record_func, 0, 0);
+    if (t == 0) {
+        return 0;
+    }
+    t->context->rdi = 0;
+    affinity_ran_on[0] = -1;
+    cpumask_clear(&t->cpus_allowed);
+    cpumask_set_cpu(&t->cpus_allowed, cpu->cpu_index);
+    cpumask_set_cpu(&t->cpus_allowed, last);
+    
+    // Pretend it just left this CPU, which has plenty of other work
+    t->state = WAIT;
+    t->cpu = cpu->cpu_index;
+    t->last_cpu = cpu->cpu_index;
+    t->last_ran = rdtsc();
+    cpu->num_threads = base_threads + 16;
+    
+    sched_set_cache_hot(1000000);
+    uint64_t hits = cpu->wake_hot_hits;
+    sched_wakeup(t);
+    int success = (cpu->wake_list == t) && (cpu->wake_hot_hits == hits + 1);
+    success = success && (sched_get_next() == t);
+    
+    sched_set_cache_hot(0);
+    uint64_t moved = cpu->wake_migrations;
+    cpu->num_threads = base_threads + 16;
+    t->state = WAIT;
+    sched_wakeup(t);
+    success = success && (cpu->wake_migrations == moved + 1) && (cpu->wake_list == 0);
+    
+    cpu->num_threads = base_threads;
+    sched_set_cache_hot(saved_window);
+    
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    uint64_t start = rdtsc();
+    while (affinity_ran_on[0] == -1 && rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    return success && (affinity_ran_on[0] == (int32_t) last);
+}
+
+static volatile int recycle_exited;
+static struct thread *volatile recycle_created;
+static volatile int recycle_from_pool;
+
+static void recycle_exit_func(void *arg) {
+    (void) arg;
+    recycle_exited = 1;
+    sched_exit();
+}
+
+static void recycle_create_func(void *arg) {
+    (void) arg;
+    struct percpu *cpu = mycpu();
+    uint64_t reused = cpu->threads_reused;
+    struct thread *t = create_thread(recycle_exit_func, 0, 0);
+    recycle_from_pool = (cpu->threads_reused == reused + 1);
+    release_thread(t);
+    recycle_created = t;
+    sched_exit();
+}
+
+/**
+ * @brief Test that exited threads are reaped and handed out again
+ * 
+ * A thread exits on the idle last CPU, which must reap it at once. The
+ * next create_thread() on that CPU must return the same thread from the
+ * pool without allocating.
+ */
+int test_thread_recycling() {
+    uint32_t last = ncpu - 1;
+    struct percpu *target = &percpus[last];
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    
+    recycle_exited = 0;
+    recycle_created = 0;
+    recycle_from_pool = 0;
+    
+    struct thread *exiting = create_thread(recycle_exit_func, 0, 0);
+    if (exiting == 0) {
+        return 0;
+    }
+    cpumask_clear(&exiting->cpus_allowed);
+    cpumask_set_cpu(&exiting->cpus_allowed, last);
+    uint64_t reaped = target->threads_reaped;
+    sched_add_thread(exiting, last);
+    
+    uint64_t start = rdtsc();
+    while ((!recycle_exited || target->threads_reaped == reaped) &&
+           rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    if (target->threads_reaped == reaped) {
+        return 0;
+    }
+    
+    struct thread *creator = create_thread(recycle_create_func, 0, 0);
+    if (creator == 0) {
+        return 0;
+    }
+    cpumask_clear(&creator->cpus_allowed);
+    cpumask_set_cpu(&creator->cpus_allowed, last);
+    sched_add_thread(creator, last);
+    
+    start = rdtsc();
+    while (recycle_created == 0 && rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    return recycle_from_pool && (recycle_created == exiting);
+}
+
+#define YIELD_BENCH_ROUNDS 1000
+
+static volatile int fiber_rounds[2];
+static volatile uint64_t fiber_yield_cycles;
+static volatile int fiber_bench_done;
+static volatile uint64_t thread_bench_start;
+static volatile uint64_t thread_bench_end;
+static volatile int thread_bench_left;
+
+static void fiber_yielder(void *arg) {
+    for (int i = 0; i < YIELD_BENCH_ROUNDS; i++) {
+        fiber_rounds[(uint64_t) arg]++;
+        fiber_yield();
+    }
+}
+
+static void fiber_bench_driver(void *arg) {
+    (void) arg;
+    uint64_t start = rdtsc();
+    struct fiber *a = fiber_spawn(fiber_yielder, (void *) 0);
+    struct fiber *b = fiber_spawn(fiber_yielder, (void *) 1);
+    if (a != 0 && b != 0) {
+        fiber_await(a);
+        fiber_await(b);
+        fiber_yield_cycles = (rdtsc() - start) / (2 * YIELD_BENCH_ROUNDS);
+    }
+    fiber_bench_done = 1;
+}
+
+static void thread_yielder(void *arg) {
+    (void) arg;
+    __sync_bool_compare_and_swap(&thread_bench_start, 0, rdtsc());
+    for (int i = 0; i < YIELD_BENCH_ROUNDS; i++) {
+        sched_yield();
+    }
+    if (__sync_sub_and_fetch(&thread_bench_left, 1) == 0) {
+        thread_bench_end = rdtsc();
+    }
+    sched_exit();
+}
+
+/**
+ * @brief Test fibers and compare their yield with a thread's
+ * 
+ * On the last CPU, a driver fiber spawns two fibers that yield to each
+ * other and awaits both; then two threads pinned there do the same with
+ * sched_yield(). Fibers must finish every round and switch faster.
+ */
+int test_fiber_yield_bench() {
+    uint32_t last = ncpu - 1;
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    
+    fiber_rounds[0] = fiber_rounds[1] = 0;
+    fiber_yield_cycles = 0;
+    fiber_bench_done = 0;
+    struct fiber *driver = fiber_spawn_on(last, fiber_bench_driver, 0);
+    if (driver == 0) {
+        return 0;
+    }
+    
+    uint64_t start = rdtsc();
+    while (!fiber_bench_done && rdtsc() - start < 2000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    if (!fiber_bench_done) {
+        return 0;
+    }
+    fiber_await(driver);
+    
+    thread_bench_start = 0;
+    thread_bench_end = 0;
+    thread_bench_left = 2;
+    for (int i = 0; i < 2; i++) {
+        struct thread *t = create_thread(thread_yielder, 0, 0);
+        if (t == 0) {
+            return 0;
+        }
+        cpumask_clear(&t->cpus_allowed);
+        cpumask_set_cpu(&t->cpus_allowed, last);
+        sched_add_thread(t, last);
+    }
+    
+    start = rdtsc();
+    while (thread_bench_end == 0 && rdtsc() - start < 2000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    if (thread_bench_end == 0) {
+        return 0;
+    }
+    uint64_t thread_yield_cycles = (thread_bench_end - thread_bench_start) / (2 * YIELD_BENCH_ROUNDS);
+    
+    LOG_SERIAL("TEST", "Yield cost over %d rounds: fiber %llu cycles, thread %llu cycles",
+               YIELD_BENCH_ROUNDS, fiber_yield_cycles, thread_yield_cycles);
+    return (fiber_rounds[0] == YIELD_BENCH_ROUNDS) && (fiber_rounds[1] == YIELD_BENCH_ROUNDS) &&
+           (fiber_yield_cycles != 0) && (fiber_yield_cycles < thread_yield_cycles);
+}
+
+#define FPU_TEST_WORDS 1024
+
+static uint32_t *volatile fpu_buffers[2];
+static volatile uint32_t fpu_sums[2];
+static volatile int fpu_mismatches;
+static volatile int fpu_threads_left;
+static volatile uint64_t fpu_deadline;
+
+static void fpu_sum_func(void *arg) {
+    uint64_t i = (uint64_t) arg;
+    // Loop long enough to be preempted, mostly inside sum32_simd()
+    while (rdtsc() < fpu_deadline) {
+        if (sum32_simd(fpu_buffers[i], FPU_TEST_WORDS) != fpu_sums[i]) {
+            fpu_mismatches++;
+        }
+    }
+    __sync_sub_and_fetch(&fpu_threads_left, 1);
+    sched_exit();
+}
+
+static void fpu_idle_func(void *arg) {
+    (void) arg;
+    __sync_sub_and_fetch(&fpu_threads_left, 1);
+    sched_exit();
+}
+
+/**
+ * @brief Test that SIMD registers survive preemption and stay lazy
+ * 
+ * Two threads pinned to the last CPU sum different buffers with SSE for
+ * 30 ms and time-share it; every sum must match the scalar one. A thread
+ * that never uses SIMD must not fault in an FPU state.
+ */
+int test_lazy_fpu() {
+    uint32_t last = ncpu - 1;
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    struct thread *threads[3];
+    
+    for (int i = 0; i < 2; i++) {
+        fpu_buffers[i] = kalloc();
+        if (fpu_buffers[i] == 0) {
+            return 0;
+        }
+        uint32_t sum = 0;
+        for (uint32_t j = 0; j < FPU_TEST_WORDS; j++) {
+            fpu_buffers[i][j] = (j + 1) * (i == 0 ? 2654435761u : 40503u);
+            sum += fpu_buffers[i][j];
+        }
+        fpu_sums[i] = sum;
+    }
+    
+    fpu_mismatches = 0;
+    fpu_threads_left = 3;
+    fpu_deadline = rdtsc() + 30 * tsc_per_ms;
+    for (uint64_t i = 0; i < 3; i++) {
+        threads[i] = create_thread(i < 2 ? fpu_sum_func : fpu_idle_func, i, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        cpumask_clear(&threads[i]->cpus_allowed);
+        cpumask_set_cpu(&threads[i]->cpus_allowed, last);
+    }
+    uint64_t saves = percpus[last].fpu_saves;
+    for (int i = 0; i < 3; i++) {
+        sched_add_thread(threads[i], last);
+    }
+    
+    uint64_t start = rdtsc();
+    while (fpu_threads_left != 0 && rdtsc() - start < 2000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    // Let the last CPU switch away from the exited threads
+    start = rdtsc();
+    while (rdtsc() - start < 5 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    
+    // The threads sit on the dead list or in the pool; their fields stay
+    int ok = (fpu_threads_left == 0) && (fpu_mismatches == 0) &&
+             threads[0]->fpu_used && threads[1]->fpu_used &&
+             !threads[2]->fpu_used && (percpus[last].fpu_saves >= saves + 2);
+    kfree(fpu_buffers[0]);
+    kfree(fpu_buffers[1]);
+    return ok;
+}
+
+static volatile int stat_threads_left;
+static volatile int stat_sleeper_ran;
+static volatile uint64_t stat_spin_cycles;
+
+static void stat_sleeper_func(void *arg) {
+    (void) arg;
+    stat_sleeper_ran = 1;
+    sched_block();
+    __sync_sub_and_fetch(&stat_threads_left, 1);
+    sched_exit();
+}
+
+static void stat_spinner_func(void *arg) {
+    (void) arg;
+    // sum_exec_runtime is charged on every tick
+    while (curthread()->sum_exec_runtime < stat_spin_cycles) {
+        asm volatile("pause");
+    }
+    __sync_sub_and_fetch(&stat_threads_left, 1);
+    sched_exit();
+}
+
+/**
+ * @brief Test per-thread and per-CPU scheduler statistics
+ * 
+ * On the last CPU, a thread blocks for 10 ms while the CPU idles, then two
+ * threads each need 30 ms of CPU time, so one waits for the other and
+ * at least one is preempted. Blocked, idle and wait times and the switch
+ * counts must reflect that.
+ */
+int test_schedstat() {
+    uint32_t last = ncpu - 1;
+    struct percpu *target = &percpus[last];
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    struct thread *threads[3];
+    
+    stat_threads_left = 3;
+    stat_sleeper_ran = 0;
+    stat_spin_cycles = 30 * tsc_per_ms;
+    for (int i = 0; i < 3; i++) {
+        threads[i] = create_thread(i == 0 ? stat_sleeper_func : stat_spinner_func, 0, 0);
+        if (threads[i] == 0) {
+            return 0;
+        }
+        cpumask_clear(&threads[i]->cpus_allowed);
+        cpumask_set_cpu(&threads[i]->cpus_allowed, last);
+    }
+    
+    sched_add_thread(threads[0], last);
+    uint64_t start = rdtsc();
+    while ((!stat_sleeper_ran || threads[0]->on_cpu) && rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    if (threads[0]->state != WAIT) {
+        return 0;
+    }
+    uint64_t idle = target->idle_time;
+    start = rdtsc();
+    while (rdtsc() - start < 10 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    sched_wakeup(threads[0]);
+    
+    sched_add_thread(threads[1], last);
+    sched_add_thread(threads[2], last);
+    start = rdtsc();
+    while (stat_threads_left != 0 && rdtsc() - start < 2000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    if (stat_threads_left != 0) {
+        return 0;
+    }
+    
+    sched_dump_stats();
+    for (int i = 0; i < 3; i++) {
+        sched_dump_thread_stats(threads[i]);
+    }
+    
+    // The exited threads wait on the dead list or in the pool; their
+    // counters stay until they are handed out again
+    return (threads[0]->blocked_time >= 10 * tsc_per_ms) &&
+           (threads[0]->nr_voluntary == 2) &&
+           (target->idle_time - idle >= 5 * tsc_per_ms) &&
+           (threads[1]->sum_exec_runtime >= stat_spin_cycles) &&
+           (threads[1]->nr_involuntary + threads[2]->nr_involuntary >= 1) &&
+           (threads[1]->run_delay + threads[2]->run_delay >= 5 * tsc_per_ms);
+}
+
+#define MUTEX_TEST_THREADS 4
+#define MUTEX_TEST_ROUNDS 2000
+
+static struct mutex wq_test_mutex;
+static struct wait_queue wq_test_queue;
+static volatile uint64_t wq_counter;
+static volatile int wq_threads_left;
+static volatile int wq_flag;
+static volatile int wq_waiter_ran;
+
+static void mutex_worker_func(void *arg) {
+    (void) arg;
+    for (int i = 0; i < MUTEX_TEST_ROUNDS; i++) {
+        acquire_mutex(&wq_test_mutex);
+        uint64_t value = wq_counter;
+        if (i % 16 == 0) {
+            // Switch away while holding it so others have to sleep
+            sched_yield();
+        }
+        wq_counter = value + 1;
+        release_mutex(&wq_test_mutex);
+    }
+    __sync_sub_and_fetch(&wq_threads_left, 1);
+    sched_exit();
+}
+
+static void wq_waiter_func(void *arg) {
+    (void) arg;
+    wq_waiter_ran = 1;
+    wait_event(&wq_test_queue, wq_flag);
+    __sync_sub_and_fetch(&wq_threads_left, 1);
+    sched_exit();
+}
+
+/**
+ * @brief Test wait queues and the futex-based mutex
+ * 
+ * A thread in wait_event() must stay blocked, off the CPU, until the
+ * condition is set and the queue woken. Threads spread over the APs then
+ * increment a counter under a mutex, sometimes yielding while holding it,
+ * and no increment may be lost.
+ */
+int test_waitqueue_mutex() {
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    
+    waitqueue_init(&wq_test_queue, "test");
+    init_mutex(&wq_test_mutex, "test");
+    wq_flag = 0;
+    wq_waiter_ran = 0;
+    wq_threads_left = 1;
+    
+    struct thread *waiter = create_thread(wq_waiter_func, 0, 0);
+    if (waiter == 0) {
+        return 0;
+    }
+    cpumask_clear(&waiter->cpus_allowed);
+    cpumask_set_cpu(&waiter->cpus_allowed, ncpu - 1);
+    sched_add_thread(waiter, ncpu - 1);
+    
+    uint64_t start = rdtsc();
+    while ((!wq_waiter_ran || waiter->on_cpu) && rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    start = rdtsc();
+    while (rdtsc() - start < 5 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    int blocked = wq_waiter_ran && (waiter->state == WAIT) && (wq_threads_left == 1);
+    
+    wq_flag = 1;
+    uint32_t woken = waitqueue_wake_all(&wq_test_queue);
+    start = rdtsc();
+    while (wq_threads_left != 0 && rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    if (!blocked || woken != 1 || wq_threads_left != 0) {
+        return 0;
+    }
+    
+    wq_counter = 0;
+    wq_threads_left = MUTEX_TEST_THREADS;
+    for (int i = 0; i < MUTEX_TEST_THREADS; i++) {
+        struct thread *t = create_thread(mutex_worker_func, 0, 0);
+        if (t == 0) {
+            return 0;
+        }
+        uint32_t cpu = 1 + i % (ncpu - 1);
+        cpumask_clear(&t->cpus_allowed);
+        cpumask_set_cpu(&t->cpus_allowed, cpu);
+        sched_add_thread(t, cpu);
+    }
+    
+    start = rdtsc();
+    while (wq_threads_left != 0 && rdtsc() - start < 5000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    
+    return (wq_threads_left == 0) && (wq_counter == MUTEX_TEST_THREADS * MUTEX_TEST_ROUNDS) &&
+           (wq_test_mutex.state == 0);
+}
+
+#define SLEEP_TEST_THREADS 8
+
+static volatile int sleep_threads_left;
+static volatile uint64_t sleep_elapsed[SLEEP_TEST_THREADS];
+static volatile int sleep_timeouts_ok;
+static volatile int timer_fired;
+static struct mutex sleep_test_mutex;
+static volatile uint32_t sleep_futex_word;
+
+static void sleeper_func(void *arg) {
+    uint64_t i = (uint64_t) arg;
+    uint64_t start = rdtsc();
+    thread_sleep_ns(30 * 1000000ull + i * 100000ull);
+    sleep_elapsed[i] = rdtsc() - start;
+    __sync_sub_and_fetch(&sleep_threads_left, 1);
+    sched_exit();
+}
+
+static void timeout_func(void *arg) {
+    (void) arg;
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    
+    // Nobody changes the word or releases the mutex
+    uint64_t start = rdtsc();
+    int futex_ok = !futex_wait_timeout(&sleep_futex_word, 0, 10 * 1000000ull);
+    futex_ok = futex_ok && (rdtsc() - start >= 10 * tsc_per_ms);
+    start = rdtsc();
+    int mutex_ok = !acquire_mutex_timeout(&sleep_test_mutex, 10 * 1000000ull);
+    mutex_ok = mutex_ok && (rdtsc() - start >= 10 * tsc_per_ms);
+    
+    sleep_timeouts_ok = futex_ok && mutex_ok;
+    __sync_sub_and_fetch(&sleep_threads_left, 1);
+    sched_exit();
+}
+
+static void count_timer_func(void *arg) {
+    (void) arg;
+    timer_fired++;
+}
+
+/**
+ * @brief Test sleeps, timeouts and callback timers on the timer wheel
+ * 
+ * Threads on the last CPU sleep for about 30 ms each and must wake no
+ * earlier and not much later, several per timer interrupt. Futex and
+ * mutex waits that nobody ends must time out. A callback timer fires
+ * once; a cancelled one never does.
+ */
+int test_timer_wheel() {
+    uint32_t last = ncpu - 1;
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    struct timer_base *base = &timer_bases[last];
+    
+    init_mutex(&sleep_test_mutex, "test");
+    acquire_mutex(&sleep_test_mutex);
+    sleep_futex_word = 0;
+    sleep_timeouts_ok = 0;
+    sleep_threads_left = SLEEP_TEST_THREADS + 1;
+    uint64_t expired = base->expired;
+    uint64_t runs = base->expiry_runs;
+    
+    for (uint64_t i = 0; i <= SLEEP_TEST_THREADS; i++) {
+        struct thread *t = create_thread(i < SLEEP_TEST_THREADS ? sleeper_func : timeout_func, i, 0);
+        if (t == 0) {
+            return 0;
+        }
+        cpumask_clear(&t->cpus_allowed);
+        cpumask_set_cpu(&t->cpus_allowed, last);
+        sched_add_thread(t, last);
+    }
+    
+    // Callback timers on this CPU
+    struct timer fired, cancelled;
+    timer_fired = 0;
+    timer_setup(&fired, count_timer_func, 0);
+    timer_setup(&cancelled, count_timer_func, 0);
+    timer_add(&fired, 5 * 1000000ull, 0);
+    timer_add(&cancelled, 10 * 1000000ull, 0);
+    int cancel_ok = timer_cancel(&cancelled);
+    
+    uint64_t start = rdtsc();
+    while (sleep_threads_left != 0 && rdtsc() - start < 2000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    release_mutex(&sleep_test_mutex);
+    if (sleep_threads_left != 0) {
+        return 0;
+    }
+    
+    int sleeps_ok = 1;
+    for (int i = 0; i < SLEEP_TEST_THREADS; i++) {
+        uint64_t want = 30 * tsc_per_ms + i * tsc_per_ms / 10;
+        if (sleep_elapsed[i] < want || sleep_elapsed[i] > want + 20 * tsc_per_ms) {
+            sleeps_ok = 0;
+        }
+    }
+    
+    timer_log_stats();
+    // Sleeps, the two timeouts and any fiber or test timers of that CPU
+    uint64_t expired_now = base->expired - expired;
+    uint64_t runs_now = base->expiry_runs - runs;
+    return sleeps_ok && sleep_timeouts_ok && cancel_ok && (timer_fired == 1) &&
+           (expired_now >= SLEEP_TEST_THREADS + 2) && (runs_now < expired_now);
+}
+
+static volatile int work_gate;
+static volatile int work_runs;
+static volatile int work_cpu_ok;
+static volatile int softirq_ctx_ok;
+static volatile uint32_t work_any_cpu;
+
+static void gate_work_func(void *arg) {
+    (void) arg;
+    while (!work_gate) {
+        asm volatile("pause");
+    }
+}
+
+static void count_work_func(void *arg) {
+    uint64_t cpu = (uint64_t) arg;
+    
+    // Work runs in a thread and may sleep
+    thread_sleep_ns(1000000ull);
+    pushcli();
+    if (mycpu()->cpu_index != cpu) {
+        work_cpu_ok = 0;
+    }
+    popcli();
+    __sync_add_and_fetch(&work_runs, 1);
+}
+
+static void any_work_func(void *arg) {
+    (void) arg;
+    pushcli();
+    work_any_cpu = mycpu()->cpu_index;
+    popcli();
+    __sync_add_and_fetch(&work_runs, 1);
+}
+
+static void softirq_timer_func(void *arg) {
+    (void) arg;
+    softirq_ctx_ok = mycpu()->in_softirq && (read_eflags() & FL_IF) && mycpu()->preempt_count > 0;
+}
+
+/**
+ * @brief Test softirqs and per-CPU workqueues
+ * 
+ * A timer callback must run as a softirq with interrupts enabled. Work
+ * queued on the last CPU runs on its worker; queueing an item that is
+ * still waiting is refused. Work queued from the BSP, which has no
+ * worker yet, goes to another CPU's worker.
+ */
+int test_softirq_workqueue() {
+    uint32_t last = ncpu - 1;
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    struct percpu *cpu = mycpu();
+    uint64_t softirq_runs = cpu->softirq_runs;
+    
+    struct timer timer;
+    softirq_ctx_ok = 0;
+    timer_setup(&timer, softirq_timer_func, 0);
+    timer_add(&timer, 2 * 1000000ull, 0);
+    
+    // Hold the last CPU's worker so the next item stays queued
+    struct work gate, counted, any;
+    work_gate = 0;
+    work_runs = 0;
+    work_cpu_ok = 1;
+    work_init(&gate, gate_work_func, 0);
+    work_init(&counted, count_work_func, (void *) (uint64_t) last);
+    work_init(&any, any_work_func, 0);
+    work_any_cpu = 0;
+    int queue_ok = queue_work_on(last, &gate);
+    queue_ok = queue_ok && queue_work_on(last, &counted);
+    queue_ok = queue_ok && !queue_work_on(last, &counted);
+    work_gate = 1;
+    
+    int fallback_ok = workers[0].thread == 0 && queue_work(&any);
+    
+    uint64_t start = rdtsc();
+    while ((work_runs < 2 || !softirq_ctx_ok) && rdtsc() - start < 1000 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    timer_cancel(&timer);
+    
+    int runs_ok = work_runs == 2 && work_cpu_ok && work_any_cpu != 0;
+    
+    softirq_log_stats();
+    workqueue_log_stats();
+    return queue_ok && fallback_ok && runs_ok && softirq_ctx_ok && cpu->softirq_runs > softirq_runs;
+}
+
+#define PARALLEL_TEST_ITEMS 4096
+#define PARALLEL_ITEM_ROUNDS 2000
+
+static volatile uint8_t parallel_marks[PARALLEL_TEST_ITEMS];
+static volatile uint64_t parallel_sum;
+
+/**
+ * @brief CPU-bound work for one index, standing in for a page or a table
+ */
+static uint64_t parallel_item(uint64_t i) {
+    uint64_t x = i + 1;
+    for (int k = 0; k < PARALLEL_ITEM_ROUNDS; k++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    return x;
+}
+
+static void parallel_mark_func(uint64_t lo, uint64_t hi, void *arg) {
+    (void) arg;
+    uint64_t sum = 0;
+    for (uint64_t i = lo; i < hi; i++) {
+        parallel_marks[i]++;
+        sum += parallel_item(i);
+    }
+    __sync_add_and_fetch(&parallel_sum, sum);
+}
+
+static void parallel_nested_func(uint64_t lo, uint64_t hi, void *arg) {
+    (void) arg;
+    for (uint64_t i = lo; i < hi; i++) {
+        parallel_for(i * 64, (i + 1) * 64, 8, parallel_mark_func, 0);
+    }
+}
+
+static int parallel_marks_once(void) {
+    for (int i = 0; i < PARALLEL_TEST_ITEMS; i++) {
+        if (parallel_marks[i] != 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void parallel_reset(void) {
+    for (int i = 0; i < PARALLEL_TEST_ITEMS; i++) {
+        parallel_marks[i] = 0;
+    }
+    parallel_sum = 0;
+}
+
+/**
+ * @brief Test parallel_for() and benchmark it against a serial loop
+ * 
+ * Every index must be run exactly once, both for a flat loop and for one
+ * whose body starts inner loops. Logs a [BENCH] line with the speedup
+ * over the serial loop; make bench collects it for 1 to 8 CPUs.
+ */
+int test_parallel_for() {
+    uint64_t expected = 0;
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PARALLEL_TEST_ITEMS; i++) {
+        expected += parallel_item(i);
+    }
+    uint64_t serial = rdtsc() - start;
+    
+    parallel_reset();
+    start = rdtsc();
+    parallel_for(0, PARALLEL_TEST_ITEMS, 0, parallel_mark_func, 0);
+    uint64_t parallel = rdtsc() - start;
+    int flat_ok = parallel_marks_once() && parallel_sum == expected;
+    
+    parallel_reset();
+    parallel_for(0, PARALLEL_TEST_ITEMS / 64, 1, parallel_nested_func, 0);
+    int nested_ok = parallel_marks_once() && parallel_sum == expected;
+    
+    uint64_t speedup = parallel != 0 ? serial * 100 / parallel : 0;
+    LOG_SERIAL("BENCH", "parallel_for cpus=%d items=%d serial=%llu parallel=%llu cycles speedup=%llu.%02llu",
+               ncpu, PARALLEL_TEST_ITEMS, serial, parallel, speedup / 100, speedup % 100);
+    parallel_log_stats();
+    return flat_ok && nested_ok;
+}
+
+/**
+ * @brief Test that the calibrated tick runs at TICK_HZ
+ * 
+ * Spins for 100 ms of TSC time with interrupts enabled and counts the
+ * ticks taken on this CPU, allowing for emulator jitter.
+ */
+int test_tick_rate() {
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+    if (tsc_per_ms == 0 || !(read_eflags() & FL_IF)) {
+        return 0;
+    }
+    
+    struct percpu *cpu = mycpu();
+    uint64_t expected = 100 * TICK_HZ / 1000;
+    uint64_t start_ticks = cpu->timer_ticks;
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < 100 * tsc_per_ms) {
+        asm volatile("pause");
+    }
+    uint64_t ticks = cpu->timer_ticks - start_ticks;
+    
+    return ticks >= expected / 2 && ticks <= expected * 3 / 2;
+}
+
 void run_tests() {
     LOG("Test mode enabled, running tests");
 
@@ -530,6 +2071,49 @@ void run_tests() {
     TEST_REPORT("VM: va_to_pa translation", CHECK(test_va_to_pa));
     TEST_REPORT("VM: unmap_page works", CHECK(test_unmap_page));
     TEST_REPORT("VM: map_pages range", CHECK(test_map_pages_range));
+    TEST_REPORT("VM: unmap frees page tables", CHECK(test_unmap_frees_page_tables));
+    TEST_REPORT("VM: ioremap registry", CHECK(test_ioremap_registry));
+    TEST_REPORT("VM: Direct map", CHECK(test_direct_map));
+    TEST_REPORT("VM: Demand paging", CHECK(test_demand_paging));
+    log_pagetable_stats("VM tests");
+    
+    // Console tests
+    int wc_status = pat_wc_available() ? CHECK(test_console_write_combining) : 0;
+    TEST_REPORT("VM: Console write-combining", wc_status);
 
     LOG("All VM tests completed");
+    
+    // Scheduler tests
+    TEST_REPORT("SCHED: Spinlocks disable preemption", CHECK(test_preempt_count));
+    TEST_REPORT("SCHED: Priority pick order", CHECK(test_priority_pick_order));
+    TEST_REPORT("SCHED: Run queue without allocation", CHECK(test_runqueue_no_alloc));
+    TEST_REPORT("SCHED: Wakelist drain", CHECK(test_wakelist_drain));
+    TEST_REPORT("SCHED: Fair pick order", CHECK(test_fair_pick_order));
+    TEST_REPORT("SCHED: Class pick order", CHECK(test_class_pick_order));
+    TEST_REPORT("SCHED: Deadline admission control", CHECK(test_deadline_admission));
+    TEST_REPORT("SCHED: Calibrated tick rate", CHECK(test_tick_rate));
+    TEST_REPORT("SCHED: Topology domains", CHECK(test_topology_domains));
+
+    // Needs an AP running its scheduler
+    int dl_status = ncpu > 1 ? CHECK(test_deadline_periodic) : 0;
+    TEST_REPORT("SCHED: Periodic deadline tasks", dl_status);
+    int affinity_status = ncpu > 1 ? CHECK(test_affinity) : 0;
+    TEST_REPORT("SCHED: CPU affinity", affinity_status);
+    int cache_hot_status = ncpu > 1 ? CHECK(test_cache_hot_wakeup) : 0;
+    TEST_REPORT("SCHED: Cache-hot wakeup placement", cache_hot_status);
+    int recycle_status = ncpu > 1 ? CHECK(test_thread_recycling) : 0;
+    TEST_REPORT("SCHED: Thread recycling", recycle_status);
+    int fiber_status = ncpu > 1 ? CHECK(test_fiber_yield_bench) : 0;
+    TEST_REPORT("SCHED: Fiber yield benchmark", fiber_status);
+    int fpu_status = ncpu > 1 ? CHECK(test_lazy_fpu) : 0;
+    TEST_REPORT("SCHED: Lazy FPU state", fpu_status);
+    int schedstat_status = ncpu > 1 ? CHECK(test_schedstat) : 0;
+    TEST_REPORT("SCHED: Scheduler statistics", schedstat_status);
+    int waitqueue_status = ncpu > 1 ? CHECK(test_waitqueue_mutex) : 0;
+    TEST_REPORT("SCHED: Wait queues and mutex", waitqueue_status);
+    int timer_status = ncpu > 1 ? CHECK(test_timer_wheel) : 0;
+    TEST_REPORT("SCHED: Timer wheel sleeps", timer_status);
+    int softirq_status = ncpu > 1 ? CHECK(test_softirq_workqueue) : 0;
+    TEST_REPORT("SCHED: Softirq and workqueue", softirq_status);
+    TEST_REPORT("SCHED: Parallel for", CHECK(test_parallel_for));
 }
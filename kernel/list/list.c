@@ -47,6 +47,12 @@ lst_push(struct list *lst, void *p)
   lst->next = e;
 }
 
+void
+lst_push_back(struct list *lst, void *p)
+{
+  lst_push(lst->prev, p);
+}
+
 void
 lst_print(struct list *lst)
 {
@@ -9,12 +9,23 @@
 #ifndef LIST_H
 #define LIST_H
 
+#include <stddef.h>
+
 // Basic node for a circular doubly-linked list
 struct list {
     struct list *prev;
     struct list *next;
 };
 
+/**
+ * @brief Get the structure that embeds a list node
+ * @param ptr Pointer to the struct list member
+ * @param type Type of the containing structure
+ * @param member Name of the struct list member inside type
+ */
+#define lst_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
 /**
  * @brief Initialize a list node as a circular list
  * @param lst Pointer to the list head
@@ -48,6 +59,13 @@ void* lst_pop(struct list *lst);
  */
 void lst_push(struct list *lst, void *p);
 
+/**
+ * @brief Push a node to the back of the list
+ * @param lst Pointer to the list head
+ * @param p Pointer to the node to push
+ */
+void lst_push_back(struct list *lst, void *p);
+
 /**
  * @brief Print all nodes in the list (for debugging)
  * @param lst Pointer to the list head
@@ -15,15 +15,27 @@
 #include "lib/include/test.h"
 #include "lib/include/shutdown.h"
 #include "paging/paging.h"
+#include "paging/pat.h"
+#include "paging/ioremap.h"
+#include "vm/vma.h"
 #include "sched/proc.h"
 #include "sched/threads.h"
 #include "sched/scheduler.h"
 #include "sched/percpu.h"
 #include "sched/smp_sched.h"
+#include "sched/topology.h"
+#include "sched/fiber.h"
+#include "sched/fpu.h"
+#include "sched/workqueue.h"
+#include "sched/parallel.h"
+#include "sync/futex.h"
+#include "time/timer.h"
 #include "desc/rsdp.h"
 #include "desc/rsdt.h"
 #include "desc/madt.h"
 #include "apic/ap_startup.h"
+#include "cmdline/cmdline.h"
+#include "kalloc/memmap.h"
 
 /**
  * @brief Initialize ACPI subsystem and map APIC memory regions
@@ -50,7 +62,10 @@ static void init_acpi_and_map_apic(pagetable_t kernel_table)
     if (lapic_addr != 0)
     {
         LOG_SERIAL("MEMORY", "Mapping Local APIC at 0x%x", lapic_addr);
-        map_apic_region(kernel_table, lapic_addr, PGSIZE);
+        if (ioremap(lapic_addr, PGSIZE) == NULL)
+        {
+            panic("Unable to map Local APIC");
+        }
     }
     
     // Map all I/O APIC regions found in MADT
@@ -68,7 +83,10 @@ static void init_acpi_and_map_apic(pagetable_t kernel_table)
             {
                 struct MADTEntryIOAPIC *ioapic = (struct MADTEntryIOAPIC *)entry_ptr;
                 LOG_SERIAL("MEMORY", "Mapping I/O APIC at 0x%x", ioapic->IOAPICAddr);
-                map_apic_region(kernel_table, ioapic->IOAPICAddr, PGSIZE);
+                if (ioremap(ioapic->IOAPICAddr, PGSIZE) == NULL)
+                {
+                    LOG_SERIAL("MEMORY", "Failed to map I/O APIC at 0x%x", ioapic->IOAPICAddr);
+                }
             }
             
             entry_ptr += header->Length;
@@ -84,7 +102,7 @@ static void init_acpi_and_map_apic(pagetable_t kernel_table)
  * @brief Demo thread function for SMP scheduler testing
  * 
  * Each thread prints its ID and which CPU it's running on.
- * Uses yield() to allow other threads to run.
+ * Sleeps between prints to let other threads run.
  */
 static void demo_thread_func(void *arg)
 {
@@ -95,11 +113,8 @@ static void demo_thread_func(void *arg)
         LOG_SERIAL("THREAD", "Thread %d running on CPU %d (tick %d)", 
                    thread_id, cpu->cpu_index, i);
         
-        // Busy wait to simulate work
-        for (volatile int j = 0; j < 5000000; j++);
-        
-        // Yield to let other threads run
-        sched_yield();
+        // Wait for simulated work without holding the CPU
+        thread_sleep_ns(50 * 1000000ull);
     }
     
     LOG_SERIAL("THREAD", "Thread %d finished", thread_id);
@@ -213,6 +228,10 @@ int kernel_main()
 
     LOG("Kernel started");
 
+    // The boot loader's information structure lives in memory kinit() frees
+    cmdline_init();
+    memmap_init();
+
     init_tty();
     for (uint8_t i = 0; i < TERMINALS_NUMBER; i++)
     {
@@ -224,24 +243,39 @@ int kernel_main()
     LOG(" CR3: %x", rcr3());
     LOG("Kernel end at address: %d", KEND);
     LOG("Kernel size: %d", KEND - KSTART);
-    LOG_SERIAL("MEMORY", "Calling kinit(%p, %p)", KEND, INIT_PHYSTOP);
-    kinit(KEND, INIT_PHYSTOP);
+    LOG_SERIAL("MEMORY", "Calling kinit(%p, %p)", V2P(KEND), INIT_PHYSTOP);
+    kinit(V2P(KEND), INIT_PHYSTOP);
     LOG_SERIAL("MEMORY", "kinit complete");
 
     LOG_SERIAL("MEMORY", "Calling kvminit(%p, %p)", INIT_PHYSTOP, PHYSTOP);
     pagetable_t kernel_table = kvminit(INIT_PHYSTOP, PHYSTOP);
     LOG_SERIAL("MEMORY", "kvminit complete, kernel_table=%p", kernel_table);
     LOG("kernel table: %p", kernel_table);
+    log_pagetable_stats("kvminit");
+    vm_init();
+
+    // Program PAT and switch the console to a write-combining mapping
+    pat_init();
+    if (vga_enable_write_combining() == 0)
+    {
+        LOG_SERIAL("BOOT", "VGA buffer mapped write-combining");
+    }
+
+    // FPU state is switched lazily; threads fault in their registers on first use
+    fpu_init_cpu();
+    fpu_log();
 
     // Initialize ACPI and map APIC regions
     init_acpi_and_map_apic(kernel_table);
+    log_pagetable_stats("ACPI/APIC mapped");
 
     // Copy ACPI tables to safe memory before freeing upper memory region
     rsdt_copy_to_safe_memory();
     madt_copy_to_safe_memory();
 
-    // Free upper memory region (INIT_PHYSTOP to PHYSTOP)
-    kinit(INIT_PHYSTOP, PHYSTOP);
+    // Free the RAM between INIT_PHYSTOP and PHYSTOP, skipping the holes
+    // of the memory map
+    memmap_kinit(INIT_PHYSTOP, PHYSTOP);
     LOG("Successfully allocated physical memory up to %p", PHYSTOP);
     LOG_SERIAL("MEMORY", "Physical memory initialized");
 
@@ -255,6 +289,7 @@ int kernel_main()
 
     // Initialize SMP scheduler
     sched_init();
+    futex_init();
     // Initialize scheduler for bootstrap processor
     sched_init_cpu();
 
@@ -270,12 +305,27 @@ int kernel_main()
     uint32_t ap_count = start_all_aps(kernel_table);
     LOG_SERIAL("KERNEL", "Started %d Application Processors", ap_count);
 
+    // Scheduling domains need the CPU indices the APs got at startup
+    topology_init();
+    topology_log();
+
+    // Every AP is running in the higher half now, the low identity map can go
+    drop_identity_map();
+    LOG_SERIAL("MEMORY", "Identity map of low memory removed");
+    log_pagetable_stats("APs started");
+
     // Log per-CPU data after all CPUs are initialized
     percpu_log_cpu_info();
 
     // Wait for all APs to initialize their schedulers
     for (volatile int i = 0; i < 10000000; i++);
 
+    // One fiber executor, one worker and one parallel worker thread per AP;
+    // the BSP gets its own once it schedules
+    fiber_init();
+    workqueue_init();
+    parallel_init();
+
 #ifdef TEST
     run_tests();
     shutdown();
@@ -291,6 +341,9 @@ int kernel_main()
     
     // Mark BSP scheduler as ready and start scheduling
     mycpu()->scheduler_ready = true;
+    fiber_init();
+    workqueue_init();
+    parallel_init();
     LOG_SERIAL("KERNEL", "Starting SMP scheduler on BSP");
     
     // Run the scheduler (never returns)
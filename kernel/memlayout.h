@@ -9,12 +9,40 @@
 #ifndef MEMLAYOUT_H
 #define MEMLAYOUT_H
 
+#include <stdint.h>
+
+/**
+ * @brief Virtual base of the kernel image.
+ * 
+ * The kernel is linked in the top 2 GB of the address space, so virtual
+ * address KERNBASE + x refers to physical address x.
+ * Must match KERNEL_OFFSET in boot.asm and linker.ld.
+ */
+#define KERNBASE 0xFFFFFFFF80000000ULL
+
+/**
+ * @brief Virtual base of the direct map of physical memory.
+ * 
+ * All RAM is mapped starting here (PML4 slot 256), so any physical address
+ * pa is reachable at DIRECT_MAP_BASE + pa.
+ */
+#define DIRECT_MAP_BASE 0xFFFF800000000000ULL
+
+/**
+ * @brief Virtual window for demand-paged anonymous regions.
+ * 
+ * Regions created with vm_map_anon() are placed here (PML4 slot 384) and
+ * backed by frames only when first touched.
+ */
+#define ANON_BASE 0xFFFFC00000000000ULL
+#define ANON_END  (ANON_BASE + 0x1000000000ULL)   // 64 GB
+
 /**
  * @brief Kernel virtual memory start address.
  * 
- * The kernel is linked to start at 1 MB (0x100000) in physical memory.
+ * The kernel is loaded at 1 MB (0x100000) in physical memory.
  */
-#define KSTART 0x100000
+#define KSTART (KERNBASE + 0x100000)
 
 /**
  * @brief Symbol representing the end of the kernel in memory.
@@ -35,9 +63,25 @@ extern char end[];
 /**
  * @brief Top of usable physical memory.
  * 
- * The kernel can manage memory up to this address.
+ * The kernel can manage memory up to this address. Set from the boot
+ * loader's memory map by memmap_init(), see kalloc/memmap.h.
  */
-#define PHYSTOP (128 * 1024 * 1024)      // 128 MB
+extern uint64_t phystop;
+#define PHYSTOP phystop
+
+/**
+ * @brief Physical memory mapped by boot.asm, with 2 MB pages past the first.
+ * 
+ * kvminit() maps the RAM above it.
+ */
+#define BOOT_DIRECT_MAP_END (1024ULL * 1024 * 1024)   // 1 GB
+
+/**
+ * @brief Largest physical address the direct map can reach.
+ * 
+ * The direct map ends where the anonymous window starts.
+ */
+#define DIRECT_MAP_SIZE (ANON_BASE - DIRECT_MAP_BASE)
 
 /**
  * @brief Size of one memory page in bytes.
@@ -63,5 +107,36 @@ extern char end[];
  */
 #define PGROUNDDOWN(a) ((a) & ~(PGSIZE - 1))
 
+/**
+ * @brief Translate a physical address to its direct-map virtual address.
+ */
+static inline void *phys_to_virt(uint64_t pa)
+{
+    return (void *)(pa + DIRECT_MAP_BASE);
+}
+
+/**
+ * @brief Translate a kernel virtual address back to a physical address.
+ * 
+ * Accepts addresses in the kernel image and in the direct map. Anything
+ * else is assumed to be identity mapped (early boot, AP trampoline).
+ */
+static inline uint64_t virt_to_phys(const void *va)
+{
+    uint64_t addr = (uint64_t)va;
+    if (addr >= KERNBASE)
+    {
+        return addr - KERNBASE;
+    }
+    if (addr >= DIRECT_MAP_BASE)
+    {
+        return addr - DIRECT_MAP_BASE;
+    }
+    return addr;
+}
+
+#define P2V(pa) phys_to_virt((uint64_t)(pa))
+#define V2P(va) virt_to_phys((const void *)(va))
+
 #endif // MEMLAYOUT_H
 
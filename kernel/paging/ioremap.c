@@ -0,0 +1,247 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Reference-counted registry of MMIO mappings.
+//
+
+#include "ioremap.h"
+#include "paging.h"
+#include "pat.h"
+#include "../memlayout.h"
+#include "../sync/spinlock.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+
+/**
+ * @brief A physical range mapped through ioremap
+ *
+ * Ranges are page aligned and mapped at their direct-map address. `owned`
+ * is false when some page was already present before the first ioremap
+ * (kernel image, low memory, boot maps), in which case the mapping is left
+ * in place on the final iounmap.
+ */
+struct ioremap_region
+{
+    uint64_t pa_start;
+    uint64_t pa_end;
+    int flags;
+    uint32_t refcount;
+    bool owned;
+};
+
+// Page flags of a write-back mapping, the type of the RAM direct map
+#define IOREMAP_WB_FLAGS PTE_W
+
+static struct ioremap_region regions[IOREMAP_MAX_REGIONS];
+static struct spinlock ioremap_lock;
+static struct ioremap_stats stats;
+
+static struct ioremap_region *find_covering(uint64_t start, uint64_t end, int flags)
+{
+    for (int i = 0; i < IOREMAP_MAX_REGIONS; i++)
+    {
+        struct ioremap_region *r = &regions[i];
+        if (r->refcount != 0 && r->flags == flags && r->pa_start <= start && end <= r->pa_end)
+        {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static struct ioremap_region *find_conflict(uint64_t start, uint64_t end, int flags)
+{
+    for (int i = 0; i < IOREMAP_MAX_REGIONS; i++)
+    {
+        struct ioremap_region *r = &regions[i];
+        if (r->refcount != 0 && r->flags != flags && r->pa_start < end && start < r->pa_end)
+        {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static struct ioremap_region *find_free_slot(void)
+{
+    for (int i = 0; i < IOREMAP_MAX_REGIONS; i++)
+    {
+        if (regions[i].refcount == 0)
+        {
+            return &regions[i];
+        }
+    }
+    return NULL;
+}
+
+static bool range_has_mapping(pagetable_t tbl, uint64_t start, uint64_t end)
+{
+    for (uint64_t addr = start; addr < end; addr += PGSIZE)
+    {
+        if (mapping_size(tbl, (uint64_t)P2V(addr)) != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool range_in_large_pages(pagetable_t tbl, uint64_t start, uint64_t end)
+{
+    for (uint64_t addr = start; addr < end; addr += PGSIZE)
+    {
+        if (mapping_size(tbl, (uint64_t)P2V(addr)) < LARGE_PGSIZE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *ioremap_flags(uint64_t pa, uint64_t size, int flags)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    uint64_t start = PGROUNDDOWN(pa);
+    uint64_t end = PGROUNDUP(pa + size);
+    void *va = NULL;
+
+    acquire_spinlock(&ioremap_lock);
+
+    struct ioremap_region *region = find_covering(start, end, flags);
+    if (region != NULL)
+    {
+        region->refcount++;
+        stats.hits++;
+        va = P2V(pa);
+        goto out;
+    }
+
+    struct ioremap_region *conflict = find_conflict(start, end, flags);
+    if (conflict != NULL)
+    {
+        LOG_SERIAL("IOREMAP", "0x%llx-0x%llx overlaps 0x%llx-0x%llx with a different memory type",
+                   start, end, conflict->pa_start, conflict->pa_end);
+        goto out;
+    }
+
+    region = find_free_slot();
+    if (region == NULL)
+    {
+        LOG_SERIAL("IOREMAP", "Registry full, cannot map 0x%llx-0x%llx", start, end);
+        goto out;
+    }
+
+    pagetable_t tbl = current_pagetable();
+    bool owned = !range_has_mapping(tbl, start, end);
+
+    // RAM in the direct map uses 2 MB or 1 GB write-back pages which are
+    // left as they are, so only write-back requests can be served there;
+    // everything else (device windows above RAM, low memory) is mapped here
+    bool large = range_in_large_pages(tbl, start, end);
+    if (large && flags != IOREMAP_WB_FLAGS)
+    {
+        LOG_SERIAL("IOREMAP", "0x%llx-0x%llx is write-back RAM in large pages, cannot change its type",
+                   start, end);
+        goto out;
+    }
+    if (!large && map_pages(tbl, (uint64_t)P2V(start), start, end - start, flags) != 0)
+    {
+        LOG_SERIAL("IOREMAP", "Failed to map 0x%llx-0x%llx", start, end);
+        goto out;
+    }
+
+    region->pa_start = start;
+    region->pa_end = end;
+    region->flags = flags;
+    region->refcount = 1;
+    region->owned = owned;
+    stats.misses++;
+    stats.regions++;
+    va = P2V(pa);
+
+out:
+    release_spinlock(&ioremap_lock);
+    return va;
+}
+
+void *ioremap(uint64_t pa, uint64_t size)
+{
+    return ioremap_flags(pa, size, PTE_W | PTE_PCD);
+}
+
+void *ioremap_cache(uint64_t pa, uint64_t size)
+{
+    return ioremap_flags(pa, size, IOREMAP_WB_FLAGS);
+}
+
+void *ioremap_wc(uint64_t pa, uint64_t size)
+{
+    if (!pat_wc_available())
+    {
+        return ioremap(pa, size);
+    }
+    return ioremap_flags(pa, size, PTE_W | PTE_PAT);
+}
+
+void iounmap(void *va)
+{
+    uint64_t pa = V2P(va);
+    struct ioremap_region *region = NULL;
+
+    acquire_spinlock(&ioremap_lock);
+
+    // Prefer the smallest live region containing the address
+    for (int i = 0; i < IOREMAP_MAX_REGIONS; i++)
+    {
+        struct ioremap_region *r = &regions[i];
+        if (r->refcount != 0 && r->pa_start <= pa && pa < r->pa_end)
+        {
+            if (region == NULL || (r->pa_end - r->pa_start) < (region->pa_end - region->pa_start))
+            {
+                region = r;
+            }
+        }
+    }
+
+    if (region == NULL)
+    {
+        LOG_SERIAL("IOREMAP", "iounmap of unknown address %p", va);
+        release_spinlock(&ioremap_lock);
+        return;
+    }
+
+    if (--region->refcount == 0)
+    {
+        // Another region may still cover part of this range
+        bool shared = false;
+        for (int i = 0; i < IOREMAP_MAX_REGIONS; i++)
+        {
+            struct ioremap_region *r = &regions[i];
+            if (r->refcount != 0 && r->pa_start < region->pa_end && region->pa_start < r->pa_end)
+            {
+                shared = true;
+                break;
+            }
+        }
+
+        if (region->owned && !shared)
+        {
+            unmap_pages(current_pagetable(), (uint64_t)P2V(region->pa_start),
+                        region->pa_end - region->pa_start);
+        }
+        stats.unmaps++;
+        stats.regions--;
+    }
+
+    release_spinlock(&ioremap_lock);
+}
+
+struct ioremap_stats get_ioremap_stats(void)
+{
+    return stats;
+}
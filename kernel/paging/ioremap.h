@@ -0,0 +1,85 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Reference-counted registry of MMIO mappings.
+// Ranges are mapped at their direct-map address (phys_to_virt).
+// Repeated requests for a physical range that is already mapped with the
+// same memory type are served from the registry without touching the
+// page tables.
+//
+
+#ifndef SHIPOS_IOREMAP_H
+#define SHIPOS_IOREMAP_H
+
+#include <stdint.h>
+
+// Maximum number of distinct physical ranges tracked at once
+#define IOREMAP_MAX_REGIONS 64
+
+/**
+ * @brief Registry counters
+ */
+struct ioremap_stats {
+    uint64_t hits;      // Requests served by an existing mapping
+    uint64_t misses;    // Requests that had to edit the page tables
+    uint64_t unmaps;    // Regions released after their last reference
+    uint32_t regions;   // Regions currently registered
+};
+
+/**
+ * @brief Map a physical range as uncached device memory
+ *
+ * If a registered region of the same memory type already covers the range
+ * its reference count is taken and the existing address is returned.
+ *
+ * Fails for RAM mapped by the direct map's 2 MB and 1 GB pages, which
+ * stay write-back; use ioremap_cache() for firmware tables in RAM.
+ *
+ * @param pa Physical address of the range
+ * @param size Size of the range in bytes
+ * @return Virtual address of pa, or NULL on failure
+ */
+void *ioremap(uint64_t pa, uint64_t size);
+
+/**
+ * @brief Map a physical range as write-back memory
+ *
+ * For firmware tables and other RAM-backed data; works anywhere,
+ * including the large pages of the direct map.
+ *
+ * @param pa Physical address of the range
+ * @param size Size of the range in bytes
+ * @return Virtual address of pa, or NULL on failure
+ */
+void *ioremap_cache(uint64_t pa, uint64_t size);
+
+/**
+ * @brief Map a physical range as write-combining memory
+ *
+ * Same as ioremap(), but selects the PAT write-combining type. Falls back
+ * to an uncached mapping when PAT is not available. Fails for RAM in large
+ * direct-map pages, like ioremap().
+ *
+ * @param pa Physical address of the range
+ * @param size Size of the range in bytes
+ * @return Virtual address of pa, or NULL on failure
+ */
+void *ioremap_wc(uint64_t pa, uint64_t size);
+
+/**
+ * @brief Drop a reference taken by ioremap(), ioremap_cache() or ioremap_wc()
+ *
+ * When the last reference goes away the pages are unmapped, unless they
+ * were already mapped before the region was registered.
+ *
+ * @param va Any address inside the mapped range
+ */
+void iounmap(void *va);
+
+/**
+ * @brief Get a snapshot of the registry counters
+ */
+struct ioremap_stats get_ioremap_stats(void);
+
+#endif // SHIPOS_IOREMAP_H
@@ -11,6 +11,57 @@
 #include "../memlayout.h"
 #include "../lib/include/x86_64.h"
 #include "../lib/include/logging.h"
+#include "../lib/include/panic.h"
+#include "ioremap.h"
+#include "../sched/percpu.h"
+#include "../sync/spinlock.h"
+#include "../apic/lapic.h"
+#include "../idt/idt.h"
+#include "../kalloc/memmap.h"
+
+// Number of freed page-table pages collected before the TLB is flushed
+#define PT_FREE_BATCH_MAX 16
+
+// Above this many pages a full CR3 reload is cheaper than per-page invlpg
+#define TLB_FLUSH_ALL_THRESHOLD 32
+
+/**
+ * @brief Page-table pages waiting to be returned to the allocator
+ *
+ * Tables unlinked from their parent may still be cached by the MMU, so they
+ * are only handed back to kfree() after the TLB flush that covers them.
+ */
+struct pt_free_batch {
+    void *pages[PT_FREE_BATCH_MAX];
+    int count;
+};
+
+/**
+ * @brief Link kept at the start of a page-table page waiting for the other CPUs' TLB flush
+ *
+ * Another CPU may still walk the table, so both words keep bit 0, the
+ * present bit, clear: next is page aligned and gen is stored shifted.
+ */
+struct pt_deferred_page {
+    struct pt_deferred_page *next;
+    uint64_t gen_shifted;   // pt_flush_gen when the page was unlinked, << 1
+};
+
+static struct pagetable_stats pt_stats;
+
+// Held while tables of the shared kernel page table are allocated, filled
+// or reclaimed, so no CPU installs an entry in a table being freed
+static struct spinlock pt_lock;
+
+// Kernel page tables are shared, so another CPU's paging-structure cache
+// may still walk a table unlinked here. Such tables are only freed once
+// every running CPU has flushed its TLB after the unlink, tracked by a
+// generation counter each CPU copies when it flushes. The list is in
+// unlink order, so generations only grow towards the tail.
+static volatile uint64_t pt_flush_gen;
+static struct pt_deferred_page *pt_deferred_head;
+static struct pt_deferred_page *pt_deferred_tail;
+static struct spinlock pt_defer_lock;
 
 page_entry_raw encode_page_entry(struct page_entry entry) {
 
@@ -65,7 +116,7 @@ void do_print_vm(pagetable_t tbl, int level) {
                 print(".. ");
             }
             print_entry(&entry);
-            if (level > 1) do_print_vm(entry.address << 12, level-1);
+            if (level > 1 && !entry.rsvd) do_print_vm(P2V(entry.address << 12), level-1);
         }
     }
 }
@@ -96,8 +147,14 @@ void init_entry(page_entry_raw *raw_entry, uint64_t addr) {
     *raw_entry = encode_page_entry(entry);
 }
 
-struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc) {
-    for (int level = 3; level > 0; level--) {
+/**
+ * @brief Walk down to the entry that maps va at the given level
+ *
+ * Level 0 is the PT, 1 the PD, 2 the PDPT. Tables are reached through the
+ * direct map. Returns 0 if a large page is found above the requested level.
+ */
+static page_entry_raw *walk_level(pagetable_t tbl, uint64_t va, int stop_level, bool alloc) {
+    for (int level = 3; level > stop_level; level--) {
         int level_index = (va >> (12 + level * 9)) & 0x1FF;
         // printf("VA: %p TBL: %p LEVEL: %d INDEX: %d\n", va, tbl, level, level_index);
         page_entry_raw *entry_raw = &tbl[level_index];
@@ -106,7 +163,10 @@ struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc) {
 
         if (entry.p) {
             // printf("PRESENT, CONTINUE\n");
-            tbl = entry.address << 12;
+            if (level < 3 && entry.rsvd) {
+                return 0;   // Large page, there is no table below
+            }
+            tbl = P2V(entry.address << 12);
         } else {
             // printf("NOT PRESENT, ALLOC NEW TABLE\n");
             if (alloc == 0 || (tbl = kalloc()) == 0) {
@@ -114,12 +174,26 @@ struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc) {
             }
             // printf("Allocated page at %p\n", tbl);
             memset(tbl, 0, PGSIZE);
-            init_entry(entry_raw, (uint64_t)tbl);
+            init_entry(entry_raw, V2P(tbl));
+            __sync_add_and_fetch(&pt_stats.allocated, 1);
+            uint64_t in_use = __sync_add_and_fetch(&pt_stats.in_use, 1);
+            uint64_t peak = pt_stats.peak;
+            while (in_use > peak && !__sync_bool_compare_and_swap(&pt_stats.peak, peak, in_use)) {
+                peak = pt_stats.peak;
+            }
         }
     }
 
     // printf("ENTRY IN TABLE %p\n", tbl);
-    return tbl + ((va >> 12) & 0x1FF);
+    return tbl + ((va >> (12 + stop_level * 9)) & 0x1FF);
+}
+
+struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc) {
+    return (struct page_entry_raw *)walk_level(tbl, va, 0, alloc);
+}
+
+pagetable_t current_pagetable(void) {
+    return P2V(PGROUNDDOWN(rcr3()));
 }
 
 /**
@@ -132,6 +206,7 @@ void map_apic_region(pagetable_t tbl, uint64_t apic_base, uint32_t size) {
     LOG("Mapping APIC region at 0x%x (size: %d bytes)", apic_base, size);
     
     // Map each page in the APIC region
+    acquire_spinlock(&pt_lock);
     for (uint64_t addr = apic_base; addr < apic_base + size; addr += PGSIZE) {
         page_entry_raw *entry_raw = walk(tbl, addr, 1);
         if (entry_raw == 0) {
@@ -157,6 +232,7 @@ void map_apic_region(pagetable_t tbl, uint64_t apic_base, uint32_t size) {
         
         *entry_raw = encode_page_entry(entry);
     }
+    release_spinlock(&pt_lock);
     
     // Flush TLB for the mapped region
     for (uint64_t addr = apic_base; addr < apic_base + size; addr += PGSIZE) {
@@ -166,6 +242,7 @@ void map_apic_region(pagetable_t tbl, uint64_t apic_base, uint32_t size) {
 
 void map_low_memory(pagetable_t tbl, uint64_t start, uint64_t size)
 {
+    acquire_spinlock(&pt_lock);
     for (uint64_t addr = start; addr < start + size; addr += PGSIZE)
     {
         page_entry_raw *entry_raw = walk(tbl, addr, 1);
@@ -192,6 +269,7 @@ void map_low_memory(pagetable_t tbl, uint64_t start, uint64_t size)
         
         *entry_raw = encode_page_entry(entry);
     }
+    release_spinlock(&pt_lock);
     
     // Flush TLB
     for (uint64_t addr = start; addr < start + size; addr += PGSIZE)
@@ -200,25 +278,77 @@ void map_low_memory(pagetable_t tbl, uint64_t start, uint64_t size)
     }
 }
 
+static bool cpu_has_huge_pages(void) {
+    uint32_t regs[4];
+
+    // CPUID leaf 0x80000001: EDX[26] indicates 1 GB pages
+    cpuid(0x80000001, 0, regs);
+    return (regs[3] >> 26) & 1;
+}
+
+/**
+ * @brief Map [pa, end) at its direct-map address, skipping what is already mapped
+ *
+ * Uses 1 GB pages for aligned gigabytes when the CPU has them, 2 MB pages
+ * elsewhere. The caller holds pt_lock.
+ */
+static void direct_map_range(pagetable_t tbl4, uint64_t pa, uint64_t end, bool huge) {
+    pa &= ~(uint64_t)(LARGE_PGSIZE - 1);
+    while (pa < end) {
+        if (huge && (pa & (HUGE_PGSIZE - 1)) == 0 && end - pa >= HUGE_PGSIZE) {
+            page_entry_raw *pdpte = walk_level(tbl4, (uint64_t)P2V(pa), 2, 1);
+            if (pdpte == 0) {
+                panic("kvminit: cannot allocate direct map tables");
+            }
+            if (!(*pdpte & PTE_P)) {
+                *pdpte = pa | PTE_P | PTE_W | PTE_PS;
+            }
+            if (*pdpte & PTE_PS) {
+                pa += HUGE_PGSIZE;
+                continue;
+            }
+        }
+
+        page_entry_raw *pde = walk_level(tbl4, (uint64_t)P2V(pa), 1, 1);
+        if (pde == 0) {
+            panic("kvminit: cannot allocate direct map tables");
+        }
+        if (!(*pde & PTE_P)) {
+            *pde = pa | PTE_P | PTE_W | PTE_PS;
+        }
+        pa += LARGE_PGSIZE;
+    }
+}
+
 pagetable_t kvminit(uint64_t start, uint64_t end) {
     LOG("Setting up kernel page table...");
-    pagetable_t tbl4 = rcr3();
-
-    char *addr;
-    addr = (char*)PGROUNDUP(start);
-    for(;addr + PGSIZE < end; addr += PGSIZE) {
-        //printf("Walking address %p\n", addr);
-        page_entry_raw *entry_raw = walk(tbl4, addr, 1);
-        // printf("FOUND ENTRY AT ADDRESS: %p\n", entry_raw);
-        // TODO an infinite busy-wait loop. Add panic
-        while (entry_raw == 0) {}
-        init_entry(entry_raw, addr);
-        // printf("INITIALIZED ENTRY: %p\n", addr);
+    pagetable_t tbl4 = current_pagetable();
+    bool huge = cpu_has_huge_pages();
+
+    // Extend the direct map over the RAM of the memory map only, so device
+    // windows between regions stay free for ioremap(); boot.asm already
+    // covers the first 1 GB
+    const struct memmap_region *ram;
+    int count = memmap_ram(&ram);
+    acquire_spinlock(&pt_lock);
+    for (int i = 0; i < count; i++) {
+        uint64_t lo = ram[i].start > start ? ram[i].start : start;
+        uint64_t hi = ram[i].end < end ? ram[i].end : end;
+        if (lo < hi) {
+            direct_map_range(tbl4, lo, hi, huge);
+        }
     }
+    release_spinlock(&pt_lock);
 
     return tbl4;
 }
 
+void drop_identity_map(void) {
+    pagetable_t tbl4 = current_pagetable();
+    tbl4[0] = 0;
+    wcr3(rcr3());
+}
+
 void invlpg(uint64_t va) {
     asm volatile("invlpg (%0)" : : "r"(va) : "memory");
 }
@@ -227,14 +357,17 @@ int map_page(pagetable_t tbl, uint64_t va, uint64_t pa, int flags) {
     va = PGROUNDDOWN(va);
     pa = PGROUNDDOWN(pa);
     
+    acquire_spinlock(&pt_lock);
     page_entry_raw *pte = (page_entry_raw *)walk(tbl, va, 1);
     if (pte == 0) {
+        release_spinlock(&pt_lock);
         return -1;
     }
     
     struct page_entry entry = decode_page_entry(*pte);
     
     if (entry.p && (entry.address << 12) != pa) {
+        release_spinlock(&pt_lock);
         LOG("map_page: va %p already mapped to %p, trying to map to %p",
             va, entry.address << 12, pa);
         return -1;
@@ -247,13 +380,14 @@ int map_page(pagetable_t tbl, uint64_t va, uint64_t pa, int flags) {
     entry.pcd = (flags & PTE_PCD) ? 1 : 0;
     entry.a = 0;
     entry.d = 0;
-    entry.rsvd = 0;
+    entry.rsvd = (flags & PTE_PAT) ? 1 : 0;
     entry.ign1 = 0;
     entry.address = (pa >> 12) & 0xFFFFFFFFF;
     entry.ign2 = 0;
     entry.xd = 0;
     
     *pte = encode_page_entry(entry);
+    release_spinlock(&pt_lock);
     
     invlpg(va);
     
@@ -267,9 +401,7 @@ int map_pages(pagetable_t tbl, uint64_t va, uint64_t pa, uint64_t size, int flag
     
     for (uint64_t addr = va_start; addr < va_end; addr += PGSIZE) {
         if (map_page(tbl, addr, pa_cur, flags) != 0) {
-            for (uint64_t rollback = va_start; rollback < addr; rollback += PGSIZE) {
-                unmap_page(tbl, rollback);
-            }
+            unmap_pages(tbl, va_start, addr - va_start);
             return -1;
         }
         pa_cur += PGSIZE;
@@ -279,58 +411,293 @@ int map_pages(pagetable_t tbl, uint64_t va, uint64_t pa, uint64_t size, int flag
 }
 
 void *map_mmio(uint64_t pa, uint64_t size) {
-    pagetable_t tbl = (pagetable_t)rcr3();
-    
-    uint64_t pa_aligned = PGROUNDDOWN(pa);
-    uint64_t offset = pa - pa_aligned;
-    uint64_t map_size = size + offset;
-    
-    if (map_pages(tbl, pa_aligned, pa_aligned, map_size, PTE_W | PTE_PCD) != 0) {
-        return 0;
+    return ioremap(pa, size);
+}
+
+void *map_mmio_wc(uint64_t pa, uint64_t size) {
+    return ioremap_wc(pa, size);
+}
+
+/**
+ * @brief Check whether a page table was allocated by walk()
+ *
+ * Boot-time tables live in the kernel image (below `end`) and must never be
+ * handed to kfree().
+ */
+static bool pt_is_reclaimable(pagetable_t tbl) {
+    uint64_t addr = V2P(tbl);
+    return addr >= PGROUNDUP(V2P(end)) && addr < PHYSTOP;
+}
+
+static bool pt_is_empty(pagetable_t tbl) {
+    for (int i = 0; i < ENTRIES_COUNT; i++) {
+        if (tbl[i] & PTE_P) {
+            return false;
+        }
     }
-    
-    return (void *)(uintptr_t)pa;
+    return true;
 }
 
-void unmap_page(pagetable_t tbl, uint64_t va) {
-    va = PGROUNDDOWN(va);
-    
-    page_entry_raw *pte = (page_entry_raw *)walk(tbl, va, 0);
-    if (pte == 0) {
+/**
+ * @brief Free the deferred tables every running CPU has flushed (caller holds pt_defer_lock)
+ */
+static void pt_free_flushed(void) {
+    uint64_t min = pt_flush_gen;
+    for (uint32_t i = 0; i < ncpu; i++) {
+        if (percpus[i].started && percpus[i].pt_flush_gen < min) {
+            min = percpus[i].pt_flush_gen;
+        }
+    }
+
+    while (pt_deferred_head != 0 && (pt_deferred_head->gen_shifted >> 1) <= min) {
+        struct pt_deferred_page *page = pt_deferred_head;
+        pt_deferred_head = page->next;
+        kfree(page);
+        pt_stats.deferred--;
+    }
+    if (pt_deferred_head == 0) {
+        pt_deferred_tail = 0;
+    }
+}
+
+void pt_flush_check(void) {
+    struct percpu *cpu = mycpu();
+    uint64_t gen = pt_flush_gen;
+
+    if (cpu->pt_flush_gen != gen) {
+        wcr3(rcr3());
+        cpu->pt_flush_gen = gen;
+    }
+
+    // The last CPU to flush frees the tables; the tick retries if the
+    // lock is busy
+    if (pt_deferred_head != 0 && try_acquire_spinlock(&pt_defer_lock)) {
+        pt_free_flushed();
+        release_spinlock(&pt_defer_lock);
+    }
+}
+
+static bool pt_other_cpus_running(void) {
+    struct percpu *self = mycpu();
+    for (uint32_t i = 0; i < ncpu; i++) {
+        if (percpus[i].started && &percpus[i] != self) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void tlb_shootdown(void) {
+    bool sent[MAX_CPUS];
+
+    pushcli();
+    struct percpu *self = mycpu();
+    if (self->ncli != 1) {
+        panic("tlb_shootdown: called with interrupts disabled");
+    }
+
+    uint64_t gen = __sync_add_and_fetch(&pt_flush_gen, 1);
+    wcr3(rcr3());
+    self->pt_flush_gen = gen;
+
+    for (uint32_t i = 0; i < ncpu; i++) {
+        struct percpu *cpu = &percpus[i];
+        sent[i] = cpu->started && cpu != self;
+        if (sent[i]) {
+            lapic_send_ipi(cpu->apic_id, APIC_TLB_VECTOR);
+        }
+    }
+    popcli();
+
+    // A CPU started after the IPIs never saw the old translations
+    for (uint32_t i = 0; i < ncpu; i++) {
+        while (sent[i] && percpus[i].pt_flush_gen < gen) {
+            asm volatile("pause");
+        }
+    }
+}
+
+static void pt_flush_batch(struct pt_free_batch *batch, uint64_t va_start, uint64_t va_end) {
+    if (va_end - va_start > TLB_FLUSH_ALL_THRESHOLD * PGSIZE) {
+        wcr3(rcr3());
+    } else {
+        // invlpg also drops every paging-structure cache entry of this CPU
+        for (uint64_t addr = va_start; addr < va_end; addr += PGSIZE) {
+            invlpg(addr);
+        }
+    }
+
+    if (batch->count == 0) {
         return;
     }
-    
-    struct page_entry entry = decode_page_entry(*pte);
-    if (!entry.p) {
+    __sync_add_and_fetch(&pt_stats.freed, batch->count);
+    __sync_sub_and_fetch(&pt_stats.in_use, batch->count);
+
+    pushcli();
+    if (!pt_other_cpus_running()) {
+        popcli();
+        for (int i = 0; i < batch->count; i++) {
+            kfree(batch->pages[i]);
+        }
+        batch->count = 0;
         return;
     }
-    
-    *pte = 0;
-    
-    invlpg(va);
+
+    acquire_spinlock(&pt_defer_lock);
+    uint64_t gen = __sync_add_and_fetch(&pt_flush_gen, 1);
+    mycpu()->pt_flush_gen = gen;
+    pt_free_flushed();
+    for (int i = 0; i < batch->count; i++) {
+        struct pt_deferred_page *page = batch->pages[i];
+        page->next = 0;
+        page->gen_shifted = gen << 1;
+        if (pt_deferred_tail != 0) {
+            pt_deferred_tail->next = page;
+        } else {
+            pt_deferred_head = page;
+        }
+        pt_deferred_tail = page;
+    }
+    pt_stats.deferred += batch->count;
+    release_spinlock(&pt_defer_lock);
+
+    // The others flush from the IPI; a CPU that starts meanwhile catches
+    // up in its first tick
+    for (uint32_t i = 0; i < ncpu; i++) {
+        struct percpu *cpu = &percpus[i];
+        if (cpu->started && cpu != mycpu() && cpu->pt_flush_gen < gen) {
+            lapic_send_ipi(cpu->apic_id, APIC_TLB_VECTOR);
+        }
+    }
+    popcli();
+    batch->count = 0;
+}
+
+/**
+ * @brief Unlink the PT, PD and PDPT covering va if they became empty
+ *
+ * Walks down from the PML4 remembering the parent slot of every level, then
+ * releases tables bottom-up until a level still has live entries. The PML4
+ * itself is never released.
+ */
+static void pt_reclaim(pagetable_t tbl, uint64_t va, struct pt_free_batch *batch) {
+    pagetable_t tables[4];
+    page_entry_raw *slots[4];
+    int depth = 0;
+
+    for (int level = 3; level > 0; level--) {
+        page_entry_raw *slot = &tbl[(va >> (12 + level * 9)) & 0x1FF];
+        struct page_entry entry = decode_page_entry(*slot);
+        if (!entry.p || (level < 3 && entry.rsvd)) {
+            break;
+        }
+        tbl = P2V(entry.address << 12);
+        slots[depth] = slot;
+        tables[depth] = tbl;
+        depth++;
+    }
+
+    while (depth > 0) {
+        depth--;
+        if (!pt_is_reclaimable(tables[depth]) || !pt_is_empty(tables[depth])) {
+            return;
+        }
+        *slots[depth] = 0;
+        batch->pages[batch->count++] = tables[depth];
+    }
+}
+
+void unmap_page(pagetable_t tbl, uint64_t va) {
+    unmap_pages(tbl, va, PGSIZE);
 }
 
 void unmap_pages(pagetable_t tbl, uint64_t va, uint64_t size) {
     uint64_t va_start = PGROUNDDOWN(va);
     uint64_t va_end = PGROUNDUP(va + size);
-    
+    uint64_t flush_start = va_start;
+    struct pt_free_batch batch;
+    batch.count = 0;
+
+    acquire_spinlock(&pt_lock);
     for (uint64_t addr = va_start; addr < va_end; addr += PGSIZE) {
-        unmap_page(tbl, addr);
+        page_entry_raw *pte = (page_entry_raw *)walk(tbl, addr, 0);
+        if (pte != 0) {
+            *pte = 0;
+        }
+
+        // Only the last page of each page table can make it empty
+        uint64_t next = addr + PGSIZE;
+        if (next == va_end || (next & ((ENTRIES_COUNT * PGSIZE) - 1)) == 0) {
+            // A single reclaim can release up to three tables
+            if (batch.count + 3 > PT_FREE_BATCH_MAX) {
+                pt_flush_batch(&batch, flush_start, addr);
+                flush_start = addr;
+            }
+            pt_reclaim(tbl, addr, &batch);
+        }
     }
+
+    pt_flush_batch(&batch, flush_start, va_end);
+    release_spinlock(&pt_lock);
 }
 
-uint64_t va_to_pa(pagetable_t tbl, uint64_t va) {
-    page_entry_raw *pte = (page_entry_raw *)walk(tbl, va, 0);
-    if (pte == 0) {
-        return 0;
+struct pagetable_stats get_pagetable_stats(void) {
+    return pt_stats;
+}
+
+void log_pagetable_stats(const char *stage) {
+    LOG_SERIAL("PAGING", "%s: page-table pages in use=%llu (%llu KiB), allocated=%llu, freed=%llu, peak=%llu",
+               stage, pt_stats.in_use, pt_stats.in_use * PGSIZE / 1024,
+               pt_stats.allocated, pt_stats.freed, pt_stats.peak);
+    if (pt_stats.deferred != 0) {
+        LOG_SERIAL("PAGING", "%s: %llu unlinked tables waiting for other CPUs' TLB flush",
+                   stage, pt_stats.deferred);
     }
-    
-    struct page_entry entry = decode_page_entry(*pte);
-    if (!entry.p) {
-        return 0;
+}
+
+uint64_t mapping_size(pagetable_t tbl, uint64_t va) {
+    uint64_t size = 0;
+
+    acquire_spinlock(&pt_lock);
+    page_entry_raw *pdpte = walk_level(tbl, va, 2, 0);
+    page_entry_raw *pde = walk_level(tbl, va, 1, 0);
+    if (pdpte != 0 && (*pdpte & PTE_P) && (*pdpte & PTE_PS)) {
+        size = HUGE_PGSIZE;
+    } else if (pde != 0 && (*pde & PTE_P)) {
+        if (*pde & PTE_PS) {
+            size = LARGE_PGSIZE;
+        } else {
+            page_entry_raw *pte = (page_entry_raw *)walk(tbl, va, 0);
+            size = (pte != 0 && (*pte & PTE_P)) ? PGSIZE : 0;
+        }
     }
-    
-    return (entry.address << 12) | (va & (PGSIZE - 1));
+    release_spinlock(&pt_lock);
+
+    return size;
+}
+
+uint64_t va_to_pa(pagetable_t tbl, uint64_t va) {
+    uint64_t pa = 0;
+
+    acquire_spinlock(&pt_lock);
+    page_entry_raw *pdpte = walk_level(tbl, va, 2, 0);
+    page_entry_raw *pde = walk_level(tbl, va, 1, 0);
+    if (pdpte != 0 && (*pdpte & PTE_P) && (*pdpte & PTE_PS)) {
+        pa = (*pdpte & PTE_ADDR_MASK & ~(HUGE_PGSIZE - 1)) | (va & (HUGE_PGSIZE - 1));
+    } else if (pde != 0 && (*pde & PTE_P) && (*pde & PTE_PS)) {
+        pa = (*pde & PTE_ADDR_MASK & ~(LARGE_PGSIZE - 1)) | (va & (LARGE_PGSIZE - 1));
+    } else {
+        page_entry_raw *pte = (page_entry_raw *)walk(tbl, va, 0);
+        if (pte != 0) {
+            struct page_entry entry = decode_page_entry(*pte);
+            if (entry.p) {
+                pa = (entry.address << 12) | (va & (PGSIZE - 1));
+            }
+        }
+    }
+    release_spinlock(&pt_lock);
+
+    return pa;
 }
 
 // Legacy hack
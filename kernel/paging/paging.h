@@ -57,6 +57,20 @@ struct page_entry_t {
     page_entry_raw table[ENTRIES_COUNT];
 };
 
+/**
+ * @brief Page-table memory accounting
+ *
+ * Counts the PDPT/PD/PT pages allocated by walk(). Boot-time tables that are
+ * part of the kernel image are not included.
+ */
+struct pagetable_stats {
+    uint64_t in_use;    // Page-table pages currently linked into a page table
+    uint64_t allocated; // Total page-table pages allocated since boot
+    uint64_t freed;     // Total page-table pages returned to the allocator
+    uint64_t peak;      // Highest value of in_use seen so far
+    uint64_t deferred;  // Unlinked, not yet freed until every CPU flushed
+};
+
 page_entry_raw encode_page_entry(struct page_entry);
 
 struct page_entry decode_page_entry(page_entry_raw);
@@ -65,14 +79,43 @@ void init_paging();
 
 void print_vm(pagetable_t);
 
+/**
+ * @brief Extend the direct map over the RAM in physical range [start, end)
+ * 
+ * Maps the regions of the memory map (see memmap_init) not mapped by
+ * boot.asm, with 1 GB pages where the CPU supports them and 2 MB pages
+ * elsewhere. Holes between regions are left for ioremap().
+ * 
+ * @return Direct-map address of the kernel PML4
+ */
 pagetable_t kvminit(uint64_t, uint64_t);
 
+/**
+ * @brief Find the PTE mapping va, allocating missing tables if alloc is set
+ *
+ * Takes no lock: on the shared kernel table, entries are installed through
+ * map_page()/map_pages(), which serialize with unmap_pages() reclaiming
+ * empty tables.
+ */
 struct page_entry_raw *walk(pagetable_t tbl, uint64_t va, bool alloc);
 
+/**
+ * @brief Get the active PML4 through the direct map
+ */
+pagetable_t current_pagetable(void);
+
+/**
+ * @brief Remove the boot identity map of low memory (PML4 slot 0)
+ * 
+ * Called once all APs have left the trampoline, which leaves the lower
+ * half of the address space free.
+ */
+void drop_identity_map(void);
+
 /**
  * @brief Map a single page from virtual address to physical address
  * 
- * @param tbl Page table to use (typically from rcr3())
+ * @param tbl Page table to use (typically from current_pagetable())
  * @param va Virtual address to map (will be page-aligned)
  * @param pa Physical address to map to (will be page-aligned)
  * @param flags Page flags (PTE_W for writable, PTE_U for user-accessible)
@@ -93,20 +136,37 @@ int map_page(pagetable_t tbl, uint64_t va, uint64_t pa, int flags);
 int map_pages(pagetable_t tbl, uint64_t va, uint64_t pa, uint64_t size, int flags);
 
 /**
- * @brief Map physical memory for MMIO/device access (identity mapping)
+ * @brief Map physical memory for MMIO/device access
  * 
- * Maps physical address to the same virtual address.
+ * Maps physical address at its direct-map virtual address.
  * Useful for accessing ACPI tables, device memory, etc.
+ * Goes through the ioremap registry, so ranges that are already mapped
+ * uncached are returned without touching the page tables.
  * 
  * @param pa Physical address to map
  * @param size Size in bytes to map
- * @return Virtual address (same as pa) on success, 0 on failure
+ * @return Direct-map virtual address of pa on success, 0 on failure
  */
 void *map_mmio(uint64_t pa, uint64_t size);
 
+/**
+ * @brief Map physical memory as write-combining
+ * 
+ * Intended for framebuffers and prefetchable device buffers, where bulk
+ * writes can be merged into burst transactions. Falls back to an uncached
+ * mapping when PAT is not available.
+ * 
+ * @param pa Physical address to map
+ * @param size Size in bytes to map
+ * @return Direct-map virtual address of pa on success, 0 on failure
+ */
+void *map_mmio_wc(uint64_t pa, uint64_t size);
+
 /**
  * @brief Unmap a single page
  * 
+ * Page tables left without any present entry are returned to the allocator.
+ * 
  * @param tbl Page table to use
  * @param va Virtual address to unmap
  */
@@ -115,12 +175,47 @@ void unmap_page(pagetable_t tbl, uint64_t va);
 /**
  * @brief Unmap a range of pages
  * 
+ * Empty intermediate tables are freed after a single TLB flush covering the
+ * whole range.
+ * 
  * @param tbl Page table to use
  * @param va Virtual address start
  * @param size Size in bytes to unmap
  */
 void unmap_pages(pagetable_t tbl, uint64_t va, uint64_t size);
 
+/**
+ * @brief Get a snapshot of page-table memory usage
+ * 
+ * @return Current page-table accounting counters
+ */
+struct pagetable_stats get_pagetable_stats(void);
+
+/**
+ * @brief Flush this CPU's TLB if page tables were unlinked since its last flush
+ *
+ * Called from the TLB flush IPI and from every timer interrupt. Unlinked
+ * tables are freed only after every running CPU has done this, by the
+ * next pt_flush_check() or unmap on any CPU.
+ */
+void pt_flush_check(void);
+
+/**
+ * @brief Flush every running CPU's TLB and wait until all have done so
+ *
+ * For memory that is reused as soon as it is unmapped, such as frames
+ * returned to kalloc(). Waits for the other CPUs' TLB flush IPI, so the
+ * caller must hold no spinlock and have interrupts enabled.
+ */
+void tlb_shootdown(void);
+
+/**
+ * @brief Log page-table memory usage to the serial port
+ * 
+ * @param stage Short description of the point in time being reported
+ */
+void log_pagetable_stats(const char *stage);
+
 /**
  * @brief Translate virtual address to physical address
  * 
@@ -130,6 +225,15 @@ void unmap_pages(pagetable_t tbl, uint64_t va, uint64_t size);
  */
 uint64_t va_to_pa(pagetable_t tbl, uint64_t va);
 
+/**
+ * @brief Get the size of the page that maps a virtual address
+ * 
+ * @param tbl Page table to use
+ * @param va Virtual address to look up
+ * @return PGSIZE, LARGE_PGSIZE or HUGE_PGSIZE, or 0 if va is not mapped
+ */
+uint64_t mapping_size(pagetable_t tbl, uint64_t va);
+
 /**
  * @brief Invalidate TLB entry for a virtual address
  * 
@@ -163,5 +267,15 @@ void map_low_memory(pagetable_t tbl, uint64_t start, uint64_t size);
 #define PTE_PCD 0x010   // Page-level cache disable
 #define PTE_A   0x020   // Accessed
 #define PTE_D   0x040   // Dirty
+#define PTE_PAT 0x080   // PAT index bit (4K leaf entries only)
+#define PTE_PS  0x080   // Page size: entry maps a large page (PD/PDPT only)
+
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL   // Physical address bits of an entry
+
+// Size of a page mapped by a PD entry with PTE_PS set
+#define LARGE_PGSIZE (2 * 1024 * 1024)
+
+// Size of a page mapped by a PDPT entry with PTE_PS set
+#define HUGE_PGSIZE (1024ULL * 1024 * 1024)
 
 #endif
\ No newline at end of file
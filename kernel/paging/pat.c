@@ -0,0 +1,49 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Page Attribute Table (PAT) setup.
+//
+
+#include "pat.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+
+static bool pat_programmed = false;
+
+static bool cpu_has_pat(void)
+{
+    uint32_t regs[4];
+
+    // CPUID leaf 1: EDX[16] indicates PAT support
+    cpuid(1, 0, regs);
+
+    return (regs[3] >> 16) & 1;
+}
+
+void pat_init(void)
+{
+    if (!cpu_has_pat())
+    {
+        LOG_SERIAL("PAT", "PAT not supported, write-combining disabled");
+        return;
+    }
+
+    uint64_t old = rdmsr(MSR_IA32_PAT);
+    if (old != PAT_KERNEL_LAYOUT)
+    {
+        // Flush caches around the change so no line keeps a stale memory type
+        wbinvd();
+        wrmsr(MSR_IA32_PAT, PAT_KERNEL_LAYOUT);
+        wbinvd();
+        wcr3(rcr3());
+    }
+
+    pat_programmed = true;
+    LOG_SERIAL("PAT", "IA32_PAT: 0x%llx -> 0x%llx", old, rdmsr(MSR_IA32_PAT));
+}
+
+bool pat_wc_available(void)
+{
+    return pat_programmed;
+}
@@ -0,0 +1,54 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Page Attribute Table (PAT) setup.
+// Reprograms IA32_PAT so that page-table entries can select
+// write-combining memory in addition to the legacy cache types.
+//
+
+#ifndef SHIPOS_PAT_H
+#define SHIPOS_PAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MSR_IA32_PAT 0x277
+
+// PAT memory types
+#define PAT_UC       0x00    // Uncacheable
+#define PAT_WC       0x01    // Write-combining
+#define PAT_WT       0x04    // Write-through
+#define PAT_WP       0x05    // Write-protected
+#define PAT_WB       0x06    // Write-back
+#define PAT_UC_MINUS 0x07    // Uncacheable, can be overridden by MTRR WC
+
+/**
+ * @brief PAT layout used by the kernel
+ *
+ * Entries 0-3 keep their power-on values, so PTEs without PTE_PAT behave
+ * exactly as before. Entry 4 (PAT=1, PCD=0, PWT=0) selects write-combining.
+ */
+#define PAT_KERNEL_LAYOUT                                           \
+    (((uint64_t)PAT_WB << 0) | ((uint64_t)PAT_WT << 8) |            \
+     ((uint64_t)PAT_UC_MINUS << 16) | ((uint64_t)PAT_UC << 24) |    \
+     ((uint64_t)PAT_WC << 32) | ((uint64_t)PAT_WT << 40) |          \
+     ((uint64_t)PAT_UC_MINUS << 48) | ((uint64_t)PAT_UC << 56))
+
+/**
+ * @brief Program IA32_PAT on the calling CPU
+ *
+ * Must run on every CPU before write-combining mappings are used, since
+ * the PAT must be identical on all processors.
+ * Does nothing if the CPU has no PAT support.
+ */
+void pat_init(void);
+
+/**
+ * @brief Check whether write-combining mappings are available
+ *
+ * @return true if PAT is supported and has been programmed
+ */
+bool pat_wc_available(void);
+
+#endif // SHIPOS_PAT_H
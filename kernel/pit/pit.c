@@ -0,0 +1,41 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Polled PIT channel 2 delay used for timer calibration.
+//
+
+#include "pit.h"
+#include "../lib/include/x86_64.h"
+
+#define PIT_CHANNEL2_DATA 0x42
+#define PIT_COMMAND       0x43
+#define PIT_GATE_PORT     0x61   // Bit 0: channel 2 gate, bit 1: speaker, bit 5: channel 2 output
+
+// Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count), binary
+#define PIT_CH2_ONESHOT 0xB0
+
+void pit_wait_ms(uint32_t ms)
+{
+    if (ms > PIT_MAX_WAIT_MS)
+    {
+        ms = PIT_MAX_WAIT_MS;
+    }
+    uint32_t count = PIT_FREQUENCY * ms / 1000;
+
+    // Gate on, speaker off
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+
+    // Loading the count starts the countdown; OUT goes high at zero
+    outb(PIT_COMMAND, PIT_CH2_ONESHOT);
+    outb(PIT_CHANNEL2_DATA, count & 0xFF);
+    outb(PIT_CHANNEL2_DATA, (count >> 8) & 0xFF);
+
+    while ((inb(PIT_GATE_PORT) & 0x20) == 0)
+    {
+        asm volatile("pause");
+    }
+
+    outb(PIT_GATE_PORT, gate);
+}
@@ -6,6 +6,14 @@
 #ifndef PIT_H
 #define PIT_H
 
+#include <stdint.h>
+
+// Input clock of the PIT counters in Hz
+#define PIT_FREQUENCY 1193182
+
+// Longest delay pit_wait_ms() can measure with a 16-bit count
+#define PIT_MAX_WAIT_MS 54
+
 /**
  * @brief Initialize the Programmable Interval Timer (PIT)
  * 
@@ -29,5 +37,16 @@ extern void send_values_to_sched();
  */
 extern void stop_timer();
 
+/**
+ * @brief Busy-wait using PIT channel 2
+ *
+ * Runs channel 2 in one-shot mode with the speaker gate and polls its
+ * output, so no interrupt is needed. Used as the reference clock when
+ * calibrating the LAPIC timer and the TSC.
+ *
+ * @param ms Delay in milliseconds, clamped to PIT_MAX_WAIT_MS
+ */
+void pit_wait_ms(uint32_t ms);
+
 #endif // PIT_H
 
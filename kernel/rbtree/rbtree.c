@@ -0,0 +1,321 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Intrusive red-black tree.
+//
+
+#include "rbtree.h"
+
+static bool is_red(const struct rb_node *node)
+{
+    return node != NULL && node->red;
+}
+
+/**
+ * @brief Point old's parent (or the root) at new
+ */
+static void replace_child(struct rb_root *root, struct rb_node *old, struct rb_node *new)
+{
+    struct rb_node *parent = old->parent;
+    if (parent == NULL)
+    {
+        root->node = new;
+    }
+    else if (parent->left == old)
+    {
+        parent->left = new;
+    }
+    else
+    {
+        parent->right = new;
+    }
+}
+
+static void rotate_left(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->right;
+
+    x->right = y->left;
+    if (y->left != NULL)
+    {
+        y->left->parent = x;
+    }
+    replace_child(root, x, y);
+    y->parent = x->parent;
+    y->left = x;
+    x->parent = y;
+}
+
+static void rotate_right(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->left;
+
+    x->left = y->right;
+    if (y->right != NULL)
+    {
+        y->right->parent = x;
+    }
+    replace_child(root, x, y);
+    y->parent = x->parent;
+    y->right = x;
+    x->parent = y;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *parent;
+
+    // The root is black, so a red parent always has a parent of its own
+    while ((parent = node->parent) != NULL && parent->red)
+    {
+        struct rb_node *gparent = parent->parent;
+
+        if (parent == gparent->left)
+        {
+            struct rb_node *uncle = gparent->right;
+            if (is_red(uncle))
+            {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right)
+            {
+                rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rotate_right(root, gparent);
+        }
+        else
+        {
+            struct rb_node *uncle = gparent->left;
+            if (is_red(uncle))
+            {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left)
+            {
+                rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rotate_left(root, gparent);
+        }
+    }
+    root->node->red = false;
+}
+
+/**
+ * @brief Restore the black height after removing a black node
+ *
+ * @param node Node that took the removed node's place, may be NULL
+ * @param parent Parent of that position
+ */
+static void erase_fixup(struct rb_root *root, struct rb_node *node, struct rb_node *parent)
+{
+    while (node != root->node && !is_red(node))
+    {
+        if (node == parent->left)
+        {
+            struct rb_node *sibling = parent->right;
+            if (sibling->red)
+            {
+                sibling->red = false;
+                parent->red = true;
+                rotate_left(root, parent);
+                sibling = parent->right;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right))
+            {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->right))
+            {
+                sibling->left->red = false;
+                sibling->red = true;
+                rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rotate_left(root, parent);
+            node = root->node;
+        }
+        else
+        {
+            struct rb_node *sibling = parent->left;
+            if (sibling->red)
+            {
+                sibling->red = false;
+                parent->red = true;
+                rotate_right(root, parent);
+                sibling = parent->left;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right))
+            {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->left))
+            {
+                sibling->right->red = false;
+                sibling->red = true;
+                rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rotate_right(root, parent);
+            node = root->node;
+        }
+    }
+    if (node != NULL)
+    {
+        node->red = false;
+    }
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *child;
+    struct rb_node *parent;
+    bool removed_red;
+
+    if (node->left != NULL && node->right != NULL)
+    {
+        // Two children: the in-order successor takes the node's place and
+        // the successor's old position is the one that loses a node
+        struct rb_node *next = node->right;
+        while (next->left != NULL)
+        {
+            next = next->left;
+        }
+
+        child = next->right;
+        parent = next->parent;
+        removed_red = next->red;
+
+        if (parent == node)
+        {
+            parent = next;
+        }
+        else
+        {
+            parent->left = child;
+            if (child != NULL)
+            {
+                child->parent = parent;
+            }
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        replace_child(root, node, next);
+        next->parent = node->parent;
+        next->left = node->left;
+        node->left->parent = next;
+        next->red = node->red;
+    }
+    else
+    {
+        child = node->left != NULL ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+
+        if (child != NULL)
+        {
+            child->parent = parent;
+        }
+        replace_child(root, node, child);
+    }
+
+    if (!removed_red)
+    {
+        erase_fixup(root, child, parent);
+    }
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    while (node->left != NULL)
+    {
+        node = node->left;
+    }
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    while (node->right != NULL)
+    {
+        node = node->right;
+    }
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+    if (node->right != NULL)
+    {
+        node = node->right;
+        while (node->left != NULL)
+        {
+            node = node->left;
+        }
+        return (struct rb_node *) node;
+    }
+
+    while (node->parent != NULL && node == node->parent->right)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+    if (node->left != NULL)
+    {
+        node = node->left;
+        while (node->right != NULL)
+        {
+            node = node->right;
+        }
+        return (struct rb_node *) node;
+    }
+
+    while (node->parent != NULL && node == node->parent->left)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
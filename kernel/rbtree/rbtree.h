@@ -0,0 +1,86 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Intrusive red-black tree. Nodes are embedded in the owning structure
+// and the caller does the ordered descent, so no comparison callbacks or
+// allocation are involved.
+//
+
+#ifndef SHIPOS_RBTREE_H
+#define SHIPOS_RBTREE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct rb_node
+{
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    bool red;
+};
+
+struct rb_root
+{
+    struct rb_node *node;
+};
+
+/**
+ * @brief Get the structure that embeds a tree node
+ * @param ptr Pointer to the struct rb_node member
+ * @param type Type of the containing structure
+ * @param member Name of the struct rb_node member inside type
+ */
+#define rb_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * @brief Attach a node at the leaf position found by the caller's descent
+ *
+ * Must be followed by rb_insert_color().
+ *
+ * @param node Node to attach
+ * @param parent Last node visited by the descent, NULL for an empty tree
+ * @param link Child pointer of parent (or root->node) to store node in
+ */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link)
+{
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->red = true;
+    *link = node;
+}
+
+/**
+ * @brief Rebalance the tree after rb_link_node()
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+
+/**
+ * @brief Remove a node from the tree
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+/**
+ * @brief Smallest node of the tree, or NULL if it is empty
+ */
+struct rb_node *rb_first(const struct rb_root *root);
+
+/**
+ * @brief Largest node of the tree, or NULL if it is empty
+ */
+struct rb_node *rb_last(const struct rb_root *root);
+
+/**
+ * @brief In-order successor of a node, or NULL for the last one
+ */
+struct rb_node *rb_next(const struct rb_node *node);
+
+/**
+ * @brief In-order predecessor of a node, or NULL for the first one
+ */
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif // SHIPOS_RBTREE_H
@@ -0,0 +1,128 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Fixed-size CPU bitmaps, one bit per CPU index.
+//
+
+#ifndef SHIPOS_CPUMASK_H
+#define SHIPOS_CPUMASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum number of CPUs supported
+#define MAX_CPUS 64
+
+#define CPUMASK_WORDS ((MAX_CPUS + 63) / 64)
+
+struct cpumask
+{
+    uint64_t bits[CPUMASK_WORDS];
+};
+
+static inline void cpumask_clear(struct cpumask *mask)
+{
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+    {
+        mask->bits[i] = 0;
+    }
+}
+
+/**
+ * @brief Set the bits of every possible CPU
+ */
+static inline void cpumask_setall(struct cpumask *mask)
+{
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+    {
+        mask->bits[i] = ~0ull;
+    }
+}
+
+static inline void cpumask_set_cpu(struct cpumask *mask, uint32_t cpu)
+{
+    mask->bits[cpu / 64] |= 1ull << (cpu % 64);
+}
+
+static inline void cpumask_clear_cpu(struct cpumask *mask, uint32_t cpu)
+{
+    mask->bits[cpu / 64] &= ~(1ull << (cpu % 64));
+}
+
+static inline bool cpumask_test_cpu(const struct cpumask *mask, uint32_t cpu)
+{
+    return cpu < MAX_CPUS && (mask->bits[cpu / 64] & (1ull << (cpu % 64))) != 0;
+}
+
+static inline bool cpumask_equal(const struct cpumask *a, const struct cpumask *b)
+{
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+    {
+        if (a->bits[i] != b->bits[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief dst = a & b
+ */
+static inline void cpumask_and(struct cpumask *dst, const struct cpumask *a, const struct cpumask *b)
+{
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+    {
+        dst->bits[i] = a->bits[i] & b->bits[i];
+    }
+}
+
+/**
+ * @brief Whether every CPU in a is also in b
+ */
+static inline bool cpumask_subset(const struct cpumask *a, const struct cpumask *b)
+{
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+    {
+        if ((a->bits[i] & ~b->bits[i]) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Lowest CPU index set in mask below limit, or limit if none is
+ */
+static inline uint32_t cpumask_first(const struct cpumask *mask, uint32_t limit)
+{
+    for (uint32_t cpu = 0; cpu < limit && cpu < MAX_CPUS; cpu++)
+    {
+        if (cpumask_test_cpu(mask, cpu))
+        {
+            return cpu;
+        }
+    }
+    return limit;
+}
+
+/**
+ * @brief Number of CPUs set in mask
+ */
+static inline uint32_t cpumask_weight(const struct cpumask *mask)
+{
+    uint32_t weight = 0;
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+    {
+        // No popcnt without libgcc; clear the lowest set bit per step
+        for (uint64_t word = mask->bits[i]; word != 0; word &= word - 1)
+        {
+            weight++;
+        }
+    }
+    return weight;
+}
+
+#endif // SHIPOS_CPUMASK_H
@@ -0,0 +1,285 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Fiber executors. Each started CPU runs one pinned executor thread that
+// pops fibers off its ready list and switches into them; a fiber switches
+// back when it yields, waits or returns. An executor with nothing ready
+// blocks its thread until a fiber is queued.
+//
+
+#include "fiber.h"
+#include "percpu.h"
+#include "smp_sched.h"
+#include "../kalloc/kalloc.h"
+#include "../lib/include/logging.h"
+#include "../lib/include/panic.h"
+
+struct fiber_executor fiber_executors[MAX_CPUS];
+
+// Value of fiber->waiter once the fiber has finished
+#define FIBER_FINISHED ((struct fiber *) 1)
+
+struct fiber *fiber_current(void)
+{
+    pushcli();
+    struct percpu *cpu = mycpu();
+    struct fiber_executor *ex = &fiber_executors[cpu->cpu_index];
+    // ex->current stays set while a preempted executor waits for the CPU
+    struct fiber *fiber = (ex->thread != 0 && cpu->current_thread == ex->thread) ? ex->current : 0;
+    popcli();
+    return fiber;
+}
+
+/**
+ * @brief Queue a fiber on its executor and wake the executor if it sleeps
+ */
+static void fiber_make_ready(struct fiber *fiber)
+{
+    struct fiber_executor *ex = fiber->executor;
+
+    acquire_spinlock(&ex->lock);
+    fiber->state = FIBER_READY;
+    lst_push_back(&ex->ready, &fiber->link);
+    release_spinlock(&ex->lock);
+
+    // A no-op unless the executor thread is blocked
+    sched_wakeup(ex->thread);
+}
+
+/**
+ * @brief Drop a reference; the last one returns the fiber to its pool
+ */
+static void fiber_put(struct fiber *fiber)
+{
+    if (__sync_sub_and_fetch(&fiber->refs, 1) != 0)
+    {
+        return;
+    }
+
+    struct fiber_executor *ex = fiber->executor;
+    bool pooled = false;
+
+    acquire_spinlock(&ex->lock);
+    if (ex->nr_pooled < FIBER_POOL_MAX)
+    {
+        lst_push(&ex->pool, &fiber->link);
+        ex->nr_pooled++;
+        pooled = true;
+    }
+    release_spinlock(&ex->lock);
+
+    if (!pooled)
+    {
+        kfree(fiber);
+    }
+}
+
+/**
+ * @brief First code a fiber runs, entered by fiber_switch()'s ret
+ */
+static void fiber_entry(void)
+{
+    struct fiber *self = fiber_current();
+
+    self->function(self->arg);
+
+    self->state = FIBER_DONE;
+    fiber_switch(&self->context, self->executor->context);
+    panic("fiber_entry: finished fiber resumed");
+}
+
+static bool executor_has_work(void *arg)
+{
+    struct fiber_executor *ex = arg;
+    return !lst_empty(&ex->ready);
+}
+
+static void executor_thread(void *arg)
+{
+    struct fiber_executor *ex = arg;
+
+    while (1)
+    {
+        struct fiber *fiber = 0;
+        acquire_spinlock(&ex->lock);
+        if (!lst_empty(&ex->ready))
+        {
+            fiber = lst_entry(lst_pop(&ex->ready), struct fiber, link);
+        }
+        release_spinlock(&ex->lock);
+
+        if (fiber == 0)
+        {
+            sched_block_unless(executor_has_work, ex);
+            continue;
+        }
+
+        fiber->state = FIBER_RUNNING;
+        ex->current = fiber;
+        ex->switches++;
+        fiber_switch(&ex->context, fiber->context);
+        ex->current = 0;
+
+        // Back on the executor's stack, so the fiber's may be reused
+        if (fiber->state == FIBER_YIELDED)
+        {
+            acquire_spinlock(&ex->lock);
+            fiber->state = FIBER_READY;
+            lst_push_back(&ex->ready, &fiber->link);
+            release_spinlock(&ex->lock);
+        }
+        else if (fiber->state == FIBER_DONE)
+        {
+            struct fiber *waiter = __sync_lock_test_and_set(&fiber->waiter, FIBER_FINISHED);
+            if (waiter != 0)
+            {
+                fiber_make_ready(waiter);
+            }
+            fiber_put(fiber);
+        }
+        // A WAITING fiber is queued again by whoever it waits for, possibly
+        // already (then it is READY)
+    }
+}
+
+void fiber_init(void)
+{
+    uint32_t started = 0;
+
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct fiber_executor *ex = &fiber_executors[i];
+        if (!percpus[i].started || !percpus[i].scheduler_ready || ex->thread != 0)
+            continue;
+
+        init_spinlock(&ex->lock, "fiber");
+        lst_init(&ex->ready);
+        lst_init(&ex->pool);
+        ex->cpu = i;
+
+        struct thread *thread = create_thread(executor_thread, 0, 0);
+        if (thread == 0)
+        {
+            LOG_SERIAL("FIBER", "No memory for the executor of CPU %d", i);
+            continue;
+        }
+        thread->context->rdi = (uint64_t) ex;
+        cpumask_clear(&thread->cpus_allowed);
+        cpumask_set_cpu(&thread->cpus_allowed, i);
+        ex->thread = thread;
+        sched_add_thread(thread, i);
+        started++;
+    }
+
+    LOG_SERIAL("FIBER", "Started %d fiber executors", started);
+}
+
+struct fiber *fiber_spawn_on(uint32_t cpu, void (*function)(void *), void *arg)
+{
+    if (cpu >= ncpu || fiber_executors[cpu].thread == 0)
+    {
+        return 0;
+    }
+
+    struct fiber_executor *ex = &fiber_executors[cpu];
+    struct fiber *fiber = 0;
+
+    acquire_spinlock(&ex->lock);
+    if (!lst_empty(&ex->pool))
+    {
+        fiber = lst_entry(lst_pop(&ex->pool), struct fiber, link);
+        ex->nr_pooled--;
+        ex->reused++;
+    }
+    ex->spawned++;
+    release_spinlock(&ex->lock);
+
+    if (fiber == 0)
+    {
+        fiber = kalloc();
+        if (fiber == 0)
+        {
+            return 0;
+        }
+    }
+
+    // The stack grows down from the end of the fiber's page. The frame is
+    // placed so fiber_entry() starts with the stack aligned as after a call.
+    uint64_t top = (uint64_t) fiber + PGSIZE - sizeof(uint64_t);
+    *(uint64_t *) top = 0;
+    struct fiber_frame *frame = (struct fiber_frame *) (top - sizeof(struct fiber_frame));
+    memset(frame, 0, sizeof(*frame));
+    frame->rip = (uint64_t) fiber_entry;
+
+    fiber->context = frame;
+    fiber->function = function;
+    fiber->arg = arg;
+    fiber->executor = ex;
+    fiber->waiter = 0;
+    fiber->refs = 2;
+
+    fiber_make_ready(fiber);
+    return fiber;
+}
+
+struct fiber *fiber_spawn(void (*function)(void *), void *arg)
+{
+    struct fiber *self = fiber_current();
+    if (self != 0)
+    {
+        return fiber_spawn_on(self->executor->cpu, function, arg);
+    }
+
+    pushcli();
+    uint32_t cpu = mycpu()->cpu_index;
+    popcli();
+    return fiber_spawn_on(cpu, function, arg);
+}
+
+void fiber_yield(void)
+{
+    struct fiber *self = fiber_current();
+    if (self == 0)
+    {
+        sched_yield();
+        return;
+    }
+
+    self->state = FIBER_YIELDED;
+    fiber_switch(&self->context, self->executor->context);
+}
+
+void fiber_await(struct fiber *fiber)
+{
+    struct fiber *self = fiber_current();
+
+    if (self == 0)
+    {
+        while (fiber->waiter != FIBER_FINISHED)
+        {
+            sched_yield();
+        }
+    }
+    else
+    {
+        // WAITING before publishing: the finishing executor may queue this
+        // fiber again right away, even before it has switched out
+        self->state = FIBER_WAITING;
+        if (__sync_bool_compare_and_swap(&fiber->waiter, 0, self))
+        {
+            fiber_switch(&self->context, self->executor->context);
+        }
+        else
+        {
+            self->state = FIBER_RUNNING;
+        }
+    }
+
+    fiber_put(fiber);
+}
+
+void fiber_detach(struct fiber *fiber)
+{
+    fiber_put(fiber);
+}
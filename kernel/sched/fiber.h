@@ -0,0 +1,137 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Kernel fibers: stackful coroutines multiplexed on one executor thread
+// per CPU. Fibers switch cooperatively with fiber_switch(), which only
+// swaps the callee-saved registers, so yielding to another fiber never
+// enters the scheduler. The executor thread itself is an ordinary thread
+// and is preempted and balanced like any other.
+//
+
+#ifndef SHIPOS_FIBER_H
+#define SHIPOS_FIBER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+#include "cpumask.h"
+#include "../list/list.h"
+#include "../sync/spinlock.h"
+
+// Recycled fibers each executor keeps; the rest are freed
+#define FIBER_POOL_MAX 32
+
+/**
+ * @brief Registers saved by fiber_switch(), lowest address first
+ */
+struct fiber_frame
+{
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rbx;
+    uint64_t rbp;
+    uint64_t rip;
+};
+
+enum fiber_state
+{
+    FIBER_READY = 0, // On its executor's ready list
+    FIBER_RUNNING,   // Running on its executor
+    FIBER_YIELDED,   // Switched out by fiber_yield(), requeued by the executor
+    FIBER_WAITING,   // Blocked in fiber_await()
+    FIBER_DONE       // Returned from its function
+};
+
+struct fiber_executor;
+
+/**
+ * @brief A fiber; it lives at the bottom of its own one-page stack
+ */
+struct fiber
+{
+    struct fiber_frame *context;      // Saved stack pointer while switched out
+    void (*function)(void *);
+    void *arg;
+    volatile enum fiber_state state;
+    struct fiber_executor *executor;  // Executor the fiber runs on
+    struct list link;                 // Ready list or pool link
+    struct fiber *volatile waiter;    // Fiber in fiber_await() on this one, see fiber.c
+    volatile int refs;                // Running fiber plus the spawner's handle
+};
+
+/**
+ * @brief Per-CPU executor: one thread that runs that CPU's fibers
+ */
+struct fiber_executor
+{
+    struct spinlock lock;             // Protects ready and the pool
+    struct list ready;                // Fibers waiting to run, FIFO
+    struct list pool;                 // Finished fibers kept for reuse
+    uint32_t nr_pooled;
+    struct thread *thread;            // Executor thread, pinned to cpu
+    struct fiber_frame *context;      // Executor loop while a fiber runs
+    struct fiber *current;            // Running fiber, NULL in the loop
+    uint32_t cpu;
+    uint64_t switches;                // Fibers switched in
+    uint64_t spawned;                 // Fibers started
+    uint64_t reused;                  // Of those, taken from the pool
+};
+
+extern struct fiber_executor fiber_executors[MAX_CPUS];
+
+extern void fiber_switch(struct fiber_frame **old, struct fiber_frame *new);
+
+/**
+ * @brief Start an executor thread on every CPU whose scheduler runs
+ *
+ * CPUs that already have one are skipped, so the BSP calls this once the
+ * APs are scheduling and again when it enters its own scheduler loop.
+ * fiber_spawn() fails on a CPU without an executor.
+ */
+void fiber_init(void);
+
+/**
+ * @brief Start a fiber running function(arg)
+ *
+ * From a fiber it runs on the same executor, otherwise on the executor of
+ * the calling CPU. The returned handle must be given up with exactly one
+ * fiber_await() or fiber_detach().
+ *
+ * @return Handle to the fiber, or NULL if out of memory or before fiber_init()
+ */
+struct fiber *fiber_spawn(void (*function)(void *), void *arg);
+
+/**
+ * @brief Like fiber_spawn(), but on the executor of a given CPU
+ */
+struct fiber *fiber_spawn_on(uint32_t cpu, void (*function)(void *), void *arg);
+
+/**
+ * @brief Let the other ready fibers of this executor run
+ *
+ * Outside a fiber this is sched_yield().
+ */
+void fiber_yield(void);
+
+/**
+ * @brief Wait until a fiber has finished and give up its handle
+ *
+ * A fiber waits without holding up its executor; a thread yields the CPU
+ * until the fiber is done.
+ */
+void fiber_await(struct fiber *fiber);
+
+/**
+ * @brief Give up the handle of a fiber without waiting for it
+ */
+void fiber_detach(struct fiber *fiber);
+
+/**
+ * @brief The running fiber, or NULL outside a fiber
+ */
+struct fiber *fiber_current(void);
+
+#endif // SHIPOS_FIBER_H
@@ -0,0 +1,200 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Lazy FPU/SIMD state: #NM loads a thread's registers on first use in a
+// time slice, the scheduler saves them when the thread leaves the CPU.
+//
+
+#include "fpu.h"
+#include "percpu.h"
+#include "../kalloc/kalloc.h"
+#include "../lib/include/memset.h"
+#include "../lib/include/panic.h"
+#include "../lib/include/logging.h"
+#include "../lib/include/x86_64.h"
+
+#define CR0_MP (1ull << 1)
+#define CR0_EM (1ull << 2)
+#define CR0_TS (1ull << 3)
+#define CR0_NE (1ull << 5)
+
+#define CR4_OSFXSR     (1ull << 9)
+#define CR4_OSXMMEXCPT (1ull << 10)
+#define CR4_OSXSAVE    (1ull << 18)
+
+// Legacy region fields used to build the initial state
+#define FPU_FCW_OFFSET   0
+#define FPU_MXCSR_OFFSET 24
+#define FPU_FCW_INIT     0x037f
+#define FPU_MXCSR_INIT   0x1f80
+
+enum fpu_save_insn
+{
+    FPU_FXSAVE = 0,
+    FPU_XSAVE,
+    FPU_XSAVEOPT
+};
+
+static enum fpu_save_insn fpu_insn = FPU_FXSAVE;
+static uint64_t fpu_xcr0;       // Components saved and restored
+static uint32_t fpu_state_size; // Bytes of the save area in use
+
+static inline void xsetbv(uint32_t reg, uint64_t value)
+{
+    asm volatile("xsetbv" : : "c"(reg), "a"((uint32_t) value), "d"((uint32_t) (value >> 32)));
+}
+
+static inline void set_ts(void)
+{
+    wcr0(rcr0() | CR0_TS);
+}
+
+static void fpu_save(void *area)
+{
+    uint32_t lo = (uint32_t) fpu_xcr0;
+    uint32_t hi = (uint32_t) (fpu_xcr0 >> 32);
+
+    switch (fpu_insn)
+    {
+    case FPU_XSAVEOPT:
+        // Skips components unchanged since the xrstor in fpu_trap()
+        asm volatile("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_XSAVE:
+        asm volatile("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    default:
+        asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+        break;
+    }
+}
+
+static void fpu_restore(void *area)
+{
+    uint32_t lo = (uint32_t) fpu_xcr0;
+    uint32_t hi = (uint32_t) (fpu_xcr0 >> 32);
+
+    if (fpu_insn == FPU_FXSAVE)
+    {
+        asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+    else
+    {
+        asm volatile("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    }
+}
+
+void fpu_init_cpu(void)
+{
+    uint32_t regs[4];
+
+    cpuid(1, 0, regs);
+    bool has_xsave = (regs[2] >> 26) & 1;
+
+    // FPU present and reporting errors natively, instructions trap while TS
+    wcr0((rcr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+
+    uint64_t cr4 = rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (has_xsave)
+    {
+        cr4 |= CR4_OSXSAVE;
+    }
+    wcr4(cr4);
+
+    if (!has_xsave)
+    {
+        fpu_insn = FPU_FXSAVE;
+        fpu_xcr0 = XFEATURE_X87 | XFEATURE_SSE;
+        fpu_state_size = 512;
+        return;
+    }
+
+    cpuid(0xd, 0, regs);
+    uint64_t supported = regs[0] | ((uint64_t) regs[3] << 32);
+    uint64_t xcr0 = supported & (XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX | XFEATURE_AVX512);
+    if ((xcr0 & XFEATURE_AVX512) != XFEATURE_AVX512)
+    {
+        // The AVX-512 components can only be enabled together
+        xcr0 &= ~XFEATURE_AVX512;
+    }
+    xsetbv(0, xcr0);
+
+    // EBX now holds the area size for the components just enabled
+    cpuid(0xd, 0, regs);
+    if (regs[1] > PGSIZE)
+    {
+        xcr0 &= ~XFEATURE_AVX512;
+        xsetbv(0, xcr0);
+        cpuid(0xd, 0, regs);
+    }
+
+    fpu_xcr0 = xcr0;
+    fpu_state_size = regs[1];
+
+    cpuid(0xd, 1, regs);
+    fpu_insn = (regs[0] & 1) ? FPU_XSAVEOPT : FPU_XSAVE;
+}
+
+void fpu_trap(void)
+{
+    struct percpu *cpu = mycpu();
+    struct thread *thread = cpu->current_thread;
+
+    asm volatile("clts");
+
+    if (thread == 0 || thread == cpu->idle_thread)
+    {
+        panic("fpu_trap: FPU used outside a thread");
+    }
+    if (cpu->fpu_owner == thread)
+    {
+        return;
+    }
+
+    if (thread->fpu_state == 0)
+    {
+        // One page holds every enabled component and is 64-byte aligned
+        thread->fpu_state = kalloc();
+        if (thread->fpu_state == 0)
+        {
+            panic("fpu_trap: out of memory for FPU state");
+        }
+    }
+
+    if (!thread->fpu_used)
+    {
+        // XSTATE_BV of 0 loads every component's initial state; only the
+        // control words are taken from the area
+        memset(thread->fpu_state, 0, PGSIZE);
+        *(uint16_t *) ((uint8_t *) thread->fpu_state + FPU_FCW_OFFSET) = FPU_FCW_INIT;
+        *(uint32_t *) ((uint8_t *) thread->fpu_state + FPU_MXCSR_OFFSET) = FPU_MXCSR_INIT;
+        thread->fpu_used = true;
+    }
+
+    fpu_restore(thread->fpu_state);
+    cpu->fpu_owner = thread;
+    cpu->fpu_traps++;
+}
+
+void fpu_switch_out(struct percpu *cpu, struct thread *thread)
+{
+    if (cpu->fpu_owner != thread)
+    {
+        return;
+    }
+
+    fpu_save(thread->fpu_state);
+    cpu->fpu_owner = 0;
+    cpu->fpu_saves++;
+
+    // The next thread traps on its first FPU instruction
+    set_ts();
+}
+
+void fpu_log(void)
+{
+    static const char *const insn_names[] = {"fxsave", "xsave", "xsaveopt"};
+    LOG_SERIAL("FPU", "Lazy FPU switching with %s, XCR0 0x%llx, %d byte state",
+               insn_names[fpu_insn], fpu_xcr0, fpu_state_size);
+}
@@ -0,0 +1,59 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Lazy FPU/SIMD state management. Every thread starts with CR0.TS set, so
+// its first x87/SSE/AVX instruction raises #NM; the handler gives the
+// thread an XSAVE area and loads its registers. When the thread is switched
+// out its registers are saved and TS set again. Threads that never touch
+// the FPU pay nothing beyond the TS bit.
+//
+// The kernel is built with -mgeneral-regs-only; only *_simd.c files are
+// compiled with SIMD enabled, and their code may only run in threads,
+// never in interrupt handlers or the scheduler loop.
+//
+
+#ifndef SHIPOS_FPU_H
+#define SHIPOS_FPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+
+struct percpu;
+
+// State components enabled in XCR0 when the CPU has them
+#define XFEATURE_X87      (1ull << 0)
+#define XFEATURE_SSE      (1ull << 1)
+#define XFEATURE_AVX      (1ull << 2)
+#define XFEATURE_AVX512   (7ull << 5)
+
+/**
+ * @brief Enable the FPU, SSE and XSAVE on this CPU and set CR0.TS
+ *
+ * Called by every CPU before its scheduler starts. The BSP's call also
+ * picks the save instruction and the enabled components; every CPU is
+ * assumed to support the same ones.
+ */
+void fpu_init_cpu(void);
+
+/**
+ * @brief Handle #NM: load the current thread's FPU state
+ *
+ * Called from trap() for vector 7. The first use initializes the state.
+ */
+void fpu_trap(void);
+
+/**
+ * @brief Save a switched-out thread's FPU state if it is live on this CPU
+ *
+ * Called by the scheduler loop after every switch back from a thread.
+ */
+void fpu_switch_out(struct percpu *cpu, struct thread *thread);
+
+/**
+ * @brief Log the save instruction and the enabled state components
+ */
+void fpu_log(void);
+
+#endif // SHIPOS_FPU_H
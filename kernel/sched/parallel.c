@@ -0,0 +1,374 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Work-stealing runtime behind parallel_for(). A participant runs a range
+// by halving it until it fits the grain, pushing every upper half on its
+// own deque, then runs what is left and pops the next range, newest
+// first. Participants without a range of their own steal the oldest,
+// largest one from another deque.
+//
+
+#include "parallel.h"
+#include "percpu.h"
+#include "smp_sched.h"
+#include "../lib/include/logging.h"
+
+struct parallel_worker parallel_workers[MAX_CPUS];
+
+/**
+ * @brief One parallel_for() call, on the caller's stack
+ */
+struct parallel_job
+{
+    void (*fn)(uint64_t lo, uint64_t hi, void *arg);
+    void *arg;
+    uint64_t grain;
+    volatile uint64_t remaining; // Indices not yet run
+};
+
+// Deques of callers that are not workers, claimed for one call each
+static struct parallel_deque parallel_callers[PARALLEL_MAX_CALLERS];
+static volatile bool parallel_caller_busy[PARALLEL_MAX_CALLERS];
+
+static uint32_t parallel_nr_workers;
+
+#define PARALLEL_DEQUE_MASK (PARALLEL_DEQUE_SIZE - 1)
+
+// Keeps the compiler from moving memory accesses across it
+#define barrier() asm volatile("" : : : "memory")
+
+/**
+ * @brief Push a range at the bottom, owner only
+ *
+ * @return false if the deque is full
+ */
+static bool deque_push(struct parallel_deque *deque, struct parallel_range range)
+{
+    int64_t bottom = deque->bottom;
+    if (bottom - deque->top >= PARALLEL_DEQUE_SIZE)
+    {
+        return false;
+    }
+
+    deque->ranges[bottom & PARALLEL_DEQUE_MASK] = range;
+    // Stores are not reordered on x86; a thief that sees the new bottom
+    // sees the entry
+    barrier();
+    deque->bottom = bottom + 1;
+    return true;
+}
+
+/**
+ * @brief Pop the newest range, owner only
+ */
+static bool deque_pop(struct parallel_deque *deque, struct parallel_range *range)
+{
+    int64_t bottom = deque->bottom - 1;
+    deque->bottom = bottom;
+    // The claim on the bottom entry must be visible before top is read,
+    // or a thief and the owner could both take the last entry
+    __sync_synchronize();
+    int64_t top = deque->top;
+
+    if (top > bottom)
+    {
+        deque->bottom = bottom + 1;
+        return false;
+    }
+
+    *range = deque->ranges[bottom & PARALLEL_DEQUE_MASK];
+    if (top < bottom)
+    {
+        return true;
+    }
+
+    // Last entry: race the thieves for it
+    bool won = __sync_bool_compare_and_swap(&deque->top, top, top + 1);
+    deque->bottom = bottom + 1;
+    return won;
+}
+
+/**
+ * @brief Take the oldest range, any thread
+ *
+ * The entry is copied before the CAS on top; if the owner reused its slot
+ * meanwhile, top has moved on and the torn copy is dropped.
+ */
+static bool deque_steal(struct parallel_deque *deque, struct parallel_range *range)
+{
+    int64_t top = deque->top;
+    int64_t bottom = deque->bottom;
+    barrier();
+
+    if (top >= bottom)
+    {
+        return false;
+    }
+
+    *range = deque->ranges[top & PARALLEL_DEQUE_MASK];
+    return __sync_bool_compare_and_swap(&deque->top, top, top + 1);
+}
+
+static bool deque_empty(struct parallel_deque *deque)
+{
+    return deque->top >= deque->bottom;
+}
+
+/**
+ * @brief Deque number i: the workers' first, then the callers'
+ *
+ * @return The deque, or NULL if nobody owns it
+ */
+static struct parallel_deque *deque_at(uint32_t i)
+{
+    if (i < MAX_CPUS)
+    {
+        return parallel_workers[i].thread != 0 ? &parallel_workers[i].deque : 0;
+    }
+    i -= MAX_CPUS;
+    return parallel_caller_busy[i] ? &parallel_callers[i] : 0;
+}
+
+/**
+ * @brief Steal a range from any deque but self, starting after start
+ */
+static bool parallel_steal(struct parallel_deque *self, uint32_t start, struct parallel_range *range)
+{
+    uint32_t total = MAX_CPUS + PARALLEL_MAX_CALLERS;
+
+    for (uint32_t k = 1; k <= total; k++)
+    {
+        struct parallel_deque *deque = deque_at((start + k) % total);
+        if (deque != 0 && deque != self && deque_steal(deque, range))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parallel_has_work(void *arg)
+{
+    (void) arg;
+    for (uint32_t i = 0; i < MAX_CPUS + PARALLEL_MAX_CALLERS; i++)
+    {
+        struct parallel_deque *deque = deque_at(i);
+        if (deque != 0 && !deque_empty(deque))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Wake one sleeping worker for a range just pushed
+ */
+static void parallel_wake_one(void)
+{
+    // Pairs with the barrier between setting sleeping and checking the
+    // deques in parallel_worker_thread()
+    __sync_synchronize();
+
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct parallel_worker *worker = &parallel_workers[i];
+        if (worker->sleeping && __sync_bool_compare_and_swap(&worker->sleeping, true, false))
+        {
+            sched_wakeup(worker->thread);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Split a range down to the grain, then run what is left
+ */
+static void run_range(struct parallel_deque *self, struct parallel_range range)
+{
+    struct parallel_job *job = range.job;
+
+    while (range.hi - range.lo > job->grain)
+    {
+        uint64_t mid = range.lo + (range.hi - range.lo) / 2;
+        struct parallel_range upper = {job, mid, range.hi};
+        if (!deque_push(self, upper))
+        {
+            break;
+        }
+        parallel_wake_one();
+        range.hi = mid;
+    }
+
+    job->fn(range.lo, range.hi, job->arg);
+    __sync_sub_and_fetch(&job->remaining, range.hi - range.lo);
+}
+
+static void parallel_worker_thread(void *arg)
+{
+    struct parallel_worker *worker = arg;
+    struct parallel_range range;
+
+    while (1)
+    {
+        if (deque_pop(&worker->deque, &range))
+        {
+            worker->ranges++;
+            run_range(&worker->deque, range);
+            continue;
+        }
+        if (parallel_steal(&worker->deque, worker->cpu, &range))
+        {
+            worker->ranges++;
+            worker->steals++;
+            run_range(&worker->deque, range);
+            continue;
+        }
+
+        worker->sleeping = true;
+        __sync_synchronize();
+        sched_block_unless(parallel_has_work, 0);
+        worker->sleeping = false;
+    }
+}
+
+void parallel_init(void)
+{
+    uint32_t started = 0;
+
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct parallel_worker *worker = &parallel_workers[i];
+        if (!percpus[i].started || !percpus[i].scheduler_ready || worker->thread != 0)
+            continue;
+
+        worker->cpu = i;
+        worker->sleeping = false;
+
+        struct thread *thread = create_thread(parallel_worker_thread, 0, 0);
+        if (thread == 0)
+        {
+            LOG_SERIAL("PARALLEL", "No memory for the worker of CPU %d", i);
+            continue;
+        }
+        thread->context->rdi = (uint64_t) worker;
+        cpumask_clear(&thread->cpus_allowed);
+        cpumask_set_cpu(&thread->cpus_allowed, i);
+        sched_add_thread(thread, i);
+        // Published last: thieves and has_work scan deques with a thread
+        worker->thread = thread;
+        __sync_add_and_fetch(&parallel_nr_workers, 1);
+        started++;
+    }
+
+    LOG_SERIAL("PARALLEL", "Started %d parallel workers", started);
+}
+
+/**
+ * @brief Claim a deque for the calling thread
+ *
+ * @return The deque and its steal start index, or NULL if all are taken
+ */
+static struct parallel_deque *parallel_enter(uint32_t *start, int *caller)
+{
+    pushcli();
+    struct percpu *cpu = mycpu();
+    struct parallel_worker *worker = &parallel_workers[cpu->cpu_index];
+    bool is_worker = worker->thread != 0 && cpu->current_thread == worker->thread;
+    *start = cpu->cpu_index;
+    popcli();
+
+    // Workers are pinned, so a nested call keeps using this CPU's deque
+    if (is_worker)
+    {
+        *caller = -1;
+        return &worker->deque;
+    }
+
+    // A released deque is empty; its indices just carry on from there
+    for (int i = 0; i < PARALLEL_MAX_CALLERS; i++)
+    {
+        if (!parallel_caller_busy[i] && __sync_bool_compare_and_swap(&parallel_caller_busy[i], false, true))
+        {
+            *caller = i;
+            return &parallel_callers[i];
+        }
+    }
+    return 0;
+}
+
+void parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+                  void (*fn)(uint64_t lo, uint64_t hi, void *arg), void *arg)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    uint64_t length = end - begin;
+    if (grain == 0)
+    {
+        grain = length / (16 * (parallel_nr_workers + 1));
+    }
+    if (grain == 0)
+    {
+        grain = 1;
+    }
+
+    uint32_t start;
+    int caller;
+    struct parallel_deque *self = parallel_nr_workers != 0 ? parallel_enter(&start, &caller) : 0;
+    if (self == 0)
+    {
+        // No workers yet, or every caller deque is taken
+        fn(begin, end, arg);
+        return;
+    }
+
+    struct parallel_job job = {fn, arg, grain, length};
+    struct parallel_range range = {&job, begin, end};
+    run_range(self, range);
+
+    // Help until every range of this job has finished. Ranges of other
+    // jobs found on the way are run as well and split onto self; their
+    // callers wait for them, so self is drained before the loop ends.
+    // Only the owner pushes, so a failed pop leaves the deque empty
+    while (1)
+    {
+        if (deque_pop(self, &range))
+        {
+            run_range(self, range);
+        }
+        else if (job.remaining == 0)
+        {
+            break;
+        }
+        else if (parallel_steal(self, start, &range))
+        {
+            run_range(self, range);
+        }
+        else
+        {
+            asm volatile("pause");
+        }
+    }
+
+    if (caller >= 0)
+    {
+        parallel_caller_busy[caller] = false;
+    }
+}
+
+void parallel_log_stats(void)
+{
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct parallel_worker *worker = &parallel_workers[i];
+        if (worker->thread == 0)
+            continue;
+
+        LOG_SERIAL("PARALLEL", "CPU %d: %llu ranges run, %llu stolen",
+                   i, worker->ranges, worker->steals);
+    }
+}
@@ -0,0 +1,92 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Fork-join parallel loops. parallel_for() splits an index range in
+// halves down to a grain size; the halves not run right away go on the
+// caller's work-stealing deque, from which the per-CPU parallel workers
+// and other callers steal them. Workers sleep while every deque is empty,
+// so the loop spreads over whichever CPUs have time for it.
+//
+// The deques follow Chase and Lev: the owner pushes and pops at the
+// bottom without locks, thieves take from the top with one CAS.
+//
+
+#ifndef SHIPOS_PARALLEL_H
+#define SHIPOS_PARALLEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+
+// Entries per deque, a power of two. Binary splitting keeps at most about
+// log2 of a range's length queued; a full deque runs ranges unsplit.
+#define PARALLEL_DEQUE_SIZE 64
+
+// Callers outside the workers that can run parallel_for() at once; more
+// run their loops serially
+#define PARALLEL_MAX_CALLERS 8
+
+struct parallel_job;
+
+/**
+ * @brief Indices [lo, hi) of one parallel_for() call
+ */
+struct parallel_range
+{
+    struct parallel_job *job;
+    uint64_t lo;
+    uint64_t hi;
+};
+
+/**
+ * @brief Chase-Lev deque of ranges
+ */
+struct parallel_deque
+{
+    volatile int64_t top;        // Next entry thieves take
+    volatile int64_t bottom;     // Next entry the owner pushes
+    struct parallel_range ranges[PARALLEL_DEQUE_SIZE];
+};
+
+/**
+ * @brief Per-CPU parallel worker: one thread that runs stolen ranges
+ */
+struct parallel_worker
+{
+    struct parallel_deque deque; // Ranges split off by this worker
+    struct thread *thread;       // Worker thread, pinned to cpu
+    uint32_t cpu;
+    volatile bool sleeping;      // Blocked until a range is queued
+    uint64_t ranges;             // Ranges run
+    uint64_t steals;             // Of those, taken from another deque
+};
+
+extern struct parallel_worker parallel_workers[MAX_CPUS];
+
+/**
+ * @brief Start a parallel worker on every CPU whose scheduler runs
+ *
+ * CPUs that already have one are skipped, like fiber_init(). Before the
+ * first call parallel_for() runs on the caller alone.
+ */
+void parallel_init(void);
+
+/**
+ * @brief Call fn(lo, hi, arg) over subranges covering [begin, end)
+ *
+ * Subranges are at most grain long, or about a sixteenth of the range per
+ * started worker if grain is 0, and run concurrently on any CPU; fn must
+ * not block for long. The caller runs subranges too and returns once all
+ * have finished. Callable from threads, from fn itself and from boot code
+ * with interrupts enabled.
+ */
+void parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+                  void (*fn)(uint64_t lo, uint64_t hi, void *arg), void *arg);
+
+/**
+ * @brief Log parallel worker counters for all CPUs
+ */
+void parallel_log_stats(void);
+
+#endif // SHIPOS_PARALLEL_H
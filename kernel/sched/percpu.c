@@ -354,16 +354,6 @@ void percpu_log_timer_ticks(void) {
 // Interrupt State Management (moved from spinlock.c)
 // ============================================================================
 
-// Read EFLAGS register
-static inline uint64_t read_eflags(void) {
-    uint64_t eflags;
-    asm volatile("pushfq; popq %0" : "=r"(eflags));
-    return eflags;
-}
-
-// Interrupt flag in EFLAGS
-#define FL_IF 0x00000200
-
 void pushcli(void) {
     uint64_t eflags = read_eflags();
     cli();  // Disable interrupts
@@ -391,3 +381,18 @@ void popcli(void) {
         sti();  // Re-enable interrupts
     }
 }
+
+void preempt_disable(void) {
+    pushcli();
+    mycpu()->preempt_count++;
+    popcli();
+}
+
+void preempt_enable(void) {
+    pushcli();
+    struct percpu *cpu = mycpu();
+    if (--cpu->preempt_count < 0) {
+        panic("unbalanced preempt_enable");
+    }
+    popcli();
+}
@@ -13,9 +13,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "threads.h"
-
-// Maximum number of CPUs supported
-#define MAX_CPUS 64
+#include "sched_class.h"
+#include "cpumask.h"
+#include "../sync/spinlock.h"
 
 // ============================================================================
 // Task State Segment (TSS) for x86_64
@@ -92,6 +92,10 @@ struct gdt_ptr
 // Per-CPU Data Structure
 // ============================================================================
 
+// Queue-depth histogram buckets: 0, 1, 2-3, 4-7, ..., the last one also
+// counts every deeper queue
+#define SCHED_QDEPTH_BUCKETS 8
+
 /**
  * @brief Per-CPU data structure
  *
@@ -115,14 +119,78 @@ struct percpu
     // Scheduler state
     struct thread *current_thread; // Currently running thread on this CPU
     struct thread *idle_thread;    // Idle thread for this CPU
-    struct thread_node *run_queue; // Per-CPU run queue (circular linked list)
+    struct spinlock rq_lock;       // Protects the run queue and num_threads
+    struct dl_rq dl;               // Deadline class queue
+    struct prio_rq rt;             // Real-time class queue
+    struct prio_rq prio;           // Priority round-robin class queue
+    struct cfs_rq cfs;             // Fair class queue
+    uint32_t nr_queued;            // RUNNABLE threads queued in any class
+    struct list throttled;         // THROTTLED threads waiting for a refill
+    uint32_t nr_throttled;         // Entries on throttled
+    struct thread *volatile wake_list; // Lock-free stack of woken threads, newest first
     struct context *scheduler_ctx; // Scheduler context for this CPU
-    uint32_t num_threads;          // Number of threads in this CPU's run queue
+    uint32_t num_threads;          // Queued plus running threads owned by this CPU
+
+    // Thread recycling, see create_thread() and release_thread()
+    struct thread *dead_threads;   // Exited threads waiting for the reaper, linked by wake_next
+    uint32_t nr_dead;              // Entries on dead_threads
+    struct thread *thread_pool;    // Reaped threads ready for reuse, linked by wake_next
+    uint32_t nr_pooled;            // Entries on thread_pool
+    uint64_t threads_reaped;       // Exited threads pooled or freed
+    uint64_t threads_reused;       // create_thread() calls served from thread_pool
     bool scheduler_ready;          // Is this CPU's scheduler ready to run?
 
+    // Preemption state
+    int preempt_count;             // Depth of preempt_disable nesting
+    volatile bool need_resched;    // Time slice expired, switch on interrupt return
+    uint32_t slice_ticks;          // Timer ticks charged to the current thread
+    uint64_t preemptions;          // Number of involuntary switches
+
+    // Load balancing counters
+    uint64_t steals;               // Threads pulled by this CPU while idle
+    uint64_t migrations;           // Threads pulled by periodic balancing
+    uint64_t balance_hot_skips;    // Cache-hot threads periodic balancing left in place
+    uint64_t nr_switches;          // Switches into threads other than idle
+
+    // Scheduler statistics, see sched_dump_stats()
+    uint64_t idle_time;            // TSC cycles spent in the idle thread
+    uint64_t qdepth_hist[SCHED_QDEPTH_BUCKETS]; // Threads left queued at each pick
+
+    // Wakeup placement counters, kept by the waking CPU
+    uint64_t wake_placements;      // Threads woken
+    uint64_t wake_hot_hits;        // Sent back to their last CPU while cache-hot
+    uint64_t wake_migrations;      // Sent to a CPU other than their last one
+
+    // Lazy FPU state, see fpu.h
+    struct thread *fpu_owner;      // Thread whose registers are loaded, NULL if none
+    uint64_t fpu_traps;            // #NM faults that loaded a thread's state
+    uint64_t fpu_saves;            // States saved when their thread switched out
+
+    // Reschedule IPI state
+    volatile bool ipi_pending;     // Reschedule IPI sent but not yet handled
+    uint64_t resched_ipis;         // Reschedule IPIs received
+    uint64_t wake_latency_count;   // Wakeups measured on this CPU
+    uint64_t wake_latency_total;   // Sum of wakeup-to-run TSC cycles
+    uint64_t wake_latency_max;     // Slowest wakeup-to-run in TSC cycles
+
+    // Page-table generation this CPU last flushed its TLB for, see paging.c
+    volatile uint64_t pt_flush_gen;
+
+    // Bottom halves, see softirq.h
+    volatile uint32_t softirq_pending; // Raised vectors, one bit each
+    bool in_softirq;               // Softirq handlers running on this CPU
+    uint64_t softirq_runs;         // Handler invocations
+
     // Timer interrupt counter for debugging
     volatile uint64_t timer_ticks; // Number of timer interrupts received
 
+    // Tick state, see time/tick.h
+    uint64_t tick_next_tsc;        // TSC of the next tick boundary
+    uint64_t timer_expiry_tsc;     // Earliest pending timer on this CPU, 0 if none
+    bool tick_stopped;             // Tick stopped while the CPU idles
+    uint64_t nohz_entries;         // Idle periods entered without a tick
+    uint64_t nohz_skipped_ticks;   // Ticks slept through while tickless
+
     // TSS for this CPU
     struct tss64 tss;
 
@@ -285,6 +353,22 @@ void pushcli(void);
  */
 void popcli(void);
 
+/**
+ * @brief Disable preemption on this CPU
+ *
+ * Nests like pushcli(). Taken by every spinlock so a thread is never
+ * switched out while holding one.
+ */
+void preempt_disable(void);
+
+/**
+ * @brief Re-enable preemption on this CPU
+ *
+ * A pending reschedule is not acted on here; it happens on the next
+ * return from interrupt.
+ */
+void preempt_enable(void);
+
 /**
  * @brief Log timer tick counts for all CPUs
  *
@@ -0,0 +1,144 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Scheduling classes. smp_sched.c owns the per-CPU locking, wakeups,
+// stealing and balancing; a class only decides the order in which the
+// RUNNABLE threads queued on one CPU run and when the running one has
+// used up its share. Every operation is called with cpu->rq_lock held,
+// except migrate, see below.
+//
+
+#ifndef SHIPOS_SCHED_CLASS_H
+#define SHIPOS_SCHED_CLASS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+#include "../list/list.h"
+#include "../rbtree/rbtree.h"
+
+struct percpu;
+
+// Fair class: period over which every runnable thread runs once, the
+// shortest slice it is cut into and the vruntime lead a waking thread
+// needs to preempt the running one
+#define SCHED_FAIR_LATENCY_MS     40
+#define SCHED_FAIR_MIN_SLICE_MS   10
+#define SCHED_FAIR_WAKEUP_GRAN_MS 5
+
+// Weight of a thread at THREAD_PRIO_DEFAULT
+#define SCHED_FAIR_WEIGHT_DEFAULT 1024
+
+// Timer ticks a SCHED_RR thread runs before yielding to its peers
+#define SCHED_RT_RR_SLICE 10
+
+// Deadline class bandwidth is the density runtime / deadline in this fixed
+// point; at most SCHED_DL_BW_LIMIT of each CPU can be reserved, the rest is
+// left to the other classes
+#define SCHED_DL_BW_SHIFT     20
+#define SCHED_DL_BW_LIMIT     ((95u << SCHED_DL_BW_SHIFT) / 100)
+#define SCHED_DL_PERIOD_MAX_US 1000000
+
+/**
+ * @brief Per-CPU state of the priority round-robin class
+ */
+struct prio_rq
+{
+    struct list queue[THREAD_PRIO_LEVELS]; // FIFO per priority level
+    uint32_t bitmap;                       // Bit p set when queue[p] is non-empty
+};
+
+/**
+ * @brief Per-CPU state of the fair class
+ *
+ * Queued threads are ordered by vruntime; the running thread is kept out
+ * of the tree.
+ */
+struct cfs_rq
+{
+    struct rb_root tasks;
+    struct rb_node *leftmost;   // Cached smallest vruntime
+    volatile uint64_t min_vruntime; // Monotonic floor of the vruntimes; migrate reads it unlocked
+    uint64_t load;              // Sum of the queued threads' weights
+    uint32_t nr_running;        // Queued threads
+};
+
+/**
+ * @brief Per-CPU state of the deadline class
+ *
+ * Queued threads are ordered by absolute deadline.
+ */
+struct dl_rq
+{
+    struct rb_root tasks;
+    struct rb_node *leftmost;   // Cached earliest deadline
+    uint64_t total_bw;          // Bandwidth admitted on this CPU
+    uint32_t nr_running;        // Queued threads
+};
+
+/**
+ * @brief Operations of a scheduling class
+ */
+struct sched_class
+{
+    const char *name;
+
+    // Reset the class's part of a CPU's run queue
+    void (*init_rq)(struct percpu *cpu);
+
+    // Add or remove a queued RUNNABLE thread
+    void (*enqueue)(struct percpu *cpu, struct thread *t);
+    void (*dequeue)(struct percpu *cpu, struct thread *t);
+
+    // Queued thread that should run next, without removing it
+    struct thread *(*peek_next)(struct percpu *cpu);
+
+    // Queued thread allowed on CPU dst that is cheapest to move there,
+    // for balancing, and the most urgent one, for an idle dst to steal
+    struct thread *(*peek_migrate)(struct percpu *cpu, uint32_t dst);
+    struct thread *(*peek_steal)(struct percpu *cpu, uint32_t dst);
+
+    // Whether t, just made runnable, should take the CPU from curr
+    bool (*preempts)(struct percpu *cpu, struct thread *t, struct thread *curr);
+
+    // Account delta TSC cycles of runtime to the running thread t (optional)
+    void (*charge)(struct percpu *cpu, struct thread *t, uint64_t delta);
+
+    // Timer tick while curr runs; true when curr has used its slice
+    bool (*tick)(struct percpu *cpu, struct thread *curr);
+
+    // t was dequeued from `from` and is about to run on `to` (optional).
+    // Called by wakeups with neither rq_lock held: t belongs to the
+    // caller, but the queues may change underneath, so each field of
+    // theirs is read once and must stay valid at any value it can take
+    void (*migrate)(struct percpu *from, struct percpu *to, struct thread *t);
+
+    // t is RUNNABLE and about to be queued, after running or, with
+    // wakeup set, after sleeping. Refills its budget when due and returns
+    // true while it must stay off the CPU (optional)
+    bool (*throttled)(struct percpu *cpu, struct thread *t, bool wakeup);
+
+    // The running thread t calls sched_yield() (optional)
+    void (*yield)(struct percpu *cpu, struct thread *t);
+
+    // t leaves the class, by changing class or exiting (optional)
+    void (*detach)(struct percpu *cpu, struct thread *t);
+};
+
+// Earliest deadline first with per-thread bandwidth (SCHED_DEADLINE)
+extern const struct sched_class dl_sched_class;
+
+// Fixed real-time priorities (SCHED_FIFO, SCHED_RR)
+extern const struct sched_class rt_sched_class;
+
+// Priority levels served round-robin, the original policy (`sched=rr`)
+extern const struct sched_class prio_sched_class;
+
+// Virtual-runtime fair share (`sched=fair`)
+extern const struct sched_class fair_sched_class;
+
+// Class given to new threads, chosen from the command line by sched_init()
+extern const struct sched_class *sched_default_class;
+
+#endif // SHIPOS_SCHED_CLASS_H
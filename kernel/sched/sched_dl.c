@@ -0,0 +1,183 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Deadline scheduling class. Each thread reserves dl_runtime of CPU time
+// every dl_period and the queued thread with the earliest absolute
+// deadline runs first. Budgets are enforced as a constant bandwidth
+// server: a thread that has used its runtime is THROTTLED until its next
+// period starts, so an overrunning thread cannot eat into the bandwidth
+// promised to others. Admission control in sched_set_deadline() keeps the
+// summed density, runtime / deadline, of each CPU below SCHED_DL_BW_LIMIT.
+//
+
+#include "sched_class.h"
+#include "percpu.h"
+#include "../lib/include/x86_64.h"
+
+static struct thread *node_thread(struct rb_node *node)
+{
+    return node ? rb_entry(node, struct thread, run_node) : 0;
+}
+
+/**
+ * @brief Start a new period once the budget is spent
+ *
+ * Periods are consumed until the budget is positive again, so a thread
+ * that overran by more than one runtime loses the periods it overran
+ * into. A deadline already in the past restarts from now.
+ */
+static void dl_replenish(struct thread *t, uint64_t now)
+{
+    while (t->dl_budget <= 0)
+    {
+        t->dl_abs_deadline += t->dl_period;
+        t->dl_budget += t->dl_runtime;
+    }
+    if (t->dl_abs_deadline <= now)
+    {
+        t->dl_abs_deadline = now + t->dl_deadline;
+        t->dl_budget = t->dl_runtime;
+    }
+}
+
+static void dl_init_rq(struct percpu *cpu)
+{
+    cpu->dl.tasks.node = 0;
+    cpu->dl.leftmost = 0;
+    cpu->dl.total_bw = 0;
+    cpu->dl.nr_running = 0;
+}
+
+static void dl_enqueue(struct percpu *cpu, struct thread *t)
+{
+    struct dl_rq *dl = &cpu->dl;
+
+    struct rb_node **link = &dl->tasks.node;
+    struct rb_node *parent = 0;
+    bool leftmost = true;
+    while (*link != 0)
+    {
+        parent = *link;
+        if (t->dl_abs_deadline < node_thread(parent)->dl_abs_deadline)
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    rb_link_node(&t->run_node, parent, link);
+    rb_insert_color(&t->run_node, &dl->tasks);
+    if (leftmost)
+    {
+        dl->leftmost = &t->run_node;
+    }
+    dl->nr_running++;
+}
+
+static void dl_dequeue(struct percpu *cpu, struct thread *t)
+{
+    struct dl_rq *dl = &cpu->dl;
+
+    if (dl->leftmost == &t->run_node)
+    {
+        dl->leftmost = rb_next(&t->run_node);
+    }
+    rb_erase(&t->run_node, &dl->tasks);
+    dl->nr_running--;
+}
+
+static struct thread *dl_peek_next(struct percpu *cpu)
+{
+    return node_thread(cpu->dl.leftmost);
+}
+
+static struct thread *dl_peek_migrate(struct percpu *cpu, uint32_t dst)
+{
+    // Bandwidth is reserved on one CPU, so deadline threads stay there
+    (void) cpu;
+    (void) dst;
+    return 0;
+}
+
+static bool dl_preempts(struct percpu *cpu, struct thread *t, struct thread *curr)
+{
+    (void) cpu;
+    return t->dl_abs_deadline < curr->dl_abs_deadline;
+}
+
+static void dl_charge(struct percpu *cpu, struct thread *t, uint64_t delta)
+{
+    (void) cpu;
+    t->dl_budget -= (int64_t) delta;
+}
+
+static bool dl_tick(struct percpu *cpu, struct thread *curr)
+{
+    (void) cpu;
+    return curr->dl_budget <= 0;
+}
+
+static bool dl_throttled(struct percpu *cpu, struct thread *t, bool wakeup)
+{
+    (void) cpu;
+    uint64_t now = rdtsc();
+
+    if (t->dl_budget > 0)
+    {
+        // A thread waking with budget left keeps its deadline only if
+        // running that budget before it stays within its bandwidth:
+        // budget / (deadline - now) <= runtime / relative deadline
+        if (wakeup && (t->dl_abs_deadline <= now ||
+                       (uint64_t) t->dl_budget * t->dl_deadline >
+                           (t->dl_abs_deadline - now) * t->dl_runtime))
+        {
+            t->dl_abs_deadline = now + t->dl_deadline;
+            t->dl_budget = t->dl_runtime;
+        }
+        return false;
+    }
+
+    // The next period starts dl_period after the current one did
+    uint64_t next_period = t->dl_abs_deadline - t->dl_deadline + t->dl_period;
+    if (now < next_period)
+    {
+        return true;
+    }
+    dl_replenish(t, now);
+    return false;
+}
+
+static void dl_yield(struct percpu *cpu, struct thread *t)
+{
+    // Done with this period's job: sleep until the next one
+    (void) cpu;
+    t->dl_budget = 0;
+}
+
+static void dl_detach(struct percpu *cpu, struct thread *t)
+{
+    cpu->dl.total_bw -= t->dl_bw;
+    t->dl_bw = 0;
+}
+
+const struct sched_class dl_sched_class = {
+    .name = "deadline",
+    .init_rq = dl_init_rq,
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .peek_next = dl_peek_next,
+    .peek_migrate = dl_peek_migrate,
+    .peek_steal = dl_peek_migrate,
+    .preempts = dl_preempts,
+    .charge = dl_charge,
+    .tick = dl_tick,
+    .migrate = 0,
+    .throttled = dl_throttled,
+    .yield = dl_yield,
+    .detach = dl_detach,
+};
@@ -0,0 +1,207 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Fair scheduling class. Every thread accumulates virtual runtime, its
+// TSC runtime scaled by SCHED_FAIR_WEIGHT_DEFAULT / weight, and the queued
+// thread with the smallest vruntime runs next. The priority level selects
+// the weight, 25% apart per level as with Linux nice values.
+//
+
+#include "sched_class.h"
+#include "percpu.h"
+#include "../time/clockevent.h"
+
+// Weights for priority levels 0..31 (nice -16..15)
+static const uint32_t prio_to_weight[THREAD_PRIO_LEVELS] = {
+    36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620,
+    6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215,
+    172, 137, 110, 87, 70, 56, 45, 36,
+};
+
+static uint64_t ms_to_tsc(uint64_t ms)
+{
+    return ms * clockevent_tsc_per_ms();
+}
+
+static uint64_t thread_weight(struct thread *t)
+{
+    return prio_to_weight[t->priority];
+}
+
+static struct thread *node_thread(struct rb_node *node)
+{
+    return node ? rb_entry(node, struct thread, run_node) : 0;
+}
+
+static void fair_init_rq(struct percpu *cpu)
+{
+    cpu->cfs.tasks.node = 0;
+    cpu->cfs.leftmost = 0;
+    cpu->cfs.min_vruntime = 0;
+    cpu->cfs.load = 0;
+    cpu->cfs.nr_running = 0;
+}
+
+static void fair_enqueue(struct percpu *cpu, struct thread *t)
+{
+    struct cfs_rq *cfs = &cpu->cfs;
+
+    // A thread that slept is placed at most half a period behind the
+    // queue, so it gets ahead of CPU hogs without monopolising the CPU
+    uint64_t credit = ms_to_tsc(SCHED_FAIR_LATENCY_MS) / 2;
+    uint64_t floor = cfs->min_vruntime > credit ? cfs->min_vruntime - credit : 0;
+    if (t->vruntime < floor)
+    {
+        t->vruntime = floor;
+    }
+
+    // Equal keys go right, so threads with the same vruntime run FIFO
+    struct rb_node **link = &cfs->tasks.node;
+    struct rb_node *parent = 0;
+    bool leftmost = true;
+    while (*link != 0)
+    {
+        parent = *link;
+        if (t->vruntime < node_thread(parent)->vruntime)
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    rb_link_node(&t->run_node, parent, link);
+    rb_insert_color(&t->run_node, &cfs->tasks);
+    if (leftmost)
+    {
+        cfs->leftmost = &t->run_node;
+    }
+    cfs->load += thread_weight(t);
+    cfs->nr_running++;
+}
+
+static void fair_dequeue(struct percpu *cpu, struct thread *t)
+{
+    struct cfs_rq *cfs = &cpu->cfs;
+
+    if (cfs->leftmost == &t->run_node)
+    {
+        cfs->leftmost = rb_next(&t->run_node);
+    }
+    rb_erase(&t->run_node, &cfs->tasks);
+    cfs->load -= thread_weight(t);
+    cfs->nr_running--;
+}
+
+static struct thread *fair_peek_next(struct percpu *cpu)
+{
+    return node_thread(cpu->cfs.leftmost);
+}
+
+static struct thread *fair_peek_migrate(struct percpu *cpu, uint32_t dst)
+{
+    // Furthest ahead in virtual time, so it has the longest to wait here
+    for (struct rb_node *node = rb_last(&cpu->cfs.tasks); node != 0; node = rb_prev(node))
+    {
+        struct thread *t = node_thread(node);
+        if (cpumask_test_cpu(&t->cpus_allowed, dst))
+        {
+            return t;
+        }
+    }
+    return 0;
+}
+
+static struct thread *fair_peek_steal(struct percpu *cpu, uint32_t dst)
+{
+    for (struct rb_node *node = cpu->cfs.leftmost; node != 0; node = rb_next(node))
+    {
+        struct thread *t = node_thread(node);
+        if (cpumask_test_cpu(&t->cpus_allowed, dst))
+        {
+            return t;
+        }
+    }
+    return 0;
+}
+
+static bool fair_preempts(struct percpu *cpu, struct thread *t, struct thread *curr)
+{
+    (void) cpu;
+    return t->vruntime + ms_to_tsc(SCHED_FAIR_WAKEUP_GRAN_MS) < curr->vruntime;
+}
+
+static void fair_charge(struct percpu *cpu, struct thread *t, uint64_t delta)
+{
+    struct cfs_rq *cfs = &cpu->cfs;
+
+    t->vruntime += delta * SCHED_FAIR_WEIGHT_DEFAULT / thread_weight(t);
+
+    // min_vruntime only moves forward and tracks the smaller of the
+    // running thread and the queue head
+    uint64_t vmin = t->vruntime;
+    struct thread *left = node_thread(cfs->leftmost);
+    if (left != 0 && left->vruntime < vmin)
+    {
+        vmin = left->vruntime;
+    }
+    if (vmin > cfs->min_vruntime)
+    {
+        cfs->min_vruntime = vmin;
+    }
+}
+
+static bool fair_tick(struct percpu *cpu, struct thread *curr)
+{
+    struct cfs_rq *cfs = &cpu->cfs;
+    uint64_t weight = thread_weight(curr);
+
+    // Every runnable thread runs once per period; the period stretches
+    // when the minimum slice would not fit
+    uint64_t period = ms_to_tsc(SCHED_FAIR_LATENCY_MS);
+    uint64_t min_slice = ms_to_tsc(SCHED_FAIR_MIN_SLICE_MS);
+    if ((cfs->nr_running + 1) * min_slice > period)
+    {
+        period = (cfs->nr_running + 1) * min_slice;
+    }
+    uint64_t slice = period * weight / (cfs->load + weight);
+
+    return cfs->nr_running != 0 && curr->sum_exec_runtime - curr->slice_start >= slice;
+}
+
+static void fair_migrate(struct percpu *from, struct percpu *to, struct thread *t)
+{
+    // Keep the thread's lag relative to the queue it leaves. Both queues
+    // are unlocked: take one snapshot of each floor, an aligned 64-bit
+    // load that cannot tear, so the result is consistent with it
+    uint64_t from_min = from->cfs.min_vruntime;
+    uint64_t to_min = to->cfs.min_vruntime;
+    int64_t lag = (int64_t) (t->vruntime - from_min);
+    if (lag < 0 && (uint64_t) -lag > to_min)
+    {
+        t->vruntime = 0;
+    }
+    else
+    {
+        t->vruntime = to_min + lag;
+    }
+}
+
+const struct sched_class fair_sched_class = {
+    .name = "fair",
+    .init_rq = fair_init_rq,
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .peek_next = fair_peek_next,
+    .peek_migrate = fair_peek_migrate,
+    .peek_steal = fair_peek_steal,
+    .preempts = fair_preempts,
+    .charge = fair_charge,
+    .tick = fair_tick,
+    .migrate = fair_migrate,
+};
@@ -0,0 +1,202 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Priority queue scheduling classes: one FIFO per priority level and a
+// bitmap of the non-empty levels, so picking is a bit scan plus a list
+// pop. The same queue backs two classes:
+//  - rr: normal threads, which share the CPU in SCHED_TIME_SLICE tick
+//    slices within a level.
+//  - rt: real-time threads, served before every normal class. SCHED_FIFO
+//    threads keep the CPU until a more urgent thread arrives; SCHED_RR
+//    threads rotate every SCHED_RT_RR_SLICE ticks within a level.
+//
+
+#include "sched_class.h"
+#include "percpu.h"
+#include "smp_sched.h"
+#include "../lib/include/x86_64.h"
+
+static void prio_rq_init(struct prio_rq *rq)
+{
+    for (int prio = 0; prio < THREAD_PRIO_LEVELS; prio++)
+    {
+        lst_init(&rq->queue[prio]);
+    }
+    rq->bitmap = 0;
+}
+
+static void prio_rq_enqueue(struct prio_rq *rq, struct thread *t)
+{
+    int prio = t->priority;
+    lst_push_back(&rq->queue[prio], &t->rq_link);
+    rq->bitmap |= 1u << prio;
+}
+
+static void prio_rq_dequeue(struct prio_rq *rq, struct thread *t)
+{
+    int prio = t->priority;
+    lst_remove(&t->rq_link);
+    lst_init(&t->rq_link);
+    if (lst_empty(&rq->queue[prio]))
+    {
+        rq->bitmap &= ~(1u << prio);
+    }
+}
+
+static struct thread *prio_rq_first(struct prio_rq *rq)
+{
+    if (rq->bitmap == 0)
+    {
+        return 0;
+    }
+    int prio = bsf(rq->bitmap);
+    return lst_entry(rq->queue[prio].next, struct thread, rq_link);
+}
+
+/**
+ * @brief First queued thread whose affinity allows CPU dst
+ *
+ * Levels are scanned from the most urgent when urgent is set, otherwise
+ * from the least urgent; each level from its head.
+ */
+static struct thread *prio_rq_find(struct prio_rq *rq, uint32_t dst, bool urgent)
+{
+    uint32_t levels = rq->bitmap;
+    while (levels != 0)
+    {
+        int prio = urgent ? bsf(levels) : 31 - __builtin_clz(levels);
+        levels &= ~(1u << prio);
+
+        struct list *head = &rq->queue[prio];
+        for (struct list *node = head->next; node != head; node = node->next)
+        {
+            struct thread *t = lst_entry(node, struct thread, rq_link);
+            if (cpumask_test_cpu(&t->cpus_allowed, dst))
+            {
+                return t;
+            }
+        }
+    }
+    return 0;
+}
+
+static bool prio_preempts(struct percpu *cpu, struct thread *t, struct thread *curr)
+{
+    (void) cpu;
+    return t->priority < curr->priority;
+}
+
+// ============================================================================
+// Normal priority round-robin
+// ============================================================================
+
+static void prio_init_rq(struct percpu *cpu)
+{
+    prio_rq_init(&cpu->prio);
+}
+
+static void prio_enqueue(struct percpu *cpu, struct thread *t)
+{
+    prio_rq_enqueue(&cpu->prio, t);
+}
+
+static void prio_dequeue(struct percpu *cpu, struct thread *t)
+{
+    prio_rq_dequeue(&cpu->prio, t);
+}
+
+static struct thread *prio_peek_next(struct percpu *cpu)
+{
+    return prio_rq_first(&cpu->prio);
+}
+
+static struct thread *prio_peek_migrate(struct percpu *cpu, uint32_t dst)
+{
+    return prio_rq_find(&cpu->prio, dst, false);
+}
+
+static struct thread *prio_peek_steal(struct percpu *cpu, uint32_t dst)
+{
+    return prio_rq_find(&cpu->prio, dst, true);
+}
+
+static bool prio_tick(struct percpu *cpu, struct thread *curr)
+{
+    (void) curr;
+    return ++cpu->slice_ticks >= SCHED_TIME_SLICE;
+}
+
+const struct sched_class prio_sched_class = {
+    .name = "rr",
+    .init_rq = prio_init_rq,
+    .enqueue = prio_enqueue,
+    .dequeue = prio_dequeue,
+    .peek_next = prio_peek_next,
+    .peek_migrate = prio_peek_migrate,
+    .peek_steal = prio_peek_steal,
+    .preempts = prio_preempts,
+    .charge = 0,
+    .tick = prio_tick,
+    .migrate = 0,
+};
+
+// ============================================================================
+// Real-time FIFO and round-robin
+// ============================================================================
+
+static void rt_init_rq(struct percpu *cpu)
+{
+    prio_rq_init(&cpu->rt);
+}
+
+static void rt_enqueue(struct percpu *cpu, struct thread *t)
+{
+    prio_rq_enqueue(&cpu->rt, t);
+}
+
+static void rt_dequeue(struct percpu *cpu, struct thread *t)
+{
+    prio_rq_dequeue(&cpu->rt, t);
+}
+
+static struct thread *rt_peek_next(struct percpu *cpu)
+{
+    return prio_rq_first(&cpu->rt);
+}
+
+static struct thread *rt_peek_migrate(struct percpu *cpu, uint32_t dst)
+{
+    return prio_rq_find(&cpu->rt, dst, false);
+}
+
+static struct thread *rt_peek_steal(struct percpu *cpu, uint32_t dst)
+{
+    return prio_rq_find(&cpu->rt, dst, true);
+}
+
+static bool rt_tick(struct percpu *cpu, struct thread *curr)
+{
+    if (curr->policy != SCHED_RR)
+    {
+        return false;
+    }
+
+    // Only worth a switch when a peer at the same level is waiting
+    return ++cpu->slice_ticks >= SCHED_RT_RR_SLICE &&
+           !lst_empty(&cpu->rt.queue[curr->priority]);
+}
+
+const struct sched_class rt_sched_class = {
+    .name = "rt",
+    .init_rq = rt_init_rq,
+    .enqueue = rt_enqueue,
+    .dequeue = rt_dequeue,
+    .peek_next = rt_peek_next,
+    .peek_migrate = rt_peek_migrate,
+    .peek_steal = rt_peek_steal,
+    .preempts = prio_preempts,
+    .charge = 0,
+    .tick = rt_tick,
+    .migrate = 0,
+};
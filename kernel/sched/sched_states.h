@@ -6,7 +6,7 @@
 #ifndef UNTITLED_OS_SCHED_STATES_H
 #define UNTITLED_OS_SCHED_STATES_H
 
-#define NUMBER_OF_SCHED_STATES 6
+#define NUMBER_OF_SCHED_STATES 8
 
 /**
  * @brief Scheduler states for threads/processes
@@ -19,7 +19,9 @@ enum sched_states {
     ON_CPU,       /**< Thread/process is currently running on a CPU */
     WAIT,         /**< Thread/process is blocked, waiting for an event */
     EXIT,         /**< Thread/process has finished execution */
-    UNUSED        /**< Unused or free thread/process slot */
+    UNUSED,       /**< Unused or free thread/process slot */
+    WAKING,       /**< Woken, waiting on a CPU's wakelist to be enqueued */
+    THROTTLED     /**< Out of budget, parked on its CPU until its class refills it */
 };
 
 #endif // UNTITLED_OS_SCHED_STATES_H
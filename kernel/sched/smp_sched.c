@@ -11,15 +11,41 @@
 #include "../lib/include/logging.h"
 #include "../lib/include/panic.h"
 #include "../lib/include/memset.h"
+#include "../lib/include/memcmp.h"
+#include "../lib/include/str_utils.h"
 #include "../lib/include/x86_64.h"
 #include "../kalloc/kalloc.h"
+#include "../apic/lapic.h"
+#include "../idt/idt.h"
+#include "../time/tick.h"
+#include "../cmdline/cmdline.h"
+#include "../time/clockevent.h"
+#include "topology.h"
+#include "fpu.h"
+#include "softirq.h"
 
 // ============================================================================
 // Global State
 // ============================================================================
 
-struct spinlock sched_lock;
 bool sched_initialized = false;
+bool sched_resched_ipi = true;
+uint64_t sched_cache_hot_us = SCHED_CACHE_HOT_US;
+const struct sched_class *sched_default_class = &prio_sched_class;
+
+// Classes in the order their queues are served
+static const struct sched_class *const sched_classes[] = {
+    &dl_sched_class,
+    &rt_sched_class,
+    &prio_sched_class,
+    &fair_sched_class,
+};
+
+#define NR_SCHED_CLASSES (sizeof(sched_classes) / sizeof(sched_classes[0]))
+
+static struct thread *sched_steal(struct percpu *cpu);
+static struct percpu *select_cpu(struct thread *thread);
+static bool cache_hot(struct thread *thread, uint64_t now);
 
 // ============================================================================
 // Idle Thread
@@ -44,19 +70,42 @@ static void idle_yield(void)
  * @brief Idle thread function
  *
  * Runs when no other threads are available.
- * Uses HLT instruction to save power while waiting for interrupts.
+ * Uses HLT instruction to save power while waiting for interrupts, with
+ * the tick stopped (see tick_nohz_idle_enter).
  * After each interrupt (like timer), yields to scheduler to check for work.
  */
 static void idle_thread_func(void *arg)
 {
     (void) arg; // Unused
+    struct percpu *cpu = mycpu();
     while (1)
     {
-        sti();               // Enable interrupts
-        asm volatile("hlt"); // Wait for interrupt
-        
+        // A wakeup pushed after the last pick must not wait for the next
+        // tick: check with interrupts off, and rely on the STI shadow so a
+        // reschedule IPI arriving after the check still ends the HLT
+        cli();
+
+        // Softirqs left over by an interrupt that hit with interrupts off,
+        // or beyond SOFTIRQ_MAX_RESTART: a due TIMER softirq has already
+        // disarmed the clockevent and would otherwise sleep through the HLT
+        softirq_run_pending();
+
+        if (cpu->wake_list == 0 && cpu->nr_queued == 0 && cpu->softirq_pending == 0)
+        {
+            // Nothing to do until an interrupt: stop the tick for the
+            // sleep, unless throttled threads wait for it to refill them
+            if (cpu->nr_throttled == 0)
+            {
+                tick_nohz_idle_enter();
+            }
+            asm volatile("sti; hlt"); // Wait for interrupt
+            cli();
+            tick_nohz_idle_exit();
+        }
+
         // After waking from hlt (e.g., timer interrupt), yield to 
-        // let scheduler check if there's real work to do
+        // let scheduler check if there's real work to do; like every
+        // switch to the scheduler, with interrupts off
         idle_yield();
     }
 }
@@ -79,104 +128,446 @@ static struct thread *create_idle_thread(void)
 // ============================================================================
 
 /**
- * @brief Add thread to current CPU's run queue (internal, no lock)
+ * @brief Queue a RUNNABLE thread in its class (caller holds cpu->rq_lock)
+ */
+static void runqueue_enqueue(struct percpu *cpu, struct thread *thread)
+{
+    thread->sched_class->enqueue(cpu, thread);
+    thread->on_rq = true;
+    cpu->nr_queued++;
+    thread->cpu = cpu->cpu_index;
+}
+
+/**
+ * @brief Remove a queued thread from its class (caller holds cpu->rq_lock)
  */
-static void runqueue_add_unlocked(struct percpu *cpu, struct thread *thread)
+static void runqueue_dequeue(struct percpu *cpu, struct thread *thread)
 {
-    push_thread_list(&cpu->run_queue, thread);
-    cpu->num_threads++;
+    thread->sched_class->dequeue(cpu, thread);
+    thread->on_rq = false;
+    cpu->nr_queued--;
+}
+
+/**
+ * @brief Most urgent queued thread, from the first class with work
+ */
+static struct thread *runqueue_peek(struct percpu *cpu)
+{
+    for (uint32_t i = 0; i < NR_SCHED_CLASSES; i++)
+    {
+        struct thread *t = sched_classes[i]->peek_next(cpu);
+        if (t != 0)
+        {
+            return t;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Queued thread to move to CPU dst, from the last class with one
+ */
+static struct thread *runqueue_peek_migrate(struct percpu *cpu, uint32_t dst)
+{
+    for (uint32_t i = NR_SCHED_CLASSES; i > 0; i--)
+    {
+        struct thread *t = sched_classes[i - 1]->peek_migrate(cpu, dst);
+        if (t != 0)
+        {
+            return t;
+        }
+    }
+    return 0;
 }
 
 /**
- * @brief Remove thread from current CPU's run queue (internal)
+ * @brief Most urgent queued thread that may move to CPU dst
  *
- * @return true if thread was found and removed
+ * Threads whose affinity excludes dst, and classes whose threads are
+ * bound to their CPU, are skipped.
  */
-static bool runqueue_remove_unlocked(struct percpu *cpu, struct thread *thread)
+static struct thread *runqueue_peek_steal(struct percpu *cpu, uint32_t dst)
 {
-    if (cpu->run_queue == 0)
+    for (uint32_t i = 0; i < NR_SCHED_CLASSES; i++)
     {
-        return false;
+        struct thread *t = sched_classes[i]->peek_steal(cpu, dst);
+        if (t != 0)
+        {
+            return t;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Position of a class in sched_classes, lower is more urgent
+ */
+static uint32_t class_rank(const struct sched_class *class)
+{
+    for (uint32_t i = 0; i < NR_SCHED_CLASSES; i++)
+    {
+        if (sched_classes[i] == class)
+        {
+            return i;
+        }
+    }
+    return NR_SCHED_CLASSES;
+}
+
+/**
+ * @brief Whether a runnable thread should take the CPU from curr
+ */
+static bool thread_preempts(struct percpu *cpu, struct thread *thread, struct thread *curr)
+{
+    if (thread->sched_class != curr->sched_class)
+    {
+        return class_rank(thread->sched_class) < class_rank(curr->sched_class);
     }
+    return thread->sched_class->preempts(cpu, thread, curr);
+}
 
-    struct thread_node *start = cpu->run_queue;
-    struct thread_node *current = start;
+/**
+ * @brief Charge the running thread for the TSC cycles since exec_start
+ *
+ * Caller holds cpu->rq_lock.
+ */
+static void update_curr(struct percpu *cpu, struct thread *curr)
+{
+    uint64_t now = rdtsc();
+    uint64_t delta = now - curr->exec_start;
 
-    do
+    curr->exec_start = now;
+    curr->sum_exec_runtime += delta;
+    if (curr->sched_class->charge != 0)
+    {
+        curr->sched_class->charge(cpu, curr, delta);
+    }
+}
+
+/**
+ * @brief Lock the run queue that owns a thread
+ *
+ * thread->cpu can change under migration until the owning queue is
+ * locked, so re-check it after taking the lock.
+ *
+ * @return The locked CPU
+ */
+static struct percpu *lock_thread_rq(struct thread *thread)
+{
+    while (1)
     {
-        if (current->data == thread)
+        struct percpu *cpu = &percpus[thread->cpu];
+        acquire_spinlock(&cpu->rq_lock);
+        if (thread->cpu == cpu->cpu_index)
         {
-            // Found it - remove from circular list
-            if (current->next == current)
-            {
-                // Only node in list
-                cpu->run_queue = 0;
-            }
-            else
-            {
-                current->prev->next = current->next;
-                current->next->prev = current->prev;
-                if (cpu->run_queue == current)
-                {
-                    cpu->run_queue = current->next;
-                }
-            }
-            kfree(current);
-            cpu->num_threads--;
-            return true;
+            return cpu;
         }
-        current = current->next;
-    } while (current != start);
+        release_spinlock(&cpu->rq_lock);
+    }
+}
 
-    return false;
+/**
+ * @brief Check whether a thread is queued in a run queue
+ */
+static bool thread_queued(struct thread *thread)
+{
+    return thread->on_rq;
 }
 
 /**
- * @brief Get next runnable thread from queue (round-robin)
+ * @brief Send a reschedule IPI unless one is already pending
+ *
+ * ipi_pending stays set until the target handles the IPI, so a burst of
+ * requests costs one interrupt.
  */
-static struct thread *runqueue_get_next(struct percpu *cpu)
+static void send_resched_ipi(struct percpu *cpu)
 {
-    if (cpu->run_queue == 0)
+    if (!__sync_lock_test_and_set(&cpu->ipi_pending, true))
     {
-        return 0;
+        lapic_send_ipi(cpu->apic_id, APIC_RESCHED_VECTOR);
+    }
+}
+
+/**
+ * @brief Request a reschedule if a newly queued thread beats the current one
+ *
+ * The local CPU is just flagged. A remote CPU gets a reschedule IPI when
+ * it is idle or running less urgent work. Called with interrupts disabled.
+ */
+static void check_preempt_curr(struct percpu *cpu, struct thread *thread)
+{
+    thread->wake_tsc = rdtsc();
+
+    struct thread *current = cpu->current_thread;
+    if (cpu == mycpu())
+    {
+        if (current != 0 && current != cpu->idle_thread && thread_preempts(cpu, thread, current))
+        {
+            cpu->need_resched = true;
+        }
+        return;
+    }
+
+    // current_thread is read racily; a stale value at worst sends an IPI
+    // that finds nothing to do, or leaves the wakeup to the next tick
+    if (!sched_resched_ipi || !cpu->scheduler_ready)
+    {
+        return;
+    }
+    if (current != 0 && current != cpu->idle_thread && !thread_preempts(cpu, thread, current))
+    {
+        return;
+    }
+    send_resched_ipi(cpu);
+}
+
+// ============================================================================
+// Throttling
+// ============================================================================
+
+/**
+ * @brief Queue a RUNNABLE thread, or park it if its class throttles it
+ *
+ * Caller holds cpu->rq_lock. A parked thread keeps counting towards
+ * num_threads and sits on cpu->throttled until runqueue_unthrottle()
+ * finds its budget refilled.
+ *
+ * @param wakeup The thread is coming back from sleep rather than the CPU
+ */
+static void runqueue_activate(struct percpu *cpu, struct thread *thread, bool wakeup)
+{
+    const struct sched_class *class = thread->sched_class;
+    if (class->throttled != 0 && class->throttled(cpu, thread, wakeup))
+    {
+        thread->state = THROTTLED;
+        thread->cpu = cpu->cpu_index;
+        lst_push_back(&cpu->throttled, &thread->rq_link);
+        cpu->nr_throttled++;
+        return;
+    }
+
+    thread->state = RUNNABLE;
+    runqueue_enqueue(cpu, thread);
+}
+
+/**
+ * @brief Take a THROTTLED thread off cpu->throttled (caller holds cpu->rq_lock)
+ */
+static void runqueue_unpark(struct percpu *cpu, struct thread *thread)
+{
+    lst_remove(&thread->rq_link);
+    lst_init(&thread->rq_link);
+    cpu->nr_throttled--;
+}
+
+/**
+ * @brief Queue the parked threads whose budget has been refilled
+ *
+ * Called from the tick with cpu->rq_lock held, so refills happen with
+ * tick granularity.
+ */
+static void runqueue_unthrottle(struct percpu *cpu)
+{
+    struct list *node = cpu->throttled.next;
+    while (node != &cpu->throttled)
+    {
+        struct thread *t = lst_entry(node, struct thread, rq_link);
+        node = node->next;
+        if (!t->sched_class->throttled(cpu, t, false))
+        {
+            runqueue_unpark(cpu, t);
+            t->state = RUNNABLE;
+            runqueue_enqueue(cpu, t);
+            check_preempt_curr(cpu, t);
+        }
     }
+}
 
-    struct thread_node *start = cpu->run_queue;
-    struct thread_node *current = start;
+// ============================================================================
+// Wakelist (lock-free remote enqueue)
+// ============================================================================
 
+/**
+ * @brief Push a woken thread onto a CPU's wakelist
+ *
+ * Any CPU may push; only the owner pops, and it always takes the whole
+ * list at once, so a plain compare-and-swap on the head is enough.
+ */
+static void wakelist_push(struct percpu *cpu, struct thread *thread)
+{
+    struct thread *head;
     do
     {
-        struct thread *t = current->data;
-        if (t->state == RUNNABLE)
+        head = cpu->wake_list;
+        thread->wake_next = head;
+    } while (!__sync_bool_compare_and_swap(&cpu->wake_list, head, thread));
+}
+
+/**
+ * @brief Hand a WAKING thread to a CPU's wakelist
+ *
+ * @param from CPU whose run queue the thread last belonged to
+ * @param to CPU that will enqueue it
+ */
+static void wake_on(struct percpu *from, struct percpu *to, struct thread *thread)
+{
+    if (from != to && thread->sched_class->migrate != 0)
+    {
+        thread->sched_class->migrate(from, to, thread);
+    }
+    wakelist_push(to, thread);
+    check_preempt_curr(to, thread);
+}
+
+/**
+ * @brief Move every thread on this CPU's wakelist into its run queue
+ *
+ * Called by the owner from the scheduler loop only, after the previous
+ * thread has been switched out, so a thread that was woken while still
+ * on its way off the CPU is never enqueued twice.
+ */
+static void wakelist_drain(struct percpu *cpu)
+{
+    if (cpu->wake_list == 0)
+    {
+        return;
+    }
+
+    struct thread *list = __sync_lock_test_and_set(&cpu->wake_list, 0);
+
+    // The stack is newest first; reverse it so threads run in wake order
+    struct thread *fifo = 0;
+    while (list != 0)
+    {
+        struct thread *next = list->wake_next;
+        list->wake_next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    acquire_spinlock(&cpu->rq_lock);
+    while (fifo != 0)
+    {
+        struct thread *t = fifo;
+        fifo = t->wake_next;
+        t->wake_next = 0;
+
+        // The affinity changed after the waker chose this CPU
+        if (!cpumask_test_cpu(&t->cpus_allowed, cpu->cpu_index))
         {
-            // Move to next for round-robin
-            cpu->run_queue = current->next;
-            return t;
+            wake_on(cpu, select_cpu(t), t);
+            continue;
+        }
+        runqueue_activate(cpu, t, true);
+        cpu->num_threads++;
+    }
+    release_spinlock(&cpu->rq_lock);
+}
+
+/**
+ * @brief Check whether a pending wakeup beats the current thread
+ *
+ * Runs on the owning CPU, which is the only one that unlinks entries, so
+ * the list can be walked without taking it.
+ */
+static bool wakelist_has_urgent(struct percpu *cpu, struct thread *current)
+{
+    for (struct thread *t = cpu->wake_list; t != 0; t = t->wake_next)
+    {
+        if (thread_preempts(cpu, t, current))
+        {
+            return true;
         }
-        current = current->next;
-    } while (current != start);
+    }
+    return false;
+}
 
-    return 0; // No runnable threads
+/**
+ * @brief Dequeue the thread that should run next
+ *
+ * Only RUNNABLE threads are ever queued. A preempted thread is queued
+ * again by the scheduler loop, which lets its class place it behind its
+ * peers.
+ */
+static struct thread *runqueue_pick_next(struct percpu *cpu)
+{
+    struct thread *t = runqueue_peek(cpu);
+    if (t != 0)
+    {
+        runqueue_dequeue(cpu, t);
+    }
+    return t;
 }
 
 // ============================================================================
 // Scheduler Initialization
 // ============================================================================
 
+/**
+ * @brief Look up a class by the name used on the command line
+ */
+static const struct sched_class *find_class(const char *name)
+{
+    size_t len = strlen(name);
+    for (uint32_t c = 0; c < NR_SCHED_CLASSES; c++)
+    {
+        const char *class_name = sched_classes[c]->name;
+        if (strlen(class_name) == len && memcmp(class_name, name, len) == 0)
+        {
+            return sched_classes[c];
+        }
+    }
+    return 0;
+}
+
 void sched_init(void)
 {
-    init_spinlock(&sched_lock, "sched");
+    // Queues of every CPU must be usable before the APs come up, since
+    // the BSP may place threads on them
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct percpu *cpu = &percpus[i];
+        init_spinlock(&cpu->rq_lock, "runqueue");
+        for (uint32_t c = 0; c < NR_SCHED_CLASSES; c++)
+        {
+            sched_classes[c]->init_rq(cpu);
+        }
+        cpu->nr_queued = 0;
+        lst_init(&cpu->throttled);
+        cpu->nr_throttled = 0;
+        cpu->wake_list = 0;
+        cpu->num_threads = 0;
+        cpu->dead_threads = 0;
+        cpu->nr_dead = 0;
+    }
+
+    // sched=rr|fair picks the class of new threads; real-time classes are
+    // chosen per thread with sched_set_policy()/sched_set_deadline()
+    const char *policy = cmdline_get("sched");
+    if (policy != 0)
+    {
+        const struct sched_class *class = find_class(policy);
+        if (class != 0 && class_rank(class) >= class_rank(&prio_sched_class))
+        {
+            sched_default_class = class;
+        }
+        else
+        {
+            LOG_SERIAL("SCHED", "Unknown sched=%s, keeping %s", policy, sched_default_class->name);
+        }
+    }
+
+    softirq_open(SOFTIRQ_SCHED, sched_balance);
+
     sched_initialized = true;
-    LOG_SERIAL("SCHED", "SMP scheduler initialized");
+    LOG_SERIAL("SCHED", "SMP scheduler initialized, default class %s", sched_default_class->name);
 }
 
 void sched_init_cpu(void)
 {
     struct percpu *cpu = mycpu();
 
-    // Initialize run queue
-    cpu->run_queue = 0;
-    cpu->num_threads = 0;
+    // Run queues were set up by sched_init()
     cpu->scheduler_ready = false;
 
     // Allocate scheduler context
@@ -217,32 +608,40 @@ void sched_add_thread(struct thread *thread, int cpu_index)
         panic("sched_add_thread: null thread");
     }
 
-    acquire_spinlock(&sched_lock);
-
     struct percpu *target_cpu;
 
-    if (cpu_index < 0)
+    if (cpu_index >= 0 && (uint32_t) cpu_index >= ncpu)
     {
-        // Auto-select: find least loaded CPU
-        target_cpu = &percpus[sched_find_least_loaded()];
+        panic("sched_add_thread: invalid cpu_index");
     }
-    else if ((uint32_t) cpu_index >= ncpu)
+
+    if (thread->sched_class == &dl_sched_class)
     {
-        release_spinlock(&sched_lock);
-        panic("sched_add_thread: invalid cpu_index");
+        // Its bandwidth was admitted on this CPU by sched_set_deadline()
+        target_cpu = &percpus[thread->cpu];
+    }
+    else if (cpu_index < 0 || !cpumask_test_cpu(&thread->cpus_allowed, cpu_index))
+    {
+        // Auto-select, or the requested CPU is outside the affinity mask
+        target_cpu = select_cpu(thread);
     }
     else
     {
         target_cpu = &percpus[cpu_index];
     }
 
+    acquire_spinlock(&target_cpu->rq_lock);
+
     thread->state = RUNNABLE;
-    runqueue_add_unlocked(target_cpu, thread);
+    thread->stat_since = rdtsc();
+    runqueue_enqueue(target_cpu, thread);
+    target_cpu->num_threads++;
+    check_preempt_curr(target_cpu, thread);
 
-    LOG_SERIAL("SCHED", "Added thread %p to CPU %d (now has %d threads)",
-               thread, target_cpu->cpu_index, target_cpu->num_threads);
+    LOG_SERIAL("SCHED", "Added thread %p (prio %d) to CPU %d (now has %d threads)",
+               thread, thread->priority, target_cpu->cpu_index, target_cpu->num_threads);
 
-    release_spinlock(&sched_lock);
+    release_spinlock(&target_cpu->rq_lock);
 }
 
 void sched_remove_thread(struct thread *thread)
@@ -252,27 +651,41 @@ void sched_remove_thread(struct thread *thread)
         return;
     }
 
-    acquire_spinlock(&sched_lock);
-
-    // Search all CPUs for this thread
-    for (uint32_t i = 0; i < ncpu; i++)
+    // A queued thread always sits on the CPU recorded in thread->cpu
+    struct percpu *cpu = lock_thread_rq(thread);
+    if (thread_queued(thread))
     {
-        if (runqueue_remove_unlocked(&percpus[i], thread))
-        {
-            LOG_SERIAL("SCHED", "Removed thread %p from CPU %d", thread, i);
-            break;
-        }
+        runqueue_dequeue(cpu, thread);
+        cpu->num_threads--;
+        LOG_SERIAL("SCHED", "Removed thread %p from CPU %d", thread, thread->cpu);
     }
-
-    release_spinlock(&sched_lock);
+    else if (thread->state == THROTTLED)
+    {
+        runqueue_unpark(cpu, thread);
+        thread->state = RUNNABLE;
+        cpu->num_threads--;
+        LOG_SERIAL("SCHED", "Removed throttled thread %p from CPU %d", thread, thread->cpu);
+    }
+    release_spinlock(&cpu->rq_lock);
 }
 
 struct thread *sched_get_next(void)
 {
     struct percpu *cpu = mycpu();
 
+    // Threads woken by other CPUs since the last pick
+    wakelist_drain(cpu);
+
     // Try to get a runnable thread from our queue
-    struct thread *next = runqueue_get_next(cpu);
+    acquire_spinlock(&cpu->rq_lock);
+    struct thread *next = runqueue_pick_next(cpu);
+    release_spinlock(&cpu->rq_lock);
+
+    // Nothing local: pull work from the busiest sibling before idling
+    if (next == 0)
+    {
+        next = sched_steal(cpu);
+    }
 
     if (next != 0)
     {
@@ -283,48 +696,377 @@ struct thread *sched_get_next(void)
     return cpu->idle_thread;
 }
 
-// ============================================================================
-// Context Switching
-// ============================================================================
-
-void sched_yield(void)
+void sched_set_priority(struct thread *thread, int priority)
 {
-    struct percpu *cpu = mycpu();
-    struct thread *current = cpu->current_thread;
-
-    if (current == 0 || current == cpu->idle_thread)
+    if (priority < 0 || priority >= THREAD_PRIO_LEVELS)
     {
-        return; // Nothing to yield from
+        panic("sched_set_priority: invalid priority");
     }
 
-    // Mark as runnable (will be picked up again)
-    current->state = RUNNABLE;
-
-    // Switch to scheduler context
-    switch_context(&current->context, cpu->scheduler_ctx);
+    struct percpu *cpu = lock_thread_rq(thread);
+    if (thread_queued(thread))
+    {
+        runqueue_dequeue(cpu, thread);
+        thread->priority = priority;
+        runqueue_enqueue(cpu, thread);
+    }
+    else
+    {
+        thread->priority = priority;
+    }
+    release_spinlock(&cpu->rq_lock);
 }
 
 /**
- * @brief Exit the current thread
- * 
- * Removes the current thread from the run queue and switches
+ * @brief Take a thread out of its class (caller holds cpu->rq_lock)
+ *
+ * Runtime used so far is charged to the class first, and the class drops
+ * any per-thread state such as a bandwidth reservation.
+ *
+ * @return Whether the thread was queued or throttled and must be requeued
+ */
+static bool class_leave(struct percpu *cpu, struct thread *thread)
+{
+    bool requeue = false;
+
+    if (thread_queued(thread))
+    {
+        runqueue_dequeue(cpu, thread);
+        requeue = true;
+    }
+    else if (thread->state == THROTTLED)
+    {
+        runqueue_unpark(cpu, thread);
+        thread->state = RUNNABLE;
+        requeue = true;
+    }
+    else if (thread->state == ON_CPU)
+    {
+        update_curr(cpu, thread);
+    }
+
+    if (thread->sched_class->detach != 0)
+    {
+        thread->sched_class->detach(cpu, thread);
+    }
+    return requeue;
+}
+
+/**
+ * @brief Put a thread taken out by class_leave() into a class
+ */
+static void class_enter(struct percpu *cpu, struct thread *thread,
+                        const struct sched_class *class, enum sched_policy policy, bool requeue)
+{
+    thread->sched_class = class;
+    thread->policy = policy;
+    if (requeue)
+    {
+        runqueue_activate(cpu, thread, false);
+        if (thread->state == RUNNABLE)
+        {
+            check_preempt_curr(cpu, thread);
+        }
+    }
+}
+
+void sched_set_policy(struct thread *thread, enum sched_policy policy, int priority)
+{
+    if (priority < 0 || priority >= THREAD_PRIO_LEVELS)
+    {
+        panic("sched_set_policy: invalid priority");
+    }
+    if (policy == SCHED_DEADLINE)
+    {
+        panic("sched_set_policy: use sched_set_deadline");
+    }
+
+    const struct sched_class *class = policy == SCHED_NORMAL ? sched_default_class : &rt_sched_class;
+    struct percpu *cpu = lock_thread_rq(thread);
+    bool requeue = class_leave(cpu, thread);
+    thread->priority = priority;
+    class_enter(cpu, thread, class, policy, requeue);
+    release_spinlock(&cpu->rq_lock);
+}
+
+bool sched_set_deadline(struct thread *thread, uint64_t runtime_us, uint64_t deadline_us,
+                        uint64_t period_us)
+{
+    if (runtime_us == 0 || runtime_us > deadline_us || deadline_us > period_us ||
+        period_us > SCHED_DL_PERIOD_MAX_US)
+    {
+        LOG_SERIAL("SCHED", "Rejected deadline parameters %llu/%llu/%llu us",
+                   runtime_us, deadline_us, period_us);
+        return false;
+    }
+
+    // Reserved by density, which is the utilization when deadline == period
+    uint64_t bw = (runtime_us << SCHED_DL_BW_SHIFT) / deadline_us;
+    uint64_t tsc_per_ms = clockevent_tsc_per_ms();
+
+    struct percpu *cpu = lock_thread_rq(thread);
+    if (!cpumask_test_cpu(&thread->cpus_allowed, cpu->cpu_index))
+    {
+        release_spinlock(&cpu->rq_lock);
+        LOG_SERIAL("SCHED", "Rejected deadline thread %p: CPU %d is outside its affinity",
+                   thread, cpu->cpu_index);
+        return false;
+    }
+
+    // Admission control: under EDF the deadlines of every admitted thread
+    // can be met as long as the summed densities on the CPU stay at or
+    // below 1, also when deadlines are shorter than periods; the limit
+    // keeps some of the CPU for the other classes
+    uint64_t own_bw = thread->sched_class == &dl_sched_class ? thread->dl_bw : 0;
+    if (cpu->dl.total_bw - own_bw + bw > SCHED_DL_BW_LIMIT)
+    {
+        release_spinlock(&cpu->rq_lock);
+        LOG_SERIAL("SCHED", "Deadline admission failed on CPU %d: %llu/%llu us would exceed %d%%",
+                   cpu->cpu_index, runtime_us, deadline_us,
+                   (int) ((SCHED_DL_BW_LIMIT * 100) >> SCHED_DL_BW_SHIFT));
+        return false;
+    }
+
+    // Parameters change off the queue, after any previous reservation
+    // has been released
+    bool requeue = class_leave(cpu, thread);
+    thread->dl_runtime = runtime_us * tsc_per_ms / 1000;
+    thread->dl_deadline = deadline_us * tsc_per_ms / 1000;
+    thread->dl_period = period_us * tsc_per_ms / 1000;
+    thread->dl_bw = bw;
+    thread->dl_budget = (int64_t) thread->dl_runtime;
+    thread->dl_abs_deadline = rdtsc() + thread->dl_deadline;
+    cpu->dl.total_bw += bw;
+    class_enter(cpu, thread, &dl_sched_class, SCHED_DEADLINE, requeue);
+
+    release_spinlock(&cpu->rq_lock);
+    return true;
+}
+
+bool sched_set_affinity(struct thread *thread, const struct cpumask *mask)
+{
+    if (cpumask_first(mask, ncpu) == ncpu)
+    {
+        LOG_SERIAL("SCHED", "Rejected affinity for thread %p: no usable CPU", thread);
+        return false;
+    }
+
+    struct percpu *cpu = lock_thread_rq(thread);
+    if (thread->sched_class == &dl_sched_class && !cpumask_test_cpu(mask, cpu->cpu_index))
+    {
+        // The bandwidth is reserved on this CPU and cannot follow
+        release_spinlock(&cpu->rq_lock);
+        LOG_SERIAL("SCHED", "Rejected affinity for deadline thread %p on CPU %d",
+                   thread, cpu->cpu_index);
+        return false;
+    }
+
+    thread->cpus_allowed = *mask;
+    bool move_self = false;
+    if (!cpumask_test_cpu(mask, cpu->cpu_index))
+    {
+        if (thread_queued(thread))
+        {
+            // Handed over like a wakeup, so only the target's owner ever
+            // takes its run-queue lock
+            runqueue_dequeue(cpu, thread);
+            cpu->num_threads--;
+            thread->state = WAKING;
+            wake_on(cpu, select_cpu(thread), thread);
+        }
+        else if (thread->state == ON_CPU)
+        {
+            // sched_run() moves it as soon as it leaves the CPU
+            if (thread == mycpu()->current_thread)
+            {
+                move_self = true;
+            }
+            else
+            {
+                cpu->need_resched = true;
+                send_resched_ipi(cpu);
+            }
+        }
+        // Blocked and waking threads are placed by their wakeup
+    }
+    release_spinlock(&cpu->rq_lock);
+
+    if (move_self)
+    {
+        sched_yield();
+    }
+    return true;
+}
+
+void sched_block_unless(bool (*ready)(void *), void *arg)
+{
+    // A tick between marking WAIT and switching would preempt the thread
+    // as RUNNABLE and lose the block
+    uint64_t eflags = read_eflags();
+    cli();
+
+    struct percpu *cpu = mycpu();
+    struct thread *current = cpu->current_thread;
+
+    if (current == 0 || current == cpu->idle_thread)
+    {
+        panic("sched_block: no thread to block");
+    }
+    // A held spinlock or a preempt_disable() section would stay held by a
+    // thread that is not running, and deadlock whoever wakes it
+    if (cpu->ncli != 0 || cpu->preempt_count != 0)
+    {
+        panic("sched_block: called in atomic context");
+    }
+
+    // Not re-enqueued by the scheduler until sched_wakeup(). WAIT goes up
+    // before the condition is read: a waker that sets it afterwards sees
+    // WAIT and queues the thread, which then only passes through here.
+    current->stat_since = rdtsc();
+    current->state = WAIT;
+    __sync_synchronize();
+
+    if (ready == 0 || !ready(arg) || !__sync_bool_compare_and_swap(&current->state, WAIT, ON_CPU))
+    {
+        switch_context(&current->context, cpu->scheduler_ctx);
+    }
+
+    // The caller's interrupt flag, whichever way the switch left it
+    if (eflags & FL_IF)
+    {
+        sti();
+    }
+    else
+    {
+        cli();
+    }
+}
+
+void sched_block(void)
+{
+    sched_block_unless(0, 0);
+}
+
+void sched_wakeup(struct thread *thread)
+{
+    pushcli();
+    struct percpu *self = mycpu();
+
+    if (thread == self->current_thread)
+    {
+        // Woken before it switched out (e.g. from an interrupt): the
+        // scheduler loop re-enqueues it as an ordinary yield
+        __sync_bool_compare_and_swap(&thread->state, WAIT, RUNNABLE);
+    }
+    else if (__sync_bool_compare_and_swap(&thread->state, WAIT, WAKING))
+    {
+        // A blocked thread is not queued, so its cpu field is stable. The
+        // owner enqueues it at its next scheduling point without anyone
+        // touching its run-queue lock from here.
+        uint64_t now = rdtsc();
+        thread->blocked_time += now - thread->stat_since;
+        thread->stat_since = now;
+
+        struct percpu *cpu = &percpus[thread->cpu];
+        struct percpu *target = cpu;
+        if (thread->on_cpu)
+        {
+            // Still switching out: only its own CPU knows when the context
+            // is saved, and forwards it from the wakelist if need be
+        }
+        else if (thread->sched_class != &dl_sched_class)
+        {
+            // Deadline threads stay where their bandwidth is reserved
+            target = select_cpu(thread);
+        }
+
+        self->wake_placements++;
+        if (target->cpu_index != thread->last_cpu)
+        {
+            self->wake_migrations++;
+        }
+        else if (cache_hot(thread, now))
+        {
+            self->wake_hot_hits++;
+        }
+        wake_on(cpu, target, thread);
+    }
+
+    popcli();
+}
+
+// ============================================================================
+// Context Switching
+// ============================================================================
+
+void sched_yield(void)
+{
+    // A preempted thread may be stolen by another CPU; until it is marked
+    // RUNNABLE below, only disabled interrupts keep it on this one
+    uint64_t eflags = read_eflags();
+    cli();
+
+    struct percpu *cpu = mycpu();
+    struct thread *current = cpu->current_thread;
+
+    if (current == 0 || current == cpu->idle_thread)
+    {
+        if (eflags & FL_IF)
+        {
+            sti();
+        }
+        return; // Nothing to yield from
+    }
+
+    // Mark as runnable (will be picked up again)
+    current->state = RUNNABLE;
+    cpu->need_resched = false;
+
+    if (current->sched_class->yield != 0)
+    {
+        acquire_spinlock(&cpu->rq_lock);
+        update_curr(cpu, current);
+        current->sched_class->yield(cpu, current);
+        release_spinlock(&cpu->rq_lock);
+    }
+
+    // Switch to scheduler context; the scheduler resumes threads with
+    // interrupts off
+    switch_context(&current->context, cpu->scheduler_ctx);
+
+    if (eflags & FL_IF)
+    {
+        sti();
+    }
+}
+
+/**
+ * @brief Exit the current thread
+ * 
+ * Removes the current thread from the run queue and switches
  * to the scheduler. The thread will never run again.
  */
 void sched_exit(void)
 {
+    // Stay on this CPU until the scheduler has taken the thread off it,
+    // as in sched_yield()
+    uint64_t eflags = read_eflags();
+    cli();
+
     struct percpu *cpu = mycpu();
     struct thread *current = cpu->current_thread;
 
     if (current == 0 || current == cpu->idle_thread)
     {
+        if (eflags & FL_IF)
+        {
+            sti();
+        }
         return; // Can't exit idle thread
     }
 
-    // Mark as exited
+    // Mark as exited; the scheduler loop drops it instead of re-enqueueing
     current->state = EXIT;
-    
-    // Remove from run queue
-    runqueue_remove_unlocked(cpu, current);
     cpu->current_thread = 0;
 
     LOG_SERIAL("SCHED", "Thread %p exited on CPU %d", current, cpu->cpu_index);
@@ -336,6 +1078,42 @@ void sched_exit(void)
     panic("sched_exit returned");
 }
 
+/**
+ * @brief Recycle the threads that exited on this CPU
+ *
+ * Deferred from the exit path so an exiting thread only costs a list
+ * push; run by the scheduler loop when a batch has piled up or the CPU
+ * has nothing else queued.
+ */
+static void reap_dead_threads(struct percpu *cpu)
+{
+    struct thread *list = cpu->dead_threads;
+    cpu->dead_threads = 0;
+    cpu->nr_dead = 0;
+
+    while (list != 0)
+    {
+        struct thread *t = list;
+        list = t->wake_next;
+        release_thread(t);
+        cpu->threads_reaped++;
+    }
+}
+
+/**
+ * @brief Histogram bucket of a queue depth, see SCHED_QDEPTH_BUCKETS
+ */
+static uint32_t qdepth_bucket(uint32_t depth)
+{
+    uint32_t bucket = 0;
+    while (depth != 0 && bucket < SCHED_QDEPTH_BUCKETS - 1)
+    {
+        depth >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
 void sched_run(void)
 {
     struct percpu *cpu = mycpu();
@@ -354,24 +1132,127 @@ void sched_run(void)
             // LOG_SERIAL("SCHED", "CPU %d switching to thread %p, context=%p, rip=%p", 
             //            cpu->cpu_index, next, next->context, 
             //            next->context ? next->context->rip : 0);
+
+            // Still on the scheduler stack: an interrupt that saw next as
+            // the running thread would preempt it and save this stack as
+            // its context. Threads re-enable interrupts once switched in.
+            cli();
             cpu->current_thread = next;
+            cpu->slice_ticks = 0;
+            cpu->need_resched = false;
             next->state = ON_CPU;
+            next->on_cpu = true;
+            next->exec_start = rdtsc();
+            next->slice_start = next->sum_exec_runtime;
+
+            if (next != cpu->idle_thread)
+            {
+                next->run_delay += next->exec_start - next->stat_since;
+                if (next->last_ran != 0 && next->last_cpu != cpu->cpu_index)
+                {
+                    next->nr_migrations++;
+                }
+            }
+            cpu->qdepth_hist[qdepth_bucket(cpu->nr_queued)]++;
+            uint64_t preemptions = cpu->preemptions;
+
+            if (next->wake_tsc != 0)
+            {
+                uint64_t latency = rdtsc() - next->wake_tsc;
+                next->wake_tsc = 0;
+                cpu->wake_latency_count++;
+                cpu->wake_latency_total += latency;
+                if (latency > cpu->wake_latency_max)
+                {
+                    cpu->wake_latency_max = latency;
+                }
+            }
+
             switch_context(&cpu->scheduler_ctx, next->context);
+
+            // Back on the scheduler stack, with interrupts off as every
+            // thread switches out that way; no thread owns the CPU until
+            // the next pick
+            cpu->current_thread = 0;
+
+            // Before any other thread can fault its own state in
+            fpu_switch_out(cpu, next);
+
+            uint64_t now = rdtsc();
+            if (next == cpu->idle_thread)
+            {
+                cpu->idle_time += now - next->exec_start;
+            }
+            else
+            {
+                // Put a preempted or yielding thread back in its class's
+                // queue, or park it if it ran out of budget; blocked and
+                // exited threads leave the queue. A thread woken while
+                // switching out is WAKING and sits on the wakelist, drained
+                // by the next sched_get_next().
+                acquire_spinlock(&cpu->rq_lock);
+                update_curr(cpu, next);
+                cpu->nr_switches++;
+                next->last_cpu = cpu->cpu_index;
+                next->last_ran = next->exec_start;
+                if (cpu->preemptions != preemptions)
+                {
+                    next->nr_involuntary++;
+                }
+                else
+                {
+                    next->nr_voluntary++;
+                }
+                if (next->state == RUNNABLE)
+                {
+                    // Preempted or yielded; blocked threads started their
+                    // clock in sched_block_unless()
+                    next->stat_since = now;
+                }
+                if (next->state == RUNNABLE && !cpumask_test_cpu(&next->cpus_allowed, cpu->cpu_index))
+                {
+                    // Its affinity changed while it ran
+                    next->state = WAKING;
+                    cpu->num_threads--;
+                    wake_on(cpu, select_cpu(next), next);
+                }
+                else if (next->state == RUNNABLE)
+                {
+                    runqueue_activate(cpu, next, false);
+                }
+                else
+                {
+                    if (next->state == EXIT)
+                    {
+                        if (next->sched_class->detach != 0)
+                        {
+                            next->sched_class->detach(cpu, next);
+                        }
+
+                        // Off its stack for good; recycled by the reaper
+                        next->wake_next = cpu->dead_threads;
+                        cpu->dead_threads = next;
+                        cpu->nr_dead++;
+                    }
+                    cpu->num_threads--;
+                }
+                release_spinlock(&cpu->rq_lock);
+            }
+
+            // The context is saved; wakers may now send it anywhere
+            __sync_synchronize();
+            next->on_cpu = false;
+
+            if (cpu->nr_dead >= SCHED_REAP_BATCH || (cpu->nr_dead != 0 && cpu->nr_queued == 0))
+            {
+                reap_dead_threads(cpu);
+            }
         }
     }
 }
 
 void sched_tick(void)
 {
-    // NOTE: Context switching from interrupt handlers is unsafe because
-    // switch_context uses 'ret' instead of 'iret', leaving the interrupt
-    // frame on the stack and corrupting CPU state.
-    //
-    // This function only handles waking up from idle when new work is available.
-    // Preemption must happen via cooperative sched_yield() from thread context.
-    //
-    // TODO: Implement proper trap-frame based preemption if needed.
-    
     struct percpu *cpu = mycpu();
 
     if (!cpu->scheduler_ready)
@@ -379,92 +1260,363 @@ void sched_tick(void)
         return;
     }
 
-    // For now, just track that timer is firing - no preemption from interrupt
-    // The idle thread loop handles checking for new work after each HLT
+    // Staggered by CPU index so the CPUs do not all balance on the same
+    // tick; the pass runs after the interrupt with interrupts enabled
+    if ((cpu->timer_ticks + cpu->cpu_index) % SCHED_BALANCE_INTERVAL == 0)
+    {
+        softirq_raise(SOFTIRQ_SCHED);
+    }
+
+    // Refill throttled threads even while idle, they wait for the tick
+    if (cpu->nr_throttled != 0)
+    {
+        acquire_spinlock(&cpu->rq_lock);
+        runqueue_unthrottle(cpu);
+        release_spinlock(&cpu->rq_lock);
+    }
+
+    struct thread *current = cpu->current_thread;
+    if (current == 0 || current == cpu->idle_thread)
+    {
+        return; // Idle yields on its own after every HLT
+    }
+
+    // Interrupts are off, so the lock cannot be held by the code we interrupted
+    acquire_spinlock(&cpu->rq_lock);
+    update_curr(cpu, current);
+    bool expired = current->sched_class->tick(cpu, current);
+    release_spinlock(&cpu->rq_lock);
+
+    if (expired || wakelist_has_urgent(cpu, current))
+    {
+        cpu->need_resched = true;
+    }
+}
+
+bool sched_need_preempt(void)
+{
+    struct percpu *cpu = mycpu();
+    struct thread *current = cpu->current_thread;
+
+    return cpu->need_resched && cpu->preempt_count == 0 && cpu->ncli == 0 &&
+           current != 0 && current != cpu->idle_thread && current->state == ON_CPU;
+}
+
+void sched_resched_interrupt(void)
+{
+    struct percpu *cpu = mycpu();
+
+    cpu->resched_ipis++;
+    cpu->ipi_pending = false;
+    lapic_eoi();
+
+    // An idle CPU leaves HLT and yields on its own; a busy one switches on
+    // the way out of trap() if the woken thread is more urgent
+    struct thread *current = cpu->current_thread;
+    if (current == 0 || current == cpu->idle_thread)
+    {
+        return;
+    }
+    acquire_spinlock(&cpu->rq_lock);
+    struct thread *best = runqueue_peek(cpu);
+    bool urgent = best != 0 && thread_preempts(cpu, best, current);
+    release_spinlock(&cpu->rq_lock);
+
+    if (urgent || wakelist_has_urgent(cpu, current))
+    {
+        cpu->need_resched = true;
+    }
+}
+
+void sched_set_resched_ipi(bool enabled)
+{
+    sched_resched_ipi = enabled;
+    LOG_SERIAL("SCHED", "Reschedule IPIs %s", enabled ? "enabled" : "disabled");
+}
+
+void sched_set_cache_hot(uint64_t us)
+{
+    sched_cache_hot_us = us;
+    LOG_SERIAL("SCHED", "Cache-hot window %llu us", us);
+}
+
+void sched_preempt(void)
+{
+    struct percpu *cpu = mycpu();
+    struct thread *current = cpu->current_thread;
+
+    cpu->need_resched = false;
+    cpu->preemptions++;
+    current->state = RUNNABLE;
+
+    // The trap frame stays on this thread's stack; switch_context returns
+    // here when the thread is picked again and trap() finishes with iretq
+    switch_context(&current->context, cpu->scheduler_ctx);
+
+    // The scheduler loop runs with interrupts on, but the rest of the
+    // interrupt return path must not be interrupted again
+    cli();
 }
 
 // ============================================================================
 // Load Balancing
 // ============================================================================
 
-uint32_t sched_find_least_loaded(void)
+/**
+ * @brief Whether a CPU and all its SMT siblings have no threads
+ */
+static bool core_idle(uint32_t index)
 {
-    uint32_t min_load = UINT32_MAX;
-    uint32_t min_cpu = 0;
-
+    const struct cpumask *siblings = &cpu_topology[index].siblings;
     for (uint32_t i = 0; i < ncpu; i++)
     {
-        if (percpus[i].started && percpus[i].num_threads < min_load)
+        if (cpumask_test_cpu(siblings, i) && percpus[i].num_threads != 0)
         {
-            min_load = percpus[i].num_threads;
-            min_cpu = i;
+            return false;
         }
     }
-
-    return min_cpu;
+    return percpus[index].num_threads == 0;
 }
 
-void sched_balance(void)
+uint32_t sched_find_least_loaded(const struct cpumask *allowed)
 {
-    // Find max and min loaded CPUs
-    uint32_t max_load = 0, min_load = UINT32_MAX;
-    uint32_t max_cpu = 0, min_cpu = 0;
+    uint32_t best_rank = UINT32_MAX;
+    uint32_t best_cpu = cpumask_first(allowed, ncpu);
 
+    // A CPU whose whole core is idle beats an idle hardware thread next
+    // to a busy one, which beats the least loaded busy CPU
     for (uint32_t i = 0; i < ncpu; i++)
     {
-        if (!percpus[i].started)
+        if (!percpus[i].started || !cpumask_test_cpu(allowed, i))
             continue;
 
         uint32_t load = percpus[i].num_threads;
-        if (load > max_load)
+        uint32_t rank = load != 0 ? 2 + load : core_idle(i) ? 0 : 1;
+        if (rank < best_rank)
         {
-            max_load = load;
-            max_cpu = i;
+            best_rank = rank;
+            best_cpu = i;
         }
-        if (load < min_load)
+    }
+
+    // An empty mask is refused by sched_set_affinity(); fall back to the BSP
+    return best_cpu < ncpu ? best_cpu : 0;
+}
+
+/**
+ * @brief Whether a thread's cache is likely still warm on its last CPU
+ */
+static bool cache_hot(struct thread *thread, uint64_t now)
+{
+    uint64_t window = sched_cache_hot_us * clockevent_tsc_per_ms() / 1000;
+    return thread->last_ran != 0 && now - thread->last_ran < window;
+}
+
+/**
+ * @brief CPU to place a thread on
+ *
+ * A thread goes back to the CPU it last ran on while it is cache-hot
+ * there or that CPU is idle. Otherwise an idle CPU sharing the last CPU's
+ * cache comes first, then the pick of sched_find_least_loaded().
+ */
+static struct percpu *select_cpu(struct thread *thread)
+{
+    uint32_t prev = thread->last_cpu;
+
+    if (thread->last_ran != 0 && cpumask_test_cpu(&thread->cpus_allowed, prev))
+    {
+        if (cache_hot(thread, rdtsc()) || percpus[prev].num_threads == 0)
         {
-            min_load = load;
-            min_cpu = i;
+            return &percpus[prev];
+        }
+
+        const struct cpumask *llc = topology_llc_span(prev);
+        if (llc != 0)
+        {
+            struct cpumask near;
+            cpumask_and(&near, llc, &thread->cpus_allowed);
+            uint32_t index = sched_find_least_loaded(&near);
+            if (cpumask_test_cpu(&near, index) && percpus[index].num_threads == 0)
+            {
+                return &percpus[index];
+            }
         }
     }
 
-    // Check if balancing is needed
-    if (max_load - min_load < LOAD_BALANCE_THRESHOLD)
+    return &percpus[sched_find_least_loaded(&thread->cpus_allowed)];
+}
+
+/**
+ * @brief Find the started CPU in span, other than self, with the most threads
+ *
+ * Only CPUs with queued threads count. Reads the counters without locks;
+ * the result is only a hint and is re-checked under the victim's lock.
+ *
+ * @param span CPUs to consider, NULL for all
+ */
+static struct percpu *find_busiest(struct percpu *self, const struct cpumask *span,
+                                   uint32_t *load_out)
+{
+    struct percpu *busiest = 0;
+    uint32_t max_load = 0;
+
+    for (uint32_t i = 0; i < ncpu; i++)
     {
-        return;
+        struct percpu *cpu = &percpus[i];
+        if (cpu == self || !cpu->started || cpu->nr_queued == 0)
+            continue;
+        if (span != 0 && !cpumask_test_cpu(span, i))
+            continue;
+
+        if (cpu->num_threads > max_load)
+        {
+            max_load = cpu->num_threads;
+            busiest = cpu;
+        }
     }
 
-    acquire_spinlock(&sched_lock);
+    *load_out = max_load;
+    return busiest;
+}
 
-    // Migrate one thread from max to min
-    struct percpu *src = &percpus[max_cpu];
-    struct percpu *dst = &percpus[min_cpu];
+/**
+ * @brief Pull the most urgent movable thread from victim to run it here
+ */
+static struct thread *steal_from(struct percpu *cpu, struct percpu *victim)
+{
+    // Local lock first, victim only by trylock: two CPUs stealing from each
+    // other back off instead of deadlocking
+    acquire_spinlock(&cpu->rq_lock);
+    if (!try_acquire_spinlock(&victim->rq_lock))
+    {
+        release_spinlock(&cpu->rq_lock);
+        return 0;
+    }
 
-    if (src->run_queue != 0 && src->num_threads > 1)
+    // The most urgent waiting thread that may move is the one worth
+    // running here
+    struct thread *t = runqueue_peek_steal(victim, cpu->cpu_index);
+    if (t != 0)
     {
-        // Find a migratable thread
-        struct thread_node *start = src->run_queue;
-        struct thread_node *current = start;
+        runqueue_dequeue(victim, t);
+        victim->num_threads--;
+        if (t->sched_class->migrate != 0)
+        {
+            t->sched_class->migrate(victim, cpu, t);
+        }
 
-        do
+        t->cpu = cpu->cpu_index;
+        cpu->num_threads++;
+        cpu->steals++;
+    }
+
+    release_spinlock(&victim->rq_lock);
+    release_spinlock(&cpu->rq_lock);
+    return t;
+}
+
+static struct thread *sched_steal(struct percpu *cpu)
+{
+    struct cpu_topology *topo = &cpu_topology[cpu->cpu_index];
+    uint32_t load;
+
+    // Look for work close by first, where the thread's cache is still warm
+    for (uint32_t d = 0; d < topo->nr_domains; d++)
+    {
+        struct percpu *victim = find_busiest(cpu, &topo->domains[d].span, &load);
+        if (victim != 0)
         {
-            struct thread *t = current->data;
-            if (t != src->current_thread &&
-                t != src->idle_thread &&
-                t->state == RUNNABLE)
+            struct thread *t = steal_from(cpu, victim);
+            if (t != 0)
             {
-                // Migrate this thread
-                runqueue_remove_unlocked(src, t);
-                runqueue_add_unlocked(dst, t);
-                LOG_SERIAL("SCHED", "Migrated thread %p from CPU %d to CPU %d",
-                           t, max_cpu, min_cpu);
-                break;
+                return t;
             }
-            current = current->next;
-        } while (current != start);
+        }
+    }
+
+    // Domains are not built yet, or every CPU is outside them
+    struct percpu *victim = find_busiest(cpu, 0, &load);
+    return victim != 0 ? steal_from(cpu, victim) : 0;
+}
+
+/**
+ * @brief Pull one thread into this CPU from the busiest CPU in span
+ *
+ * @param imbalance Thread count difference needed for a migration
+ * @return true if a thread was moved
+ */
+static bool balance_span(struct percpu *cpu, const struct cpumask *span, uint32_t imbalance)
+{
+    uint32_t busiest_load;
+    struct percpu *busiest = find_busiest(cpu, span, &busiest_load);
+
+    // Moving one thread only helps if it does not just flip the imbalance;
+    // the threshold keeps two CPUs from passing a thread back and forth
+    if (busiest == 0 || busiest_load < cpu->num_threads + imbalance)
+    {
+        return false;
+    }
+
+    acquire_spinlock(&cpu->rq_lock);
+    if (!try_acquire_spinlock(&busiest->rq_lock))
+    {
+        release_spinlock(&cpu->rq_lock);
+        return false;
+    }
+
+    // Migrate the least urgent waiting thread allowed here; queued threads
+    // are all RUNNABLE and not on a CPU
+    struct thread *t = runqueue_peek_migrate(busiest, cpu->cpu_index);
+    bool moved = t != 0 && busiest->num_threads >= cpu->num_threads + imbalance;
+
+    // A thread that just ran would refill its cache here; only worth it
+    // when the imbalance is large
+    if (moved && cache_hot(t, rdtsc()) && busiest->num_threads < cpu->num_threads + 2 * imbalance)
+    {
+        moved = false;
+        cpu->balance_hot_skips++;
+    }
+
+    if (moved)
+    {
+        runqueue_dequeue(busiest, t);
+        busiest->num_threads--;
+        if (t->sched_class->migrate != 0)
+        {
+            t->sched_class->migrate(busiest, cpu, t);
+        }
+        runqueue_enqueue(cpu, t);
+        cpu->num_threads++;
+        cpu->migrations++;
+    }
+
+    release_spinlock(&busiest->rq_lock);
+    release_spinlock(&cpu->rq_lock);
+    return moved;
+}
+
+void sched_balance(void)
+{
+    struct percpu *cpu = mycpu();
+    struct cpu_topology *topo = &cpu_topology[cpu->cpu_index];
+
+    if (topo->nr_domains == 0)
+    {
+        balance_span(cpu, 0, LOAD_BALANCE_THRESHOLD);
+        return;
     }
 
-    release_spinlock(&sched_lock);
+    // Innermost domain first; outer domains, where a move costs more
+    // cache, are balanced on every interval-th pass only
+    uint64_t pass = (cpu->timer_ticks + cpu->cpu_index) / SCHED_BALANCE_INTERVAL;
+    for (uint32_t d = 0; d < topo->nr_domains; d++)
+    {
+        struct sched_domain *sd = &topo->domains[d];
+        if (pass % sd->interval != 0)
+            continue;
+        if (balance_span(cpu, &sd->span, sd->imbalance))
+            return;
+    }
 }
 
 // ============================================================================
@@ -474,6 +1626,9 @@ void sched_balance(void)
 void sched_log_state(void)
 {
     LOG_SERIAL("SCHED", "=== Scheduler State ===");
+    LOG_SERIAL("SCHED", "Default class: %s", sched_default_class->name);
+
+    uint64_t switches = 0, moves = 0, wakeups = 0, hot_hits = 0;
 
     for (uint32_t i = 0; i < ncpu; i++)
     {
@@ -481,9 +1636,81 @@ void sched_log_state(void)
         if (!cpu->started)
             continue;
 
-        LOG_SERIAL("SCHED", "CPU %d: %d threads, current=%p, ready=%d",
-                   i, cpu->num_threads, cpu->current_thread, cpu->scheduler_ready);
+        LOG_SERIAL("SCHED", "CPU %d: %d threads, current=%p, ready=%d, preemptions=%llu, "
+                   "steals=%llu, migrations=%llu",
+                   i, cpu->num_threads, cpu->current_thread, cpu->scheduler_ready,
+                   cpu->preemptions, cpu->steals, cpu->migrations);
+
+        LOG_SERIAL("SCHED", "CPU %d: deadline bandwidth %llu%%, %d deadline and %d throttled threads",
+                   i, (cpu->dl.total_bw * 100) >> SCHED_DL_BW_SHIFT, cpu->dl.nr_running,
+                   cpu->nr_throttled);
+
+        uint64_t avg = cpu->wake_latency_count ? cpu->wake_latency_total / cpu->wake_latency_count : 0;
+        LOG_SERIAL("SCHED", "CPU %d: resched IPIs=%llu, wakeup latency avg/max=%llu/%llu cycles "
+                   "over %llu wakeups",
+                   i, cpu->resched_ipis, avg, cpu->wake_latency_max, cpu->wake_latency_count);
+
+        LOG_SERIAL("SCHED", "CPU %d: %llu threads reaped, %llu created from the pool, %d pooled",
+                   i, cpu->threads_reaped, cpu->threads_reused, cpu->nr_pooled);
+
+        LOG_SERIAL("SCHED", "CPU %d: %llu FPU states loaded, %llu saved",
+                   i, cpu->fpu_traps, cpu->fpu_saves);
+
+        LOG_SERIAL("SCHED", "CPU %d: %llu switches, woke %llu threads (%llu cache-hot, %llu moved), "
+                   "%llu hot threads kept by balancing",
+                   i, cpu->nr_switches, cpu->wake_placements, cpu->wake_hot_hits,
+                   cpu->wake_migrations, cpu->balance_hot_skips);
+
+        switches += cpu->nr_switches;
+        moves += cpu->steals + cpu->migrations + cpu->wake_migrations;
+        wakeups += cpu->wake_placements;
+        hot_hits += cpu->wake_hot_hits;
     }
 
+    LOG_SERIAL("SCHED", "Migration rate %llu per 1000 switches, cache-hot hit ratio %llu%% of %llu wakeups",
+               switches ? moves * 1000 / switches : 0, wakeups ? hot_hits * 100 / wakeups : 0, wakeups);
+
     LOG_SERIAL("SCHED", "=======================");
 }
+
+void sched_dump_stats(void)
+{
+    LOG_SERIAL("SCHEDSTAT", "version=1 tsc_per_ms=%llu cpus=%d", clockevent_tsc_per_ms(), ncpu);
+
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct percpu *cpu = &percpus[i];
+        if (!cpu->started)
+            continue;
+
+        // Comma-separated buckets, as many as SCHED_QDEPTH_BUCKETS says;
+        // up to 20 decimal digits and a separator or the NUL each
+        char qdepth[SCHED_QDEPTH_BUCKETS * 21];
+        int len = 0;
+        for (int b = 0; b < SCHED_QDEPTH_BUCKETS; b++)
+        {
+            if (b != 0)
+            {
+                qdepth[len++] = ',';
+            }
+            len += utoa64(cpu->qdepth_hist[b], &qdepth[len], 10, 0);
+        }
+        qdepth[len] = '\0';
+
+        // Threads that moved onto this CPU, by stealing or balancing; the
+        // wakeups it sent elsewhere are counted apart, on the waker
+        LOG_SERIAL("SCHEDSTAT", "cpu=%d idle=%llu switches=%llu preemptions=%llu migrations=%llu "
+                   "wake_migrations=%llu qdepth=%s",
+                   i, cpu->idle_time, cpu->nr_switches, cpu->preemptions,
+                   cpu->steals + cpu->migrations, cpu->wake_migrations, qdepth);
+    }
+}
+
+void sched_dump_thread_stats(struct thread *thread)
+{
+    LOG_SERIAL("SCHEDSTAT", "thread=%p cpu=%d state=%d run=%llu delay=%llu blocked=%llu "
+               "voluntary=%llu involuntary=%llu migrations=%llu",
+               thread, thread->last_cpu, thread->state, thread->sum_exec_runtime,
+               thread->run_delay, thread->blocked_time, thread->nr_voluntary,
+               thread->nr_involuntary, thread->nr_migrations);
+}
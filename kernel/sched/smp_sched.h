@@ -20,19 +20,34 @@
 // Time slice for round-robin scheduling (number of timer ticks)
 #define SCHED_TIME_SLICE 5
 
-// Load balancing threshold - trigger migration if difference exceeds this
+// Load balancing threshold - pull a thread only if the busiest CPU has at
+// least this many more threads than the local one
 #define LOAD_BALANCE_THRESHOLD 2
 
+// Timer ticks between periodic load balancing passes on each CPU
+#define SCHED_BALANCE_INTERVAL 100
+
+// Exited threads a busy CPU collects before reaping them; a CPU about to
+// idle reaps whatever it has
+#define SCHED_REAP_BATCH 8
+
+// Default microseconds after a thread last ran during which it counts as
+// cache-hot on that CPU (see sched_set_cache_hot)
+#define SCHED_CACHE_HOT_US 500
+
 // ============================================================================
 // Global Scheduler State
 // ============================================================================
 
-// Global lock for operations that affect multiple CPUs (thread creation, migration)
-extern struct spinlock sched_lock;
-
 // Flag indicating if scheduler is fully initialized
 extern bool sched_initialized;
 
+// Kick remote CPUs with APIC_RESCHED_VECTOR on wakeup (see sched_set_resched_ipi)
+extern bool sched_resched_ipi;
+
+// Cache-hot window in microseconds (see sched_set_cache_hot)
+extern uint64_t sched_cache_hot_us;
+
 // ============================================================================
 // Per-CPU Scheduler Functions
 // ============================================================================
@@ -57,7 +72,8 @@ void sched_init_cpu(void);
  * @brief Add a thread to a CPU's run queue
  *
  * If cpu_index is -1, the thread is added to the least loaded CPU.
- * Otherwise, adds to the specified CPU's run queue.
+ * Otherwise, adds to the specified CPU's run queue. A SCHED_DEADLINE
+ * thread always goes to the CPU its bandwidth was admitted on.
  *
  * @param thread Thread to add
  * @param cpu_index Target CPU index, or -1 for automatic selection
@@ -67,8 +83,11 @@ void sched_add_thread(struct thread *thread, int cpu_index);
 /**
  * @brief Get the next runnable thread for the current CPU
  *
- * Returns the next thread from the current CPU's run queue.
- * If no threads are available, returns the idle thread.
+ * Drains the wakelist, then dequeues the next thread of the first class
+ * with queued work: deadline, real-time, then the normal classes. If the
+ * local queue is empty, steals the most urgent queued thread that may
+ * migrate from the busiest CPU. If no threads are available, returns the
+ * idle thread.
  *
  * @return Next thread to run
  */
@@ -81,6 +100,97 @@ struct thread *sched_get_next(void);
  */
 void sched_remove_thread(struct thread *thread);
 
+/**
+ * @brief Change a thread's priority level
+ *
+ * A queued thread is moved to the new level immediately; a running or
+ * blocked one picks it up the next time it is enqueued.
+ *
+ * @param thread Thread to update
+ * @param priority New level, 0 (most urgent) to THREAD_PRIO_LEVELS - 1
+ */
+void sched_set_priority(struct thread *thread, int priority);
+
+/**
+ * @brief Change a thread's scheduling policy
+ *
+ * SCHED_FIFO and SCHED_RR threads are served before every normal thread,
+ * by priority level; SCHED_NORMAL moves the thread back to the default
+ * class. Leaving SCHED_DEADLINE releases the thread's bandwidth.
+ *
+ * @param thread Thread to update
+ * @param policy SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+ * @param priority Level, 0 (most urgent) to THREAD_PRIO_LEVELS - 1
+ */
+void sched_set_policy(struct thread *thread, enum sched_policy policy, int priority);
+
+/**
+ * @brief Make a thread SCHED_DEADLINE
+ *
+ * The thread is guaranteed runtime_us of CPU time in every period_us,
+ * finished within deadline_us of the period's start, and is throttled
+ * once it has used its runtime. Deadline threads preempt every other
+ * class and stay on thread->cpu, where the bandwidth is reserved.
+ * sched_yield() ends the current period's job early.
+ *
+ * @param thread Thread to update
+ * @param runtime_us Budget per period
+ * @param deadline_us Relative deadline, runtime_us <= deadline_us <= period_us
+ * @param period_us Period, at most SCHED_DL_PERIOD_MAX_US
+ * @return false if the parameters are invalid or admitting the thread
+ *         would raise the summed runtime_us / deadline_us of the CPU's
+ *         deadline threads above SCHED_DL_BW_LIMIT
+ */
+bool sched_set_deadline(struct thread *thread, uint64_t runtime_us, uint64_t deadline_us,
+                        uint64_t period_us);
+
+/**
+ * @brief Restrict a thread to a set of CPUs
+ *
+ * Placement, wakeups, stealing and balancing all honor the mask. A thread
+ * queued on a CPU outside the new mask is moved right away, a running one
+ * as soon as it leaves its CPU; the calling thread yields to move itself.
+ *
+ * @param thread Thread to update
+ * @param mask Allowed CPUs
+ * @return false if the mask holds no present CPU, or would move a
+ *         SCHED_DEADLINE thread off the CPU holding its bandwidth
+ */
+bool sched_set_affinity(struct thread *thread, const struct cpumask *mask);
+
+/**
+ * @brief Block the current thread
+ *
+ * The caller must have recorded the thread somewhere it will be woken
+ * from. The thread leaves the run queue until sched_wakeup().
+ */
+void sched_block(void);
+
+/**
+ * @brief Block the current thread unless a wakeup condition already holds
+ *
+ * The thread is marked WAIT before ready(arg) is tested, so a waker that
+ * makes the condition true and then calls sched_wakeup() cannot be missed
+ * between the test and the switch. Returns with the caller's interrupt
+ * flag. Panics if called while holding a spinlock or with preemption
+ * disabled.
+ *
+ * @param ready Returns true when there is no need to sleep
+ */
+void sched_block_unless(bool (*ready)(void *), void *arg);
+
+/**
+ * @brief Make a blocked thread runnable again
+ *
+ * Pushes the thread onto the lock-free wakelist of the CPU it last ran
+ * on, or of the least loaded allowed CPU if its affinity no longer
+ * includes that one; the CPU moves it into its run queue at its next
+ * scheduling point. Does nothing if the thread is not blocked.
+ *
+ * @param thread Thread to wake
+ */
+void sched_wakeup(struct thread *thread);
+
 /**
  * @brief Yield the current thread's time slice
  *
@@ -99,36 +209,94 @@ void sched_exit(void);
 /**
  * @brief Main scheduler loop for a CPU
  *
- * Never returns. Continuously picks threads and runs them.
+ * Never returns. Continuously picks threads and runs them. Threads are
+ * switched to and from with interrupts disabled; new threads enable them
+ * in thread_entry, resumed ones on their way back from the switch.
  */
 void sched_run(void);
 
 /**
  * @brief Timer tick handler for scheduler
  *
- * Called from timer interrupt. Handles time slice expiration
- * and triggers context switch if needed.
+ * Called from timer interrupt. Refills throttled threads, charges the
+ * tick to the running thread and sets need_resched once its class says
+ * it has used its slice.
  */
 void sched_tick(void);
 
+/**
+ * @brief Check whether the current thread should be preempted now
+ *
+ * True when need_resched is set, preemption is not disabled and a
+ * non-idle thread owns the CPU. Called on return from interrupt.
+ */
+bool sched_need_preempt(void);
+
+/**
+ * @brief Handle a reschedule IPI
+ *
+ * Called from trap() for APIC_RESCHED_VECTOR. Clears the CPU's
+ * ipi_pending flag and requests a reschedule if a woken thread beats the
+ * current one. An idle CPU leaves HLT and picks the thread up by itself.
+ */
+void sched_resched_interrupt(void);
+
+/**
+ * @brief Enable or disable reschedule IPIs
+ *
+ * With IPIs off, a remote CPU notices new work only at its next timer
+ * tick. Meant for comparing wakeup latency (see sched_log_state).
+ */
+void sched_set_resched_ipi(bool enabled);
+
+/**
+ * @brief Set how long a thread stays cache-hot on the CPU it last ran on
+ *
+ * A woken or re-added thread goes back to its last CPU within this many
+ * microseconds of leaving it, even if that CPU is busy. Periodic
+ * balancing leaves such threads in place unless the imbalance is twice
+ * the domain's threshold. Past the window a thread is placed on an idle
+ * CPU sharing its last CPU's cache, if there is one. 0 disables it.
+ */
+void sched_set_cache_hot(uint64_t us);
+
+/**
+ * @brief Switch away from the current thread from interrupt context
+ *
+ * Called from trap() with the interrupted thread's trap frame on its
+ * stack. Returns when the thread is scheduled again.
+ */
+void sched_preempt(void);
+
 // ============================================================================
 // Load Balancing (Optional)
 // ============================================================================
 
 /**
- * @brief Perform load balancing across CPUs
+ * @brief Pull work from the busiest CPU to this one
  *
- * Migrates threads from overloaded CPUs to underloaded ones.
- * Should be called periodically (e.g., every N timer ticks).
+ * Walks this CPU's scheduling domains (see topology.h) innermost first
+ * and migrates one queued thread from the busiest CPU of the first
+ * domain whose imbalance reaches the domain's threshold. Before the
+ * domains are built the whole machine is one domain with
+ * LOAD_BALANCE_THRESHOLD. The remote queue is only trylocked, so a
+ * contended pass is skipped rather than waited for. Runs as the
+ * SCHED softirq, which sched_tick() raises every SCHED_BALANCE_INTERVAL
+ * ticks. Idle CPUs
+ * additionally steal in sched_get_next(), also innermost domain first.
  */
 void sched_balance(void);
 
 /**
- * @brief Find the CPU with the least load
+ * @brief Find the best started CPU in a mask for a new or woken thread
  *
- * @return CPU index of the least loaded CPU
+ * Prefers a CPU whose whole core is idle, then an idle CPU whose SMT
+ * sibling is busy, then the CPU with the fewest threads.
+ *
+ * @param allowed CPUs to choose from
+ * @return CPU index of the chosen CPU
  */
-uint32_t sched_find_least_loaded(void);
+uint32_t sched_find_least_loaded(const struct cpumask *allowed);
 
 // ============================================================================
 // Debugging
@@ -136,7 +304,34 @@ uint32_t sched_find_least_loaded(void);
 
 /**
  * @brief Log scheduler state for all CPUs
+ *
+ * Includes reschedule IPI counts and wakeup-to-run latency in TSC
+ * cycles, measured from sched_add_thread()/sched_wakeup() to the switch
+ * into the thread, and how often threads change CPUs and find their
+ * cache still warm.
  */
 void sched_log_state(void);
 
+/**
+ * @brief Dump per-CPU scheduler statistics over serial
+ *
+ * One "[SCHEDSTAT]" line of key=value pairs per started CPU, after a
+ * header giving tsc_per_ms for converting the TSC cycle counts: idle time,
+ * switches into threads, preemptions, migrations into the CPU by stealing
+ * or balancing, wakeups it placed on a CPU other than the thread's last
+ * one (wake_migrations), and how many threads were left queued at each
+ * pick, bucketed 0, 1, 2-3, 4-7, ... (SCHED_QDEPTH_BUCKETS comma-separated
+ * buckets).
+ */
+void sched_dump_stats(void);
+
+/**
+ * @brief Dump one thread's scheduler statistics over serial
+ *
+ * A "[SCHEDSTAT]" line with the thread's run time, time spent runnable
+ * but waiting (delay) and blocked, in TSC cycles, its voluntary and
+ * involuntary switches and its migrations. Valid until the thread exits.
+ */
+void sched_dump_thread_stats(struct thread *thread);
+
 #endif // SHIP_OS_SMP_SCHED_H
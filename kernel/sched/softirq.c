@@ -0,0 +1,76 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Softirq dispatch on interrupt exit
+//
+
+#include "softirq.h"
+#include "percpu.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+#include "../lib/include/panic.h"
+
+static void (*softirq_handlers[SOFTIRQ_NR])(void);
+
+void softirq_open(enum softirq_vec nr, void (*handler)(void))
+{
+    softirq_handlers[nr] = handler;
+}
+
+void softirq_raise(enum softirq_vec nr)
+{
+    pushcli();
+    mycpu()->softirq_pending |= 1u << nr;
+    popcli();
+}
+
+void softirq_run_pending(void)
+{
+    struct percpu *cpu = mycpu();
+
+    if (cpu->softirq_pending == 0 || cpu->in_softirq)
+    {
+        return;
+    }
+
+    // Interrupts nested in the handlers raise more work but leave it to
+    // this loop; preemption would move the handlers to another CPU
+    cpu->in_softirq = true;
+    preempt_disable();
+
+    for (int round = 0; round < SOFTIRQ_MAX_RESTART && cpu->softirq_pending != 0; round++)
+    {
+        // Interrupts are off, so nothing is raised between read and clear
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        sti();
+
+        for (uint32_t nr = 0; nr < SOFTIRQ_NR; nr++)
+        {
+            if ((pending & (1u << nr)) && softirq_handlers[nr] != 0)
+            {
+                softirq_handlers[nr]();
+                cpu->softirq_runs++;
+            }
+        }
+
+        cli();
+    }
+
+    preempt_enable();
+    cpu->in_softirq = false;
+}
+
+void softirq_log_stats(void)
+{
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct percpu *cpu = &percpus[i];
+        if (!cpu->started)
+            continue;
+
+        LOG_SERIAL("SOFTIRQ", "CPU %d: %llu handlers run, pending 0x%x",
+                   i, cpu->softirq_runs, cpu->softirq_pending);
+    }
+}
@@ -0,0 +1,59 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Softirqs: per-CPU bottom halves. An interrupt handler does only what the
+// hardware needs right away and raises a softirq for the rest; the raised
+// handlers run on the same CPU as the interrupt returns, with interrupts
+// enabled and preemption disabled, so other devices are not held up.
+// Work that may block or take long belongs on a workqueue instead.
+//
+
+#ifndef SHIPOS_SOFTIRQ_H
+#define SHIPOS_SOFTIRQ_H
+
+#include <stdint.h>
+
+// Rounds of newly raised softirqs handled per interrupt exit; the rest
+// wait for the next interrupt on that CPU
+#define SOFTIRQ_MAX_RESTART 10
+
+/**
+ * @brief Softirq vectors, handled in this order
+ */
+enum softirq_vec
+{
+    SOFTIRQ_TIMER = 0, // Expired timers, see timer.h
+    SOFTIRQ_SCHED,     // Periodic load balancing
+    SOFTIRQ_NR
+};
+
+/**
+ * @brief Register the handler of a vector, at boot
+ */
+void softirq_open(enum softirq_vec nr, void (*handler)(void));
+
+/**
+ * @brief Mark a vector pending on this CPU
+ *
+ * Called from interrupt handlers; the vector runs on this interrupt's
+ * exit. Raised elsewhere, it waits for the next interrupt.
+ */
+void softirq_raise(enum softirq_vec nr);
+
+/**
+ * @brief Run the pending softirqs of this CPU
+ *
+ * Called by trap() with interrupts disabled on the way out of an
+ * interrupt that hit code with interrupts enabled, and by the idle loop
+ * before it halts. Does nothing when nested in another softirq run.
+ * Returns with interrupts disabled.
+ */
+void softirq_run_pending(void);
+
+/**
+ * @brief Log softirq counters for all CPUs
+ */
+void softirq_log_stats(void);
+
+#endif // SHIPOS_SOFTIRQ_H
@@ -5,37 +5,132 @@
 
 #include "threads.h"
 #include "sched_states.h"
+#include "sched_class.h"
 #include "../lib/include/panic.h"
 #include "scheduler.h"
+#include "percpu.h"
 
 struct thread *current_thread = 0;
 
-void init_thread(struct thread *thread, void (*start_function)(void *), int argc, struct argument *args) {
-    thread->stack = kalloc();
-    thread->kstack = kalloc();
-    memset(thread->stack, 0, PGSIZE);
-    memset(thread->kstack, 0, PGSIZE);
-    thread->kstack += PGSIZE;
-    thread->stack += PGSIZE;
+/**
+ * @brief Reset every field of a thread whose stacks are already set up
+ */
+static void reset_thread(struct thread *thread, void (*start_function)(void *), int argc, struct argument *args) {
     thread->start_function = start_function;
     thread->argc = argc;
     thread->args = args;
-    char *sp = thread->stack;
-    sp -= sizeof(uint64_t);     
-    *(uint64_t * )(sp) = start_function;
-    sp -= sizeof(struct context) - sizeof(uint64_t);
-    memset(sp, 0, sizeof(struct context) - sizeof(uint64_t));
+    thread->state = NEW;
+    thread->priority = THREAD_PRIO_DEFAULT;
+    thread->cpu = 0;
+    thread->last_cpu = 0;
+    thread->last_ran = 0;
+    thread->on_cpu = false;
+    cpumask_setall(&thread->cpus_allowed);
+    thread->sched_class = sched_default_class;
+    thread->policy = SCHED_NORMAL;
+    thread->on_rq = false;
+    thread->vruntime = 0;
+    thread->exec_start = 0;
+    thread->sum_exec_runtime = 0;
+    thread->slice_start = 0;
+    thread->stat_since = 0;
+    thread->run_delay = 0;
+    thread->blocked_time = 0;
+    thread->nr_voluntary = 0;
+    thread->nr_involuntary = 0;
+    thread->nr_migrations = 0;
+    thread->dl_runtime = 0;
+    thread->dl_deadline = 0;
+    thread->dl_period = 0;
+    thread->dl_bw = 0;
+    thread->dl_budget = 0;
+    thread->dl_abs_deadline = 0;
+    lst_init(&thread->rq_link);
+    thread->wake_next = 0;
+    thread->wake_tsc = 0;
+    thread->fpu_used = false;
+
+    // First frame: switch_context() returns into thread_entry, which enables
+    // interrupts, pops the arguments and returns into the start function. Above it
+    // sits the start function's return address, thread_exit, which leaves the stack
+    // aligned as after a call and ends the thread if the function returns.
+    char *sp = (char *) thread->stack;
+    sp -= sizeof(uint64_t);
+    *(uint64_t *) sp = (uint64_t) thread_exit;
+    sp -= sizeof(struct context);
+    memset(sp, 0, sizeof(struct context));
     thread->context = (struct context *) sp;
+    thread->context->rip = (uint64_t) thread_entry;
+    thread->context->entry = (uint64_t) start_function;
     thread->context->rdi = argc;
-    thread->context->rsi = args;
+    thread->context->rsi = (uint64_t) args;
 }
 
 struct thread *create_thread(void (*start_function)(void *), int argc, struct argument *args) {
-    struct thread *new_thread = (struct thread *) kalloc();
-    init_thread(new_thread, start_function, argc, args);
+    // The pool is only touched by its own CPU, with interrupts off so the
+    // reaper cannot run in between
+    pushcli();
+    struct percpu *cpu = mycpu();
+    struct thread *new_thread = cpu->thread_pool;
+    if (new_thread != 0) {
+        cpu->thread_pool = new_thread->wake_next;
+        cpu->nr_pooled--;
+        cpu->threads_reused++;
+    }
+    popcli();
+
+    if (new_thread != 0) {
+        // Old stack contents are never read, only the initial frame
+        reset_thread(new_thread, start_function, argc, args);
+        return new_thread;
+    }
+
+    new_thread = (struct thread *) kalloc();
+    void *stack = kalloc();
+    void *kstack = kalloc();
+    if (new_thread == 0 || stack == 0 || kstack == 0) {
+        if (new_thread != 0) {
+            kfree(new_thread);
+        }
+        if (stack != 0) {
+            kfree(stack);
+        }
+        if (kstack != 0) {
+            kfree(kstack);
+        }
+        return 0;
+    }
+
+    memset(stack, 0, PGSIZE);
+    memset(kstack, 0, PGSIZE);
+    new_thread->stack = (uint64_t) stack + PGSIZE;
+    new_thread->kstack = (uint64_t) kstack + PGSIZE;
+    new_thread->fpu_state = 0;
+    reset_thread(new_thread, start_function, argc, args);
     return new_thread;
 }
 
+void release_thread(struct thread *thread) {
+    pushcli();
+    struct percpu *cpu = mycpu();
+    bool pooled = cpu->nr_pooled < THREAD_POOL_MAX;
+    if (pooled) {
+        thread->wake_next = cpu->thread_pool;
+        cpu->thread_pool = thread;
+        cpu->nr_pooled++;
+    }
+    popcli();
+
+    if (!pooled) {
+        if (thread->fpu_state != 0) {
+            kfree(thread->fpu_state);
+        }
+        kfree((void *) (thread->stack - PGSIZE));
+        kfree((void *) (thread->kstack - PGSIZE));
+        kfree(thread);
+    }
+}
+
 void push_thread_list(struct thread_node **list, struct thread *thread) {
     struct thread_node *new_node = kalloc();
     new_node->data = thread;
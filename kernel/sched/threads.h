@@ -10,9 +10,32 @@
 #include "../kalloc/kalloc.h"
 #include "../lib/include/x86_64.h"
 #include <stddef.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include "../lib/include/memset.h"
 #include "sched_states.h"
+#include "../list/list.h"
+#include "../rbtree/rbtree.h"
+#include "cpumask.h"
+
+// Scheduling priorities: 0 is the most urgent, THREAD_PRIO_LEVELS - 1 the least
+#define THREAD_PRIO_LEVELS  32
+#define THREAD_PRIO_DEFAULT 16
+
+// Exited threads each CPU keeps for create_thread(); the rest are freed
+#define THREAD_POOL_MAX 16
+
+/**
+ * @brief Scheduling policy of a thread, see sched_set_policy()
+ */
+enum sched_policy {
+    SCHED_NORMAL = 0, // Default class chosen with sched= on the command line
+    SCHED_FIFO,       // Real-time, runs until it blocks, yields or is preempted
+    SCHED_RR,         // Real-time, round-robin among equal priorities
+    SCHED_DEADLINE    // Earliest deadline first, see sched_set_deadline()
+};
+
+struct sched_class;
 
 struct argument {
     char *value;
@@ -27,6 +50,37 @@ struct thread {
     size_t argc;
     struct argument *args;
     enum sched_states state;
+    int priority;   // Run-queue level, see THREAD_PRIO_LEVELS
+    uint32_t cpu;   // Index of the CPU whose run queue owns this thread
+    uint32_t last_cpu;    // CPU the thread last ran on
+    uint64_t last_ran;    // TSC when it last left that CPU, 0 if it never ran
+    volatile bool on_cpu; // Context is live on last_cpu, cleared once switched out
+    struct cpumask cpus_allowed; // CPUs the thread may run on, see sched_set_affinity()
+    const struct sched_class *sched_class; // Policy that orders this thread
+    enum sched_policy policy;
+    bool on_rq;     // Queued in cpu's run queue
+    struct list rq_link; // Priority-class link, points to itself when not queued
+    struct rb_node run_node;   // Fair-class tree node
+    uint64_t vruntime;         // Fair class: weighted runtime in TSC cycles
+    uint64_t exec_start;       // TSC when runtime was last charged
+    uint64_t sum_exec_runtime; // Total TSC cycles spent running
+    uint64_t slice_start;      // sum_exec_runtime when the current slice began
+    uint64_t stat_since;       // TSC when it last became runnable or blocked
+    uint64_t run_delay;        // TSC cycles spent runnable, waiting for a CPU
+    uint64_t blocked_time;     // TSC cycles spent blocked
+    uint64_t nr_voluntary;     // Switches out by blocking, yielding or exiting
+    uint64_t nr_involuntary;   // Switches out by preemption
+    uint64_t nr_migrations;    // Runs started on a CPU other than the previous one
+    uint64_t dl_runtime;       // Deadline class: budget per period in TSC cycles
+    uint64_t dl_deadline;      // Deadline class: relative deadline in TSC cycles
+    uint64_t dl_period;        // Deadline class: period in TSC cycles
+    uint64_t dl_bw;            // dl_runtime / dl_deadline, see SCHED_DL_BW_SHIFT
+    int64_t dl_budget;         // Budget left in the current period
+    uint64_t dl_abs_deadline;  // TSC deadline of the current period
+    void *fpu_state;          // XSAVE area, allocated on first FPU use, see fpu.h
+    bool fpu_used;            // fpu_state holds this thread's registers
+    struct thread *wake_next; // Next entry on a CPU's wakelist
+    uint64_t wake_tsc;        // TSC when last made runnable, 0 once it ran
 };
 
 struct thread_node {
@@ -43,8 +97,25 @@ void shift_thread_list(struct thread_node **list);
 
 struct thread *peek_thread_list(struct thread_node *list);
 
+/**
+ * @brief Create a NEW thread that starts in start_function(argc, args)
+ *
+ * Reuses a thread from this CPU's pool when there is one, so only the
+ * fields and the initial frame are reset; otherwise allocates the thread
+ * and its two stack pages. The pointer is invalid once the thread exits.
+ *
+ * @return The thread, or NULL if out of memory
+ */
 struct thread *create_thread(void (*start_function)(void *), int argc, struct argument *args);
 
+/**
+ * @brief Give an exited thread back for reuse
+ *
+ * Called by the scheduler once the thread's stack is no longer in use.
+ * The thread goes to this CPU's pool, or is freed if the pool is full.
+ */
+void release_thread(struct thread *thread);
+
 void change_thread_state(struct thread *thread, enum sched_states new_state);
 
 void thread_function(int argc, struct argument *args);
@@ -0,0 +1,276 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// CPU topology from CPUID and the MADT, and the scheduling domains built
+// from it.
+//
+
+#include "topology.h"
+#include "percpu.h"
+#include "../desc/madt.h"
+#include "../lib/include/logging.h"
+#include "../lib/include/x86_64.h"
+
+struct cpu_topology cpu_topology[MAX_CPUS];
+
+// Balancing parameters per level: moving a thread gets more expensive the
+// more cache it leaves behind, so outer levels need a larger imbalance
+// and are looked at less often
+static const struct sched_domain level_params[SD_LEVELS] = {
+    [SD_SMT] = {.name = "SMT", .level = SD_SMT, .imbalance = 2, .interval = 1},
+    [SD_LLC] = {.name = "LLC", .level = SD_LLC, .imbalance = 2, .interval = 1},
+    [SD_PKG] = {.name = "PKG", .level = SD_PKG, .imbalance = 2, .interval = 2},
+    [SD_SYSTEM] = {.name = "SYSTEM", .level = SD_SYSTEM, .imbalance = 3, .interval = 4},
+};
+
+// CPUID leaf 0xB/0x1F level types
+#define CPUID_LEVEL_INVALID 0
+#define CPUID_LEVEL_SMT     1
+
+/**
+ * @brief Number of APIC ID bits needed for n entities
+ */
+static uint32_t ceil_log2(uint32_t n)
+{
+    uint32_t shift = 0;
+    while ((1u << shift) < n)
+    {
+        shift++;
+    }
+    return shift;
+}
+
+/**
+ * @brief Read the APIC ID field widths from an extended topology leaf
+ *
+ * Each sub-leaf describes one level; EAX[4:0] is the shift that removes
+ * that level and everything below it from the APIC ID.
+ *
+ * @param leaf 0x1F or 0xB
+ * @return false if the leaf is not implemented
+ */
+static bool read_extended_topology(uint32_t leaf, uint32_t *smt_shift, uint32_t *pkg_shift)
+{
+    uint32_t regs[4];
+
+    cpuid(leaf, 0, regs);
+    if (regs[1] == 0)
+    {
+        return false;
+    }
+
+    *smt_shift = 0;
+    *pkg_shift = 0;
+    for (uint32_t sub = 0; sub < 8; sub++)
+    {
+        cpuid(leaf, sub, regs);
+        uint32_t type = (regs[2] >> 8) & 0xff;
+        if (type == CPUID_LEVEL_INVALID)
+        {
+            break;
+        }
+
+        uint32_t shift = regs[0] & 0x1f;
+        if (type == CPUID_LEVEL_SMT)
+        {
+            *smt_shift = shift;
+        }
+        *pkg_shift = shift;
+    }
+    return true;
+}
+
+/**
+ * @brief Read how many APIC IDs share the last-level cache
+ *
+ * @param leaf 4 (Intel) or 0x8000001D (AMD), same layout
+ * @return false if the leaf lists no caches
+ */
+static bool read_llc_shift(uint32_t leaf, uint32_t *llc_shift)
+{
+    uint32_t regs[4];
+    uint32_t best_level = 0;
+
+    for (uint32_t sub = 0; sub < 16; sub++)
+    {
+        cpuid(leaf, sub, regs);
+        uint32_t type = regs[0] & 0x1f;
+        if (type == 0)
+        {
+            break;
+        }
+
+        uint32_t level = (regs[0] >> 5) & 0x7;
+        uint32_t sharing = ((regs[0] >> 14) & 0xfff) + 1;
+        if (level >= best_level)
+        {
+            best_level = level;
+            *llc_shift = ceil_log2(sharing);
+        }
+    }
+    return best_level != 0;
+}
+
+/**
+ * @brief Add the domain at level unless it spans nothing new
+ */
+static void add_domain(struct cpu_topology *t, enum sd_level level, const struct cpumask *span)
+{
+    const struct cpumask *below = t->nr_domains != 0 ? &t->domains[t->nr_domains - 1].span : 0;
+    if (cpumask_weight(span) < 2 || (below != 0 && cpumask_equal(span, below)))
+    {
+        return;
+    }
+
+    struct sched_domain *sd = &t->domains[t->nr_domains];
+    *sd = level_params[level];
+    sd->span = *span;
+
+    // Other CPUs balance concurrently and read up to nr_domains
+    __sync_synchronize();
+    t->nr_domains++;
+}
+
+void topology_init(void)
+{
+    uint32_t regs[4];
+    uint32_t smt_shift = 0;
+    uint32_t pkg_shift = 0;
+    uint32_t llc_shift;
+
+    cpuid(0, 0, regs);
+    uint32_t max_leaf = regs[0];
+    cpuid(0x80000000, 0, regs);
+    uint32_t max_ext_leaf = regs[0];
+
+    if (!(max_leaf >= 0x1f && read_extended_topology(0x1f, &smt_shift, &pkg_shift)) &&
+        !(max_leaf >= 0xb && read_extended_topology(0xb, &smt_shift, &pkg_shift)))
+    {
+        // Legacy: leaf 1 EBX[23:16] counts the logical CPUs per package
+        cpuid(1, 0, regs);
+        if (regs[3] & (1u << 28))
+        {
+            pkg_shift = ceil_log2((regs[1] >> 16) & 0xff);
+        }
+    }
+
+    if (!(max_leaf >= 4 && read_llc_shift(4, &llc_shift)) &&
+        !(max_ext_leaf >= 0x8000001d && read_llc_shift(0x8000001d, &llc_shift)))
+    {
+        llc_shift = pkg_shift;
+    }
+
+    // The last-level cache is shared by whole cores within one package
+    if (llc_shift < smt_shift)
+    {
+        llc_shift = smt_shift;
+    }
+    if (llc_shift > pkg_shift)
+    {
+        llc_shift = pkg_shift;
+    }
+
+    // Place every started CPU from its MADT entry
+    struct cpumask present;
+    cpumask_clear(&present);
+    for (uint32_t i = 0; i < get_cpu_count(); i++)
+    {
+        struct CPUInfo *info = get_cpu_info(i);
+        if (info == 0 || !info->enabled)
+        {
+            continue;
+        }
+        struct percpu *cpu = cpu_by_apic_id(info->apic_id);
+        if (cpu == 0 || !cpu->started)
+        {
+            continue;
+        }
+
+        struct cpu_topology *t = &cpu_topology[cpu->cpu_index];
+        t->apic_id = info->apic_id;
+        t->package_id = info->apic_id >> pkg_shift;
+        t->llc_id = info->apic_id >> llc_shift;
+        t->core_id = info->apic_id >> smt_shift;
+        cpumask_set_cpu(&present, cpu->cpu_index);
+    }
+
+    for (uint32_t a = 0; a < ncpu; a++)
+    {
+        if (!cpumask_test_cpu(&present, a))
+        {
+            continue;
+        }
+
+        struct cpu_topology *t = &cpu_topology[a];
+        struct cpumask spans[SD_LEVELS];
+        for (int level = 0; level < SD_LEVELS; level++)
+        {
+            cpumask_clear(&spans[level]);
+        }
+
+        for (uint32_t b = 0; b < ncpu; b++)
+        {
+            if (!cpumask_test_cpu(&present, b))
+            {
+                continue;
+            }
+            struct cpu_topology *other = &cpu_topology[b];
+            if (other->core_id == t->core_id)
+            {
+                cpumask_set_cpu(&spans[SD_SMT], b);
+            }
+            if (other->llc_id == t->llc_id)
+            {
+                cpumask_set_cpu(&spans[SD_LLC], b);
+            }
+            if (other->package_id == t->package_id)
+            {
+                cpumask_set_cpu(&spans[SD_PKG], b);
+            }
+            cpumask_set_cpu(&spans[SD_SYSTEM], b);
+        }
+
+        t->siblings = spans[SD_SMT];
+        t->nr_domains = 0;
+        for (int level = 0; level < SD_LEVELS; level++)
+        {
+            add_domain(t, level, &spans[level]);
+        }
+    }
+
+    LOG_SERIAL("TOPO", "APIC ID shifts: SMT %d, LLC %d, package %d", smt_shift, llc_shift, pkg_shift);
+}
+
+const struct cpumask *topology_llc_span(uint32_t cpu)
+{
+    struct cpu_topology *t = &cpu_topology[cpu];
+    const struct cpumask *span = 0;
+
+    for (uint32_t d = 0; d < t->nr_domains && t->domains[d].level <= SD_LLC; d++)
+    {
+        span = &t->domains[d].span;
+    }
+    return span;
+}
+
+void topology_log(void)
+{
+    LOG_SERIAL("TOPO", "=== CPU Topology ===");
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct cpu_topology *t = &cpu_topology[i];
+        if (!percpus[i].started)
+            continue;
+
+        LOG_SERIAL("TOPO", "CPU %d: APIC %d, package %d, LLC %d, core %d, siblings %llx",
+                   i, t->apic_id, t->package_id, t->llc_id, t->core_id, t->siblings.bits[0]);
+        for (uint32_t d = 0; d < t->nr_domains; d++)
+        {
+            struct sched_domain *sd = &t->domains[d];
+            LOG_SERIAL("TOPO", "CPU %d:   %s span %llx, imbalance %d, every %d passes",
+                       i, sd->name, sd->span.bits[0], sd->imbalance, sd->interval);
+        }
+    }
+    LOG_SERIAL("TOPO", "====================");
+}
@@ -0,0 +1,87 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// CPU topology and scheduling domains. Every CPU gets a stack of nested
+// domains, from its SMT siblings out to the whole machine; load balancing
+// walks them innermost first, so threads move between CPUs that share a
+// cache before they move across packages.
+//
+
+#ifndef SHIPOS_TOPOLOGY_H
+#define SHIPOS_TOPOLOGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpumask.h"
+
+/**
+ * @brief Domain levels, innermost first
+ */
+enum sd_level
+{
+    SD_SMT = 0, // Hardware threads of one core
+    SD_LLC,     // Cores sharing the last-level cache
+    SD_PKG,     // Cores of one package
+    SD_SYSTEM,  // Every CPU
+    SD_LEVELS
+};
+
+/**
+ * @brief A set of CPUs balanced against each other
+ */
+struct sched_domain
+{
+    const char *name;
+    enum sd_level level;
+    struct cpumask span;  // CPUs in the domain, including the owner
+    uint32_t imbalance;   // Thread count difference worth a migration
+    uint32_t interval;    // Balance on every interval-th balancing pass
+};
+
+/**
+ * @brief Position of a CPU in the machine and its domains
+ *
+ * Levels that would span the same CPUs as the one below, or only the CPU
+ * itself, are left out, so domains[0..nr_domains) strictly grow.
+ */
+struct cpu_topology
+{
+    uint32_t apic_id;
+    uint32_t package_id;
+    uint32_t llc_id;
+    uint32_t core_id;         // Unique across packages
+    struct cpumask siblings;  // CPUs of the same core, including this one
+    uint32_t nr_domains;
+    struct sched_domain domains[SD_LEVELS];
+};
+
+// Indexed by CPU index; all zero until topology_init() has run
+extern struct cpu_topology cpu_topology[MAX_CPUS];
+
+/**
+ * @brief Build the topology of the started CPUs
+ *
+ * Reads the APIC ID field widths of the SMT, core and package levels from
+ * CPUID leaf 0x1F or 0xB, the cache sharing from leaf 4 (0x8000001D on
+ * AMD), and applies them to the APIC IDs of the MADT CPU list. The field
+ * widths are assumed to be the same on every CPU. Called by the BSP once
+ * all APs are up; until then every CPU has no domains and the scheduler
+ * balances across the machine as a whole.
+ */
+void topology_init(void);
+
+/**
+ * @brief CPUs sharing the last-level cache with a CPU
+ *
+ * @return Span of the outermost domain of cpu at or below SD_LLC, or NULL
+ *         if the CPU shares its cache with no other CPU
+ */
+const struct cpumask *topology_llc_span(uint32_t cpu);
+
+/**
+ * @brief Log the topology and domain spans of every CPU
+ */
+void topology_log(void);
+
+#endif // SHIPOS_TOPOLOGY_H
@@ -0,0 +1,134 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Wait queues on top of sched_block_unless() and sched_wakeup()
+//
+
+#include "waitqueue.h"
+#include "percpu.h"
+#include "smp_sched.h"
+#include "../time/timer.h"
+#include "../lib/include/panic.h"
+
+void waitqueue_init(struct wait_queue *wq, char *name)
+{
+    init_spinlock(&wq->lock, name);
+    lst_init(&wq->waiters);
+}
+
+void waitqueue_prepare(struct wait_queue *wq, struct wait_entry *entry, const void *key)
+{
+    pushcli();
+    struct thread *self = mycpu()->current_thread;
+    popcli();
+
+    if (self == 0)
+    {
+        panic("waitqueue_prepare: not in a thread");
+    }
+
+    entry->thread = self;
+    entry->key = key;
+
+    // The entry is never queued here: a wakeup is the only way out of
+    // waitqueue_sleep(), and it takes the entry off
+    acquire_spinlock(&wq->lock);
+    entry->woken = false;
+    lst_push_back(&wq->waiters, &entry->link);
+    release_spinlock(&wq->lock);
+}
+
+static bool entry_woken(void *arg)
+{
+    struct wait_entry *entry = arg;
+    return entry->woken;
+}
+
+void waitqueue_sleep(struct wait_entry *entry)
+{
+    // sched_wakeup() from anyone else returns early, so sleep again
+    while (!entry->woken)
+    {
+        sched_block_unless(entry_woken, entry);
+    }
+}
+
+struct wait_timeout
+{
+    struct timer timer;
+    struct wait_entry *entry;
+    volatile bool expired;
+};
+
+static void wait_timeout_func(void *arg)
+{
+    struct wait_timeout *timeout = arg;
+    timeout->expired = true;
+    sched_wakeup(timeout->entry->thread);
+}
+
+static bool entry_woken_or_expired(void *arg)
+{
+    struct wait_timeout *timeout = arg;
+    return timeout->entry->woken || timeout->expired;
+}
+
+bool waitqueue_sleep_timeout(struct wait_entry *entry, uint64_t timeout_ns)
+{
+    struct wait_timeout timeout;
+    timeout.entry = entry;
+    timeout.expired = false;
+    timer_setup(&timeout.timer, wait_timeout_func, &timeout);
+    timer_add(&timeout.timer, timeout_ns, 0);
+
+    while (!entry->woken && !timeout.expired)
+    {
+        sched_block_unless(entry_woken_or_expired, &timeout);
+    }
+
+    // Waits for a callback still running on the timer's CPU
+    timer_cancel(&timeout.timer);
+    return entry->woken;
+}
+
+void waitqueue_finish(struct wait_queue *wq, struct wait_entry *entry)
+{
+    acquire_spinlock(&wq->lock);
+    if (!entry->woken)
+    {
+        lst_remove(&entry->link);
+        lst_init(&entry->link);
+    }
+    release_spinlock(&wq->lock);
+}
+
+uint32_t waitqueue_wake(struct wait_queue *wq, uint32_t nr, const void *key)
+{
+    uint32_t woken = 0;
+
+    acquire_spinlock(&wq->lock);
+    struct list *node = wq->waiters.next;
+    while (node != &wq->waiters && woken < nr)
+    {
+        struct wait_entry *entry = lst_entry(node, struct wait_entry, link);
+        node = node->next;
+        if (key != 0 && entry->key != key)
+        {
+            continue;
+        }
+
+        lst_remove(&entry->link);
+        lst_init(&entry->link);
+        struct thread *thread = entry->thread;
+        entry->woken = true;
+
+        // Still under the lock: the sleeper cannot finish and block on
+        // something else before this wakeup lands
+        sched_wakeup(thread);
+        woken++;
+    }
+    release_spinlock(&wq->lock);
+
+    return woken;
+}
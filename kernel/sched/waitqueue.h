@@ -0,0 +1,132 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Wait queues: threads sleep on a queue until another thread or an
+// interrupt wakes them. A sleeper is off every run queue while it waits;
+// waking it hands it to sched_wakeup(), which queues it on a CPU chosen
+// like any other wakeup.
+//
+// The usual loop, which cannot miss a wakeup between the condition check
+// and the sleep:
+//
+//     struct wait_entry entry;
+//     while (1) {
+//         waitqueue_prepare(&wq, &entry, 0);
+//         if (condition)
+//             break;
+//         waitqueue_sleep(&entry);
+//     }
+//     waitqueue_finish(&wq, &entry);
+//
+// wait_event() wraps it.
+//
+
+#ifndef SHIPOS_WAITQUEUE_H
+#define SHIPOS_WAITQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+#include "../list/list.h"
+#include "../sync/spinlock.h"
+
+// Wake every matching waiter, see waitqueue_wake()
+#define WAITQUEUE_WAKE_ALL UINT32_MAX
+
+struct wait_queue
+{
+    struct spinlock lock;   // Protects waiters
+    struct list waiters;    // Queued wait_entry links, oldest first
+};
+
+/**
+ * @brief A sleeping thread's place in a wait queue, usually on its stack
+ */
+struct wait_entry
+{
+    struct list link;       // Points to itself when not queued
+    struct thread *thread;
+    const void *key;        // Matched by waitqueue_wake(), NULL for none
+    volatile bool woken;    // Set by the waker once the entry is dequeued
+};
+
+void waitqueue_init(struct wait_queue *wq, char *name);
+
+/**
+ * @brief Queue the current thread on wq before checking the wait condition
+ *
+ * A wakeup after this call, even one before waitqueue_sleep(), makes the
+ * sleep return at once. Calling it again after a wakeup queues the entry
+ * again. Must be called from a thread.
+ *
+ * @param key Tag for waitqueue_wake(), NULL if the queue does not use keys
+ */
+void waitqueue_prepare(struct wait_queue *wq, struct wait_entry *entry, const void *key);
+
+/**
+ * @brief Block until the entry is woken
+ *
+ * Returns at once if it already was. Interrupts may be enabled or not.
+ */
+void waitqueue_sleep(struct wait_entry *entry);
+
+/**
+ * @brief Like waitqueue_sleep(), but give up after timeout_ns
+ *
+ * @return true if the entry was woken, false if the timeout expired
+ */
+bool waitqueue_sleep_timeout(struct wait_entry *entry, uint64_t timeout_ns);
+
+/**
+ * @brief Take the entry off wq if no waker did; the entry may then go away
+ */
+void waitqueue_finish(struct wait_queue *wq, struct wait_entry *entry);
+
+/**
+ * @brief Wake up to nr waiters whose key matches, oldest first
+ *
+ * Safe from interrupt handlers.
+ *
+ * @param key Key to match, NULL to match every waiter
+ * @return Number of threads woken
+ */
+uint32_t waitqueue_wake(struct wait_queue *wq, uint32_t nr, const void *key);
+
+/**
+ * @brief Wake the oldest waiter, if any
+ */
+static inline bool waitqueue_wake_one(struct wait_queue *wq)
+{
+    return waitqueue_wake(wq, 1, 0) != 0;
+}
+
+/**
+ * @brief Wake every waiter
+ */
+static inline uint32_t waitqueue_wake_all(struct wait_queue *wq)
+{
+    return waitqueue_wake(wq, WAITQUEUE_WAKE_ALL, 0);
+}
+
+/**
+ * @brief Sleep on wq until condition holds
+ *
+ * The condition is evaluated again after every wakeup; whoever makes it
+ * true must wake wq afterwards.
+ */
+#define wait_event(wq, condition)                 \
+    do                                            \
+    {                                             \
+        struct wait_entry __entry;                \
+        while (1)                                 \
+        {                                         \
+            waitqueue_prepare((wq), &__entry, 0); \
+            if (condition)                        \
+                break;                            \
+            waitqueue_sleep(&__entry);            \
+        }                                         \
+        waitqueue_finish((wq), &__entry);         \
+    } while (0)
+
+#endif // SHIPOS_WAITQUEUE_H
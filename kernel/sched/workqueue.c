@@ -0,0 +1,139 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Worker threads. A queued item's pending flag is cleared just before it
+// runs, so it can be queued again from its own function or while it runs.
+//
+
+#include "workqueue.h"
+#include "percpu.h"
+#include "smp_sched.h"
+#include "../lib/include/logging.h"
+
+struct worker workers[MAX_CPUS];
+
+void work_init(struct work *work, void (*function)(void *), void *arg)
+{
+    lst_init(&work->link);
+    work->function = function;
+    work->arg = arg;
+    work->pending = false;
+}
+
+static bool worker_has_work(void *arg)
+{
+    struct worker *worker = arg;
+    return !lst_empty(&worker->queue);
+}
+
+static void worker_thread(void *arg)
+{
+    struct worker *worker = arg;
+
+    while (1)
+    {
+        struct work *work = 0;
+        acquire_spinlock(&worker->lock);
+        if (!lst_empty(&worker->queue))
+        {
+            work = lst_entry(lst_pop(&worker->queue), struct work, link);
+            work->pending = false;
+        }
+        release_spinlock(&worker->lock);
+
+        if (work == 0)
+        {
+            sched_block_unless(worker_has_work, worker);
+            continue;
+        }
+
+        work->function(work->arg);
+        worker->executed++;
+    }
+}
+
+void workqueue_init(void)
+{
+    uint32_t started = 0;
+
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct worker *worker = &workers[i];
+        if (!percpus[i].started || !percpus[i].scheduler_ready || worker->thread != 0)
+            continue;
+
+        init_spinlock(&worker->lock, "worker");
+        lst_init(&worker->queue);
+        worker->cpu = i;
+
+        struct thread *thread = create_thread(worker_thread, 0, 0);
+        if (thread == 0)
+        {
+            LOG_SERIAL("WORK", "No memory for the worker of CPU %d", i);
+            continue;
+        }
+        thread->context->rdi = (uint64_t) worker;
+        cpumask_clear(&thread->cpus_allowed);
+        cpumask_set_cpu(&thread->cpus_allowed, i);
+        sched_add_thread(thread, i);
+        // Published last: queue_work_on() takes a set thread as a ready worker
+        worker->thread = thread;
+        started++;
+    }
+
+    LOG_SERIAL("WORK", "Started %d workers", started);
+}
+
+bool queue_work_on(uint32_t cpu, struct work *work)
+{
+    if (cpu >= ncpu || workers[cpu].thread == 0)
+    {
+        return false;
+    }
+    if (!__sync_bool_compare_and_swap(&work->pending, false, true))
+    {
+        return false;
+    }
+
+    struct worker *worker = &workers[cpu];
+    acquire_spinlock(&worker->lock);
+    lst_push_back(&worker->queue, &work->link);
+    release_spinlock(&worker->lock);
+
+    // A no-op unless the worker is blocked
+    sched_wakeup(worker->thread);
+    return true;
+}
+
+bool queue_work(struct work *work)
+{
+    pushcli();
+    uint32_t self = mycpu()->cpu_index;
+    popcli();
+
+    if (workers[self].thread != 0)
+    {
+        return queue_work_on(self, work);
+    }
+
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        if (workers[i].thread != 0)
+        {
+            return queue_work_on(i, work);
+        }
+    }
+    return false;
+}
+
+void workqueue_log_stats(void)
+{
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        if (workers[i].thread == 0)
+            continue;
+
+        LOG_SERIAL("WORK", "CPU %d: %llu work items run", i, workers[i].executed);
+    }
+}
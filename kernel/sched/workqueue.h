@@ -0,0 +1,83 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Per-CPU workqueues: deferred work run by one pinned worker thread per
+// CPU. Unlike softirqs and timer callbacks, work items run in an ordinary
+// thread, so they may block, sleep and take mutexes. Interrupt handlers
+// queue the part of their job that does not have to happen right away.
+//
+
+#ifndef SHIPOS_WORKQUEUE_H
+#define SHIPOS_WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+#include "../list/list.h"
+#include "../sync/spinlock.h"
+
+/**
+ * @brief A deferred call of function(arg)
+ *
+ * A work item is queued at most once at a time; queueing it again while it
+ * waits is a no-op, queueing it while it runs runs it once more. A zeroed
+ * item with function set may be used without work_init().
+ */
+struct work
+{
+    struct list link;            // Worker queue link
+    void (*function)(void *);
+    void *arg;
+    volatile bool pending;       // Queued and not yet started
+};
+
+/**
+ * @brief Per-CPU worker: one thread that runs that CPU's work items
+ */
+struct worker
+{
+    struct spinlock lock;        // Protects queue
+    struct list queue;           // Work waiting to run, FIFO
+    struct thread *thread;       // Worker thread, pinned to cpu
+    uint32_t cpu;
+    uint64_t executed;           // Work items run
+};
+
+extern struct worker workers[MAX_CPUS];
+
+/**
+ * @brief Start a worker thread on every CPU whose scheduler runs
+ *
+ * CPUs that already have one are skipped, like fiber_init().
+ */
+void workqueue_init(void);
+
+/**
+ * @brief Initialize a work item
+ */
+void work_init(struct work *work, void (*function)(void *), void *arg);
+
+/**
+ * @brief Queue work on the calling CPU's worker
+ *
+ * Callable from interrupt handlers. Before that CPU has a worker, any
+ * CPU's worker is used.
+ *
+ * @return false if the work was already pending or there is no worker yet
+ */
+bool queue_work(struct work *work);
+
+/**
+ * @brief Queue work on the worker of a given CPU
+ *
+ * @return false if the work was already pending or the CPU has no worker
+ */
+bool queue_work_on(uint32_t cpu, struct work *work);
+
+/**
+ * @brief Log worker counters for all CPUs
+ */
+void workqueue_log_stats(void);
+
+#endif // SHIPOS_WORKQUEUE_H
@@ -0,0 +1,58 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+
+#include "futex.h"
+#include "../sched/waitqueue.h"
+
+static struct wait_queue futex_queues[1 << FUTEX_HASH_BITS];
+
+void futex_init(void) {
+    for (int i = 0; i < (1 << FUTEX_HASH_BITS); i++) {
+        waitqueue_init(&futex_queues[i], "futex");
+    }
+}
+
+static struct wait_queue *futex_queue(volatile uint32_t *addr) {
+    // Fibonacci hashing of the word index
+    uint64_t word = (uint64_t) addr >> 2;
+    return &futex_queues[(word * 0x9e3779b97f4a7c15ull) >> (64 - FUTEX_HASH_BITS)];
+}
+
+/**
+ * @brief Queue, compare and sleep; timeout_ns of 0 sleeps without a timeout
+ */
+static bool futex_sleep(volatile uint32_t *addr, uint32_t expected, uint64_t timeout_ns) {
+    struct wait_queue *wq = futex_queue(addr);
+    struct wait_entry entry;
+
+    // Other addresses share the queue; the key keeps their wakeups apart
+    waitqueue_prepare(wq, &entry, (const void *) addr);
+    if (*addr != expected) {
+        waitqueue_finish(wq, &entry);
+        return false;
+    }
+
+    bool woken = true;
+    if (timeout_ns == 0) {
+        waitqueue_sleep(&entry);
+    } else {
+        woken = waitqueue_sleep_timeout(&entry, timeout_ns);
+    }
+    waitqueue_finish(wq, &entry);
+    return woken;
+}
+
+bool futex_wait(volatile uint32_t *addr, uint32_t expected) {
+    return futex_sleep(addr, expected, 0);
+}
+
+bool futex_wait_timeout(volatile uint32_t *addr, uint32_t expected, uint64_t timeout_ns) {
+    // A zero timeout must not turn into an unbounded sleep
+    return futex_sleep(addr, expected, timeout_ns != 0 ? timeout_ns : 1);
+}
+
+uint32_t futex_wake(volatile uint32_t *addr, uint32_t nr) {
+    return waitqueue_wake(futex_queue(addr), nr, (const void *) addr);
+}
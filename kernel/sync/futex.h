@@ -0,0 +1,50 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Futex-style wait on an address. A thread sleeps while a 32-bit word
+// still holds the value it expects; whoever changes the word wakes it.
+// Primitives built on it keep their fast path in atomics on the word and
+// only reach the wait queues when contended.
+//
+
+#ifndef SHIPOS_FUTEX_H
+#define SHIPOS_FUTEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Wait queues the addresses are hashed into
+#define FUTEX_HASH_BITS 6
+
+/**
+ * @brief Initialize the futex hash table
+ */
+void futex_init(void);
+
+/**
+ * @brief Sleep until woken if *addr still equals expected
+ *
+ * The comparison happens after the thread is queued, so a futex_wake()
+ * that follows a change of *addr is never missed. Wakeups are advisory:
+ * the caller must check the word again. Must be called from a thread.
+ *
+ * @return true if the thread slept, false if *addr differed
+ */
+bool futex_wait(volatile uint32_t *addr, uint32_t expected);
+
+/**
+ * @brief Like futex_wait(), but give up after timeout_ns
+ *
+ * @return true if woken, false if *addr differed or the timeout expired
+ */
+bool futex_wait_timeout(volatile uint32_t *addr, uint32_t expected, uint64_t timeout_ns);
+
+/**
+ * @brief Wake up to nr threads waiting on addr
+ *
+ * @return Number of threads woken
+ */
+uint32_t futex_wake(volatile uint32_t *addr, uint32_t nr);
+
+#endif //SHIPOS_FUTEX_H
@@ -2,60 +2,80 @@
 // Created by ShipOS developers on 03.01.24.
 // Copyright (c) 2024 SHIPOS. All rights reserved.
 //
-// Simple mutex implementation for ShipOS kernel.
-// Uses an underlying spinlock and a thread waiting list for blocking.
+// Futex-based mutex implementation for ShipOS kernel.
+// The state word says whether the mutex is held and whether anyone may be
+// sleeping on it, so an uncontended release wakes nobody.
 //
 
 #include "mutex.h"
+#include "futex.h"
+#include "../lib/include/panic.h"
+#include "../lib/include/x86_64.h"
+#include "../time/timer.h"
 
 int init_mutex(struct mutex *lk, char *name) {
-    lk->spinlock = kalloc();
-
-    // Initialize waiting thread list to empty
-    lk->thread_list = 0;
-    init_spinlock(lk->spinlock, name);
+    lk->state = 0;
+    lk->name = name;
+    return 0;
 }
 
 void acquire_mutex(struct mutex *lk) {
-
     if (lk == 0) {
-        panic("panic in acquire_mutex");
+        panic("acquire_mutex: null mutex");
     }
 
-    check_mutex:
-    int locked = holding_spinlock(lk->spinlock);
-    if (locked == 0) {
-        acquire_spinlock(lk->spinlock);
+    uint32_t c = __sync_val_compare_and_swap(&lk->state, 0, 1);
+    if (c == 0) {
         return;
-    } else {
-        // Mutex is locked, add current thread to wait list
-        push_thread_list(&lk->thread_list, current_cpu.current_thread);
-        change_thread_state(current_cpu.current_thread, WAIT);
+    }
+
+    // Contended: mark the mutex as having waiters, then sleep until a
+    // release leaves it unlocked. Taking it after a sleep also sets 2, as
+    // other sleepers may remain.
+    if (c != 2) {
+        c = __sync_lock_test_and_set(&lk->state, 2);
+    }
+    while (c != 0) {
+        futex_wait(&lk->state, 2);
+        c = __sync_lock_test_and_set(&lk->state, 2);
+    }
+}
 
-        yield();
+int acquire_mutex_timeout(struct mutex *lk, uint64_t timeout_ns) {
+    if (lk == 0) {
+        panic("acquire_mutex_timeout: null mutex");
+    }
 
-        // Ensure spinlock is free before retrying
-        if(holding_spinlock(lk->spinlock) != 0)
-            panic("acquire_mutex: spinlock in not free");
-        goto check_mutex;
+    uint32_t c = __sync_val_compare_and_swap(&lk->state, 0, 1);
+    if (c == 0) {
+        return 1;
     }
-};
 
-void release_mutex(struct mutex *lk) {
-    if (lk->spinlock->is_locked == 0) {
-        panic("release_mutex");
+    uint64_t deadline = rdtsc() + timer_ns_to_tsc(timeout_ns);
+    if (c != 2) {
+        c = __sync_lock_test_and_set(&lk->state, 2);
     }
-    if (lk->thread_list == 0) {
-        // No waiting threads: simply release spinlock
-        release_spinlock(lk->spinlock);
-        return;
-    } else {
-        // Wake up one waiting thread
-        struct thread *thread = pop_thread_list(&lk->thread_list);
-        change_thread_state(thread, RUNNABLE);
+    while (c != 0) {
+        uint64_t now = rdtsc();
+        if (now >= deadline) {
+            // Leaving 2 behind is harmless: the holder's release then
+            // wakes someone who may not be there
+            return 0;
+        }
+        futex_wait_timeout(&lk->state, 2, timer_tsc_to_ns(deadline - now));
+        c = __sync_lock_test_and_set(&lk->state, 2);
     }
+    return 1;
 }
 
-void destroy_mutex(struct mutex *lk) {
-    kfree(lk);
+void release_mutex(struct mutex *lk) {
+    if (lk->state == 0) {
+        panic("release_mutex: not locked");
+    }
+    if (__sync_fetch_and_sub(&lk->state, 1) != 1) {
+        // Someone may be sleeping
+        lk->state = 0;
+        __sync_synchronize();
+        futex_wake(&lk->state, 1);
+    }
 }
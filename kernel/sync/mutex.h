@@ -9,44 +9,49 @@
 #ifndef UNTITLED_OS_MUTEX_H
 #define UNTITLED_OS_MUTEX_H
 
-#include "spinlock.h"
-#include "../sched/threads.h"
-#include "../kalloc/kalloc.h"
-#include "../sched/scheduler.h"
+#include <stdint.h>
 
 /**
  * @brief Mutex structure
  * 
- * Combines a low-level spinlock with a waiting thread list.
- * Threads attempting to acquire a locked mutex will be blocked
- * and added to the thread_list.
+ * A futex word: acquiring an unlocked mutex is one compare-and-swap.
+ * Threads attempting to acquire a locked mutex sleep in futex_wait()
+ * until a release wakes one of them.
  */
 struct mutex {
-    struct spinlock *spinlock;   ///< underlying spinlock protecting the mutex
-    struct thread_node *thread_list; ///< linked list of threads waiting for this mutex
+    volatile uint32_t state; ///< 0 unlocked, 1 locked, 2 locked and maybe contended
+    char *name;              ///< name for debugging
 };
 
 /**
  * @brief Initialize a mutex
  * @param lk Pointer to the mutex
- * @param name Name for internal spinlock (for debugging)
+ * @param name Name for debugging
  * @return 0 on success (currently unused)
  */
 int init_mutex(struct mutex *lk, char *name);
 
 /**
  * @brief Acquire the mutex
- * Blocks the current thread if mutex is already held.
+ * Blocks the current thread if mutex is already held. Contended
+ * acquisition must happen in a thread, not an interrupt handler.
  * @param lk Pointer to the mutex
  */
 void acquire_mutex(struct mutex *lk);
 
+/**
+ * @brief Acquire the mutex, giving up after timeout_ns
+ * @param lk Pointer to the mutex
+ * @param timeout_ns Longest time to wait
+ * @return 1 if the mutex was acquired, 0 on timeout
+ */
+int acquire_mutex_timeout(struct mutex *lk, uint64_t timeout_ns);
+
 /**
  * @brief Release the mutex
- * Wakes up a waiting thread if any; otherwise, releases the spinlock.
+ * Wakes up a waiting thread if any.
  * @param lk Pointer to the mutex
  */
 void release_mutex(struct mutex *lk);
 
 #endif //UNTITLED_OS_MUTEX_H
-
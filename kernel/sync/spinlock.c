@@ -14,6 +14,7 @@ void init_spinlock(struct spinlock *lock, char *name) {
 //bool function
 void acquire_spinlock(struct spinlock *lk) {
     pushcli(); // disable interrupts to avoid deadlock.
+    preempt_disable();
 //    if (holding_spinlock(lk)) {
 //        popcli();
 //        return 1;
@@ -29,6 +30,20 @@ void acquire_spinlock(struct spinlock *lk) {
     return;
 }
 
+int try_acquire_spinlock(struct spinlock *lk) {
+    pushcli();
+    preempt_disable();
+
+    if (xchg((void *) &lk->is_locked, 1) != 0) {
+        preempt_enable();
+        popcli();
+        return 0;
+    }
+
+    __sync_synchronize();
+    return 1;
+}
+
 void release_spinlock(struct spinlock *lk) {
     if (!holding_spinlock(lk))
         panic("release_spinlock");
@@ -45,6 +60,7 @@ void release_spinlock(struct spinlock *lk) {
     // not be atomic. A real OS would use C atomics here.
     asm volatile("movl $0, %0" : "+m" (lk->is_locked) : );
 
+    preempt_enable();
     popcli();
 }
 
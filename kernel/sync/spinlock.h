@@ -8,18 +8,24 @@
 
 //#include "../lib/include/stdint.h"
 #include <inttypes.h>
-#include "../sched/proc.h"
-#include "../lib/include/x86_64.h"
 
+// Defined before the includes below: percpu.h embeds a spinlock and is
+// reached again through proc.h
 struct spinlock {
     uint8_t is_locked;
     char *name;
 };
 
+#include "../sched/proc.h"
+#include "../lib/include/x86_64.h"
+
 void init_spinlock(struct spinlock *lock, char *name);
 
 void acquire_spinlock(struct spinlock *lk);
 
+// Returns 1 and holds the lock on success, 0 without spinning if it is taken
+int try_acquire_spinlock(struct spinlock *lk);
+
 void release_spinlock(struct spinlock *lk);
 
 int holding_spinlock(struct spinlock *lock);
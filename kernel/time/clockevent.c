@@ -0,0 +1,153 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// LAPIC clock-event devices and their calibration.
+//
+
+#include "clockevent.h"
+#include "../apic/lapic.h"
+#include "../idt/idt.h"
+#include "../pit/pit.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+#include "../lib/include/panic.h"
+
+static uint64_t tsc_per_ms;
+static uint64_t lapic_per_ms;
+static struct clock_event_device *device;
+
+// ============================================================================
+// LAPIC one-shot
+// ============================================================================
+
+static void lapic_oneshot_enable(void)
+{
+    lapic_write(LAPIC_TIMER_DCR, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_TIMER, LAPIC_TIMER_ONESHOT | APIC_TIMER_VECTOR);
+}
+
+static void lapic_oneshot_set_next_event(uint64_t deadline)
+{
+    uint64_t now = rdtsc();
+    uint64_t delta = deadline > now ? deadline - now : 0;
+
+    // A zero initial count stops the timer, so always arm at least one count
+    uint64_t count = delta * lapic_per_ms / tsc_per_ms;
+    if (count == 0)
+    {
+        count = 1;
+    }
+    if (count > UINT32_MAX)
+    {
+        count = UINT32_MAX;
+    }
+    lapic_write(LAPIC_TIMER_ICR, (uint32_t) count);
+}
+
+static void lapic_oneshot_shutdown(void)
+{
+    lapic_write(LAPIC_TIMER_ICR, 0);
+}
+
+static struct clock_event_device lapic_oneshot = {
+    .name = "lapic-oneshot",
+    .mode = CLOCK_EVT_ONESHOT,
+    .enable = lapic_oneshot_enable,
+    .set_next_event = lapic_oneshot_set_next_event,
+    .shutdown = lapic_oneshot_shutdown,
+};
+
+// ============================================================================
+// LAPIC TSC-deadline
+// ============================================================================
+
+static void lapic_deadline_enable(void)
+{
+    lapic_write(LAPIC_TIMER, LAPIC_TIMER_TSC_DEADLINE | APIC_TIMER_VECTOR);
+
+    // The LVT write must be visible before the first deadline MSR write
+    asm volatile("mfence" ::: "memory");
+}
+
+static void lapic_deadline_set_next_event(uint64_t deadline)
+{
+    // Writing 0 disarms the timer; a deadline in the past fires at once
+    wrmsr(MSR_IA32_TSC_DEADLINE, deadline != 0 ? deadline : 1);
+}
+
+static void lapic_deadline_shutdown(void)
+{
+    wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+}
+
+static struct clock_event_device lapic_deadline = {
+    .name = "lapic-tsc-deadline",
+    .mode = CLOCK_EVT_TSC_DEADLINE,
+    .enable = lapic_deadline_enable,
+    .set_next_event = lapic_deadline_set_next_event,
+    .shutdown = lapic_deadline_shutdown,
+};
+
+// ============================================================================
+// Calibration
+// ============================================================================
+
+static bool cpu_has_tsc_deadline(void)
+{
+    uint32_t regs[4];
+
+    // CPUID leaf 1: ECX[24] indicates the TSC-deadline timer mode
+    cpuid(1, 0, regs);
+
+    return (regs[2] >> 24) & 1;
+}
+
+/**
+ * @brief Measure the LAPIC timer and TSC rates over a PIT-timed window
+ */
+static void calibrate(void)
+{
+    lapic_write(LAPIC_TIMER_DCR, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_TIMER, LAPIC_TIMER_MASKED | LAPIC_TIMER_ONESHOT);
+    lapic_write(LAPIC_TIMER_ICR, UINT32_MAX);
+    uint64_t tsc_start = rdtsc();
+
+    pit_wait_ms(CLOCKEVENT_CALIBRATE_MS);
+
+    uint32_t remaining = lapic_read(LAPIC_TIMER_CCR);
+    uint64_t tsc_end = rdtsc();
+    lapic_write(LAPIC_TIMER_ICR, 0);
+
+    lapic_per_ms = (UINT32_MAX - remaining) / CLOCKEVENT_CALIBRATE_MS;
+    tsc_per_ms = (tsc_end - tsc_start) / CLOCKEVENT_CALIBRATE_MS;
+}
+
+void clockevent_init(void)
+{
+    calibrate();
+    if (lapic_per_ms == 0 || tsc_per_ms == 0)
+    {
+        panic("clockevent_init: LAPIC timer calibration failed");
+    }
+
+    device = cpu_has_tsc_deadline() ? &lapic_deadline : &lapic_oneshot;
+
+    LOG_SERIAL("TIME", "TSC %llu kHz, LAPIC timer %llu counts/ms (div 16), using %s",
+               tsc_per_ms, lapic_per_ms, device->name);
+}
+
+struct clock_event_device *clockevent_device(void)
+{
+    return device;
+}
+
+uint64_t clockevent_tsc_per_ms(void)
+{
+    return tsc_per_ms;
+}
+
+uint64_t clockevent_lapic_per_ms(void)
+{
+    return lapic_per_ms;
+}
@@ -0,0 +1,66 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Clock-event devices: per-CPU timers that raise APIC_TIMER_VECTOR once
+// at an absolute TSC time. The LAPIC timer is calibrated against the PIT
+// at boot and driven either in one-shot mode or in TSC-deadline mode.
+//
+
+#ifndef SHIPOS_CLOCKEVENT_H
+#define SHIPOS_CLOCKEVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Length of the PIT reference window used for calibration
+#define CLOCKEVENT_CALIBRATE_MS 10
+
+/**
+ * @brief How a clock-event device is programmed
+ */
+enum clock_event_mode
+{
+    CLOCK_EVT_ONESHOT,       // LAPIC initial count, converted from TSC cycles
+    CLOCK_EVT_TSC_DEADLINE   // IA32_TSC_DEADLINE, compared against the TSC directly
+};
+
+/**
+ * @brief A per-CPU one-shot timer
+ *
+ * The same device type is used on every CPU; the operations act on the
+ * LAPIC of the calling CPU.
+ */
+struct clock_event_device
+{
+    const char *name;
+    enum clock_event_mode mode;
+    void (*enable)(void);                    // Set up the timer on this CPU
+    void (*set_next_event)(uint64_t deadline); // Fire once when the TSC reaches deadline
+    void (*shutdown)(void);                  // Cancel a pending event
+};
+
+/**
+ * @brief Calibrate the LAPIC timer and TSC and select a device
+ *
+ * Called once on the BSP with interrupts disabled. Prefers TSC-deadline
+ * mode when CPUID reports it, otherwise uses LAPIC one-shot mode.
+ */
+void clockevent_init(void);
+
+/**
+ * @brief Device selected by clockevent_init()
+ */
+struct clock_event_device *clockevent_device(void);
+
+/**
+ * @brief TSC cycles per millisecond measured against the PIT
+ */
+uint64_t clockevent_tsc_per_ms(void);
+
+/**
+ * @brief LAPIC timer counts per millisecond (divide by 16)
+ */
+uint64_t clockevent_lapic_per_ms(void);
+
+#endif // SHIPOS_CLOCKEVENT_H
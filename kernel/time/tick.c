@@ -0,0 +1,158 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Scheduler tick and dynamic ticks.
+//
+
+#include "tick.h"
+#include "clockevent.h"
+#include "timer.h"
+#include "../sched/percpu.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+
+static bool nohz_enabled = true;
+
+static uint64_t tick_period(void)
+{
+    return clockevent_tsc_per_ms() * 1000 / TICK_HZ;
+}
+
+/**
+ * @brief Move tick_next_tsc past now
+ *
+ * @return Number of tick boundaries crossed
+ */
+static uint64_t advance_tick(struct percpu *cpu, uint64_t now)
+{
+    if (now < cpu->tick_next_tsc)
+    {
+        return 0;
+    }
+
+    uint64_t period = tick_period();
+    uint64_t ticks = (now - cpu->tick_next_tsc) / period + 1;
+    cpu->tick_next_tsc += ticks * period;
+    return ticks;
+}
+
+/**
+ * @brief Arm the device for the next tick boundary or an earlier timer
+ */
+static void program_next_event(struct percpu *cpu)
+{
+    uint64_t deadline = cpu->tick_next_tsc;
+    if (cpu->timer_expiry_tsc != 0 && cpu->timer_expiry_tsc < deadline)
+    {
+        deadline = cpu->timer_expiry_tsc;
+    }
+    clockevent_device()->set_next_event(deadline);
+}
+
+void tick_init_cpu(void)
+{
+    struct percpu *cpu = mycpu();
+    struct clock_event_device *dev = clockevent_device();
+
+    dev->enable();
+    cpu->tick_stopped = false;
+    cpu->timer_expiry_tsc = 0;
+    cpu->tick_next_tsc = rdtsc() + tick_period();
+    timer_init_cpu();
+    dev->set_next_event(cpu->tick_next_tsc);
+
+    LOG_SERIAL("TIME", "CPU %d tick started at %d Hz", cpu->cpu_index, TICK_HZ);
+}
+
+uint64_t tick_handle_interrupt(void)
+{
+    struct percpu *cpu = mycpu();
+
+    // A tickless sleep ended; tick_nohz_idle_exit() restarts the tick
+    if (cpu->tick_stopped)
+    {
+        return 0;
+    }
+
+    // Re-arm relative to the previous boundary, not to now, so the tick
+    // does not drift by the interrupt latency
+    uint64_t ticks = advance_tick(cpu, rdtsc());
+    program_next_event(cpu);
+    return ticks;
+}
+
+void tick_timer_changed(void)
+{
+    struct percpu *cpu = mycpu();
+
+    // A stopped tick is re-armed with the new expiry when the idle
+    // thread goes back to sleep after this interrupt
+    if (!cpu->tick_stopped)
+    {
+        program_next_event(cpu);
+    }
+}
+
+void tick_nohz_idle_enter(void)
+{
+    struct percpu *cpu = mycpu();
+
+    if (!nohz_enabled || cpu->tick_stopped)
+    {
+        return;
+    }
+
+    uint64_t expiry = rdtsc() + TICK_NOHZ_MAX_IDLE * tick_period();
+    if (cpu->timer_expiry_tsc != 0 && cpu->timer_expiry_tsc < expiry)
+    {
+        expiry = cpu->timer_expiry_tsc;
+    }
+
+    // Nothing to do before the next tick anyway
+    if (expiry <= cpu->tick_next_tsc)
+    {
+        return;
+    }
+
+    cpu->tick_stopped = true;
+    cpu->nohz_entries++;
+    clockevent_device()->set_next_event(expiry);
+}
+
+void tick_nohz_idle_exit(void)
+{
+    struct percpu *cpu = mycpu();
+
+    if (!cpu->tick_stopped)
+    {
+        return;
+    }
+
+    cpu->tick_stopped = false;
+    uint64_t ticks = advance_tick(cpu, rdtsc());
+    cpu->timer_ticks += ticks;
+    cpu->nohz_skipped_ticks += ticks;
+    program_next_event(cpu);
+}
+
+void tick_set_nohz(bool enabled)
+{
+    nohz_enabled = enabled;
+    LOG_SERIAL("TIME", "Dynamic ticks %s", enabled ? "enabled" : "disabled");
+}
+
+void tick_log_stats(void)
+{
+    LOG_SERIAL("TIME", "=== Tick State ===");
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct percpu *cpu = &percpus[i];
+        if (!cpu->started)
+            continue;
+
+        LOG_SERIAL("TIME", "CPU %d: %llu ticks, %llu tickless idle periods, %llu ticks skipped",
+                   i, cpu->timer_ticks, cpu->nohz_entries, cpu->nohz_skipped_ticks);
+    }
+    LOG_SERIAL("TIME", "==================");
+}
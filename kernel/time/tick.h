@@ -0,0 +1,72 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Scheduler tick and dynamic ticks. The periodic tick is emulated on top
+// of the one-shot clock-event device; idle CPUs stop it and sleep until
+// their next timer expiry instead of waking TICK_HZ times a second.
+//
+
+#ifndef SHIPOS_TICK_H
+#define SHIPOS_TICK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Scheduler tick rate
+#define TICK_HZ 100
+
+// Longest tickless sleep, in ticks. Idle CPUs still wake this often so
+// they can steal work from busy siblings.
+#define TICK_NOHZ_MAX_IDLE 100
+
+/**
+ * @brief Start the tick and the timer wheel on the calling CPU
+ *
+ * clockevent_init() must have run on the BSP.
+ */
+void tick_init_cpu(void);
+
+/**
+ * @brief Account a timer interrupt
+ *
+ * Re-arms the device for the next tick boundary, or for this CPU's
+ * timer_expiry_tsc if that comes first. Returns the number of tick periods
+ * that elapsed, 0 for an early or tickless wakeup.
+ */
+uint64_t tick_handle_interrupt(void);
+
+/**
+ * @brief Re-arm the device after timer_expiry_tsc moved earlier
+ *
+ * Called by timer_add() with interrupts disabled.
+ */
+void tick_timer_changed(void);
+
+/**
+ * @brief Stop the tick before the idle thread halts
+ *
+ * Programs the device for the earliest of this CPU's timer_expiry_tsc
+ * and TICK_NOHZ_MAX_IDLE ticks from now. Called with interrupts disabled.
+ */
+void tick_nohz_idle_enter(void);
+
+/**
+ * @brief Restart the tick after an idle wakeup
+ *
+ * Credits the ticks slept through to timer_ticks and re-arms the device
+ * at the next tick boundary. Called with interrupts disabled.
+ */
+void tick_nohz_idle_exit(void);
+
+/**
+ * @brief Enable or disable dynamic ticks on idle CPUs
+ */
+void tick_set_nohz(bool enabled);
+
+/**
+ * @brief Log tick and tickless-idle counters for all CPUs
+ */
+void tick_log_stats(void);
+
+#endif // SHIPOS_TICK_H
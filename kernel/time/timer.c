@@ -0,0 +1,426 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Hierarchical timing wheel. Level L slot i holds timers expiring within
+// [i << (L * TIMER_LVL_BITS), (i + 1) << (L * TIMER_LVL_BITS)) of wheel
+// time, counted modulo the level's span; whenever the level-0 index wraps
+// to 0, the current slot of level 1 is re-sorted into the levels below,
+// and so on upwards while those indices wrap too.
+//
+
+#include "timer.h"
+#include "tick.h"
+#include "clockevent.h"
+#include "../sched/percpu.h"
+#include "../sched/smp_sched.h"
+#include "../sched/softirq.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+#include "../lib/include/panic.h"
+
+struct timer_base timer_bases[MAX_CPUS];
+
+// TSC cycles per wheel time unit
+static uint64_t timer_unit_tsc;
+
+// Longest delay the top level can hold
+#define TIMER_MAX_DELTA ((1ull << (TIMER_LEVELS * TIMER_LVL_BITS)) - 1)
+
+uint64_t timer_ns_to_tsc(uint64_t ns)
+{
+    uint64_t per_ms = clockevent_tsc_per_ms();
+    return (ns / 1000000) * per_ms + (ns % 1000000) * per_ms / 1000000;
+}
+
+uint64_t timer_tsc_to_ns(uint64_t tsc)
+{
+    uint64_t per_ms = clockevent_tsc_per_ms();
+    return (tsc / per_ms) * 1000000 + (tsc % per_ms) * 1000000 / per_ms;
+}
+
+void timer_init_cpu(void)
+{
+    struct percpu *cpu = mycpu();
+    struct timer_base *base = &timer_bases[cpu->cpu_index];
+
+    if (timer_unit_tsc == 0)
+    {
+        timer_unit_tsc = clockevent_tsc_per_ms() * TIMER_WHEEL_RES_US / 1000;
+        softirq_open(SOFTIRQ_TIMER, timer_run);
+    }
+
+    init_spinlock(&base->lock, "timer");
+    for (int level = 0; level < TIMER_LEVELS; level++)
+    {
+        for (int i = 0; i < TIMER_LVL_SIZE; i++)
+        {
+            lst_init(&base->wheel[level][i]);
+        }
+    }
+    base->clk = rdtsc() / timer_unit_tsc;
+    base->running = 0;
+    base->nr_timers = 0;
+    base->ready = true;
+}
+
+void timer_setup(struct timer *timer, void (*function)(void *), void *arg)
+{
+    lst_init(&timer->link);
+    timer->function = function;
+    timer->arg = arg;
+    timer->cpu = 0;
+    timer->pending = false;
+}
+
+/**
+ * @brief Put a timer in the slot for its expiry (caller holds base->lock)
+ */
+static void enqueue_timer(struct timer_base *base, struct timer *timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires < base->clk)
+    {
+        // Already due: run at the next wheel time processed
+        expires = base->clk;
+    }
+
+    uint64_t delta = expires - base->clk;
+    if (delta > TIMER_MAX_DELTA)
+    {
+        expires = base->clk + TIMER_MAX_DELTA;
+        delta = TIMER_MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ull << ((level + 1) * TIMER_LVL_BITS)))
+    {
+        level++;
+    }
+
+    uint32_t index = (expires >> (level * TIMER_LVL_BITS)) & TIMER_LVL_MASK;
+    lst_push_back(&base->wheel[level][index], &timer->link);
+}
+
+/**
+ * @brief Re-sort the current slot of a level into the levels below
+ *
+ * @return The slot index, 0 if the next level up is due as well
+ */
+static uint32_t cascade(struct timer_base *base, int level)
+{
+    uint32_t index = (base->clk >> (level * TIMER_LVL_BITS)) & TIMER_LVL_MASK;
+    struct list *slot = &base->wheel[level][index];
+
+    while (!lst_empty(slot))
+    {
+        struct timer *timer = lst_entry(lst_pop(slot), struct timer, link);
+        enqueue_timer(base, timer);
+        base->cascaded++;
+    }
+    return index;
+}
+
+/**
+ * @brief Earliest wheel time at which a slot needs processing
+ *
+ * For an upper level that is when its next non-empty slot is cascaded,
+ * which may be well before its timers expire. Caller holds base->lock.
+ *
+ * @return Wheel time, or 0 if there are no timers
+ */
+static uint64_t next_event(struct timer_base *base)
+{
+    if (base->nr_timers == 0)
+    {
+        return 0;
+    }
+
+    uint64_t best = UINT64_MAX;
+    for (uint32_t i = 0; i < TIMER_LVL_SIZE; i++)
+    {
+        if (!lst_empty(&base->wheel[0][(base->clk + i) & TIMER_LVL_MASK]))
+        {
+            best = base->clk + i;
+            break;
+        }
+    }
+
+    for (int level = 1; level < TIMER_LEVELS; level++)
+    {
+        uint32_t shift = level * TIMER_LVL_BITS;
+        uint64_t lclk = base->clk >> shift;
+        // The current slot of an upper level comes up again last
+        for (uint32_t j = 1; j <= TIMER_LVL_SIZE; j++)
+        {
+            if (!lst_empty(&base->wheel[level][(lclk + j) & TIMER_LVL_MASK]))
+            {
+                uint64_t when = (lclk + j) << shift;
+                if (when < best)
+                {
+                    best = when;
+                }
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Round an expiry up within its slack to as coarse a boundary as fits
+ *
+ * Timers with overlapping slack windows then tend to share a slot.
+ */
+static uint64_t apply_slack(uint64_t expires, uint64_t slack)
+{
+    if (slack == 0)
+    {
+        return expires;
+    }
+
+    uint64_t limit = expires + slack;
+    uint64_t diff = expires ^ limit;
+    int bit = 63;
+    while ((diff >> bit) == 0)
+    {
+        bit--;
+    }
+    return limit & ~((1ull << bit) - 1);
+}
+
+/**
+ * @brief Take a timer off its wheel without waiting for its callback
+ *
+ * @return true if it was pending
+ */
+static bool detach_timer(struct timer *timer)
+{
+    while (1)
+    {
+        uint32_t cpu = timer->cpu;
+        struct timer_base *base = &timer_bases[cpu];
+
+        acquire_spinlock(&base->lock);
+        if (timer->cpu != cpu)
+        {
+            // Re-added on another CPU meanwhile
+            release_spinlock(&base->lock);
+            continue;
+        }
+
+        bool pending = timer->pending;
+        if (pending)
+        {
+            lst_remove(&timer->link);
+            lst_init(&timer->link);
+            timer->pending = false;
+            base->nr_timers--;
+        }
+        release_spinlock(&base->lock);
+        return pending;
+    }
+}
+
+void timer_add(struct timer *timer, uint64_t delay_ns, uint64_t slack_ns)
+{
+    if (timer->pending)
+    {
+        detach_timer(timer);
+    }
+
+    pushcli();
+    struct percpu *cpu = mycpu();
+    struct timer_base *base = &timer_bases[cpu->cpu_index];
+    if (!base->ready)
+    {
+        panic("timer_add: no timer wheel on this CPU");
+    }
+
+    // Expire at the first wheel time that starts after the deadline
+    uint64_t deadline = rdtsc() + timer_ns_to_tsc(delay_ns);
+    uint64_t expires = (deadline + timer_unit_tsc - 1) / timer_unit_tsc;
+    expires = apply_slack(expires, timer_ns_to_tsc(slack_ns) / timer_unit_tsc);
+
+    acquire_spinlock(&base->lock);
+    // timer_run() only advances an empty wheel's clock when it runs, which
+    // stops with the last timer; catch up so the delta is taken from now
+    if (base->nr_timers == 0)
+    {
+        base->clk = rdtsc() / timer_unit_tsc;
+    }
+    timer->expires = expires;
+    timer->cpu = cpu->cpu_index;
+    timer->pending = true;
+    enqueue_timer(base, timer);
+    base->nr_timers++;
+
+    uint64_t when = next_event(base) * timer_unit_tsc;
+    bool earlier = cpu->timer_expiry_tsc == 0 || when < cpu->timer_expiry_tsc;
+    cpu->timer_expiry_tsc = when;
+    release_spinlock(&base->lock);
+
+    if (earlier)
+    {
+        tick_timer_changed();
+    }
+    popcli();
+}
+
+bool timer_cancel(struct timer *timer)
+{
+    bool pending = detach_timer(timer);
+
+    // Callbacks run with preemption disabled and are short
+    while (timer_bases[timer->cpu].running == timer)
+    {
+        asm volatile("pause");
+    }
+    return pending;
+}
+
+bool timer_irq_due(void)
+{
+    struct percpu *cpu = mycpu();
+
+    if (cpu->timer_expiry_tsc == 0 || rdtsc() < cpu->timer_expiry_tsc)
+    {
+        return false;
+    }
+
+    // Not armed again until timer_run() has looked at the wheel
+    cpu->timer_expiry_tsc = 0;
+    softirq_raise(SOFTIRQ_TIMER);
+    return true;
+}
+
+void timer_run(void)
+{
+    struct percpu *cpu = mycpu();
+    struct timer_base *base = &timer_bases[cpu->cpu_index];
+
+    if (!base->ready)
+    {
+        return;
+    }
+
+    uint64_t now = rdtsc() / timer_unit_tsc;
+    uint64_t expired = 0;
+
+    acquire_spinlock(&base->lock);
+    while (base->clk <= now)
+    {
+        if (base->nr_timers == 0)
+        {
+            base->clk = now + 1;
+            break;
+        }
+
+        uint32_t index = base->clk & TIMER_LVL_MASK;
+        if (index == 0)
+        {
+            for (int level = 1; level < TIMER_LEVELS; level++)
+            {
+                if (cascade(base, level) != 0)
+                {
+                    break;
+                }
+            }
+        }
+        base->clk++;
+
+        // Timers re-added by a callback land in later slots, so this one
+        // drains; the lock is dropped around every callback
+        struct list *slot = &base->wheel[0][index];
+        while (!lst_empty(slot))
+        {
+            struct timer *timer = lst_entry(lst_pop(slot), struct timer, link);
+            lst_init(&timer->link);
+            timer->pending = false;
+            base->nr_timers--;
+            base->running = timer;
+            release_spinlock(&base->lock);
+
+            timer->function(timer->arg);
+
+            acquire_spinlock(&base->lock);
+            base->running = 0;
+            expired++;
+        }
+    }
+
+    cpu->timer_expiry_tsc = next_event(base) * timer_unit_tsc;
+    base->expired += expired;
+    if (expired != 0)
+    {
+        base->expiry_runs++;
+    }
+
+    // The interrupt that raised this re-armed the device for the tick only
+    if (cpu->timer_expiry_tsc != 0)
+    {
+        tick_timer_changed();
+    }
+    release_spinlock(&base->lock);
+}
+
+struct sleep_timer
+{
+    struct timer timer;
+    struct thread *thread;
+    volatile bool expired;
+};
+
+static void sleep_timer_func(void *arg)
+{
+    struct sleep_timer *sleep = arg;
+    sleep->expired = true;
+    sched_wakeup(sleep->thread);
+}
+
+static bool sleep_expired(void *arg)
+{
+    struct sleep_timer *sleep = arg;
+    return sleep->expired;
+}
+
+void thread_sleep_ns(uint64_t ns)
+{
+    struct sleep_timer sleep;
+
+    pushcli();
+    sleep.thread = mycpu()->current_thread;
+    popcli();
+    if (sleep.thread == 0)
+    {
+        panic("thread_sleep_ns: not in a thread");
+    }
+
+    sleep.expired = false;
+    timer_setup(&sleep.timer, sleep_timer_func, &sleep);
+    timer_add(&sleep.timer, ns, ns >> TIMER_SLEEP_SLACK_SHIFT);
+
+    // Other wakeups return early; keep sleeping until the timer fires
+    while (!sleep.expired)
+    {
+        sched_block_unless(sleep_expired, &sleep);
+    }
+
+    // The callback may still be finishing on the timer's CPU
+    timer_cancel(&sleep.timer);
+}
+
+void timer_log_stats(void)
+{
+    LOG_SERIAL("TIME", "=== Timer State ===");
+    for (uint32_t i = 0; i < ncpu; i++)
+    {
+        struct timer_base *base = &timer_bases[i];
+        if (!percpus[i].started || !base->ready)
+            continue;
+
+        LOG_SERIAL("TIME", "CPU %d: %d pending timers, %llu expired in %llu interrupts, %llu cascaded",
+                   i, base->nr_timers, base->expired, base->expiry_runs, base->cascaded);
+    }
+    LOG_SERIAL("TIME", "===================");
+}
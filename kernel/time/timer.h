@@ -0,0 +1,137 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Timers on a per-CPU hierarchical timing wheel. Adding and cancelling a
+// timer are O(1) list operations; timers further out sit on coarser
+// levels and are cascaded down as their slot comes up. The wheel is run
+// in the TIMER softirq, raised by the timer interrupt the tick code arms
+// for the earlier of the next tick and the next timer, so timers work on
+// tickless idle CPUs.
+//
+// Expiries are rounded to TIMER_WHEEL_RES_US. A timer's slack lets it fire
+// later by up to that much, picked so that nearby timers land in the same
+// wheel slot and expire in one interrupt.
+//
+
+#ifndef SHIPOS_TIMER_H
+#define SHIPOS_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../list/list.h"
+#include "../sync/spinlock.h"
+
+// Wheel resolution
+#define TIMER_WHEEL_RES_US 1000
+
+// Levels of 2^TIMER_LVL_BITS slots each; every level is that many times
+// coarser than the one below. Four levels cover about 4.6 hours, longer
+// timers are clamped.
+#define TIMER_LVL_BITS 6
+#define TIMER_LVL_SIZE (1 << TIMER_LVL_BITS)
+#define TIMER_LVL_MASK (TIMER_LVL_SIZE - 1)
+#define TIMER_LEVELS   4
+
+// Default slack of thread_sleep_ns(): the duration shifted right by this
+#define TIMER_SLEEP_SLACK_SHIFT 5
+
+/**
+ * @brief A one-shot callback timer
+ *
+ * The callback runs in the TIMER softirq of the CPU the timer was added
+ * on, with interrupts enabled and preemption disabled. It must not block;
+ * it may add timers, including itself.
+ */
+struct timer
+{
+    struct list link;            // Wheel slot link
+    uint64_t expires;            // Wheel time, in TIMER_WHEEL_RES_US units
+    void (*function)(void *);
+    void *arg;
+    uint32_t cpu;                // Wheel the timer was last added to
+    bool pending;                // Queued and not yet expired
+};
+
+/**
+ * @brief Per-CPU timing wheel
+ */
+struct timer_base
+{
+    struct spinlock lock;        // Protects everything below
+    bool ready;                  // Set up by timer_init_cpu()
+    uint64_t clk;                // Next wheel time to process
+    struct timer *volatile running; // Timer whose callback is running
+    uint32_t nr_timers;          // Pending timers
+    struct list wheel[TIMER_LEVELS][TIMER_LVL_SIZE];
+    uint64_t expired;            // Callbacks run
+    uint64_t expiry_runs;        // Interrupts that expired at least one timer
+    uint64_t cascaded;           // Timers moved down a level
+};
+
+extern struct timer_base timer_bases[];
+
+/**
+ * @brief Set up this CPU's wheel, called by tick_init_cpu()
+ */
+void timer_init_cpu(void);
+
+/**
+ * @brief Initialize a timer; it may then be added any number of times
+ */
+void timer_setup(struct timer *timer, void (*function)(void *), void *arg);
+
+/**
+ * @brief Start a timer on the calling CPU, or restart it if pending
+ *
+ * @param delay_ns Run the callback no earlier than this from now
+ * @param slack_ns How much later it may run so that it coalesces
+ */
+void timer_add(struct timer *timer, uint64_t delay_ns, uint64_t slack_ns);
+
+/**
+ * @brief Stop a timer and wait for its callback if it is running
+ *
+ * Afterwards the timer's memory may be reused. Must not be called from
+ * the timer's own callback.
+ *
+ * @return true if the timer was pending
+ */
+bool timer_cancel(struct timer *timer);
+
+/**
+ * @brief Raise the TIMER softirq if this CPU's next timer is due
+ *
+ * Called from every timer interrupt. Clears timer_expiry_tsc so that the
+ * interrupt re-arms the device for the tick alone.
+ *
+ * @return true if the softirq was raised
+ */
+bool timer_irq_due(void);
+
+/**
+ * @brief Run this CPU's expired timers, the TIMER softirq handler
+ *
+ * Updates timer_expiry_tsc and re-arms the device for it.
+ */
+void timer_run(void);
+
+/**
+ * @brief Block the current thread for at least ns nanoseconds
+ *
+ * Uses a slack of ns >> TIMER_SLEEP_SLACK_SHIFT.
+ */
+void thread_sleep_ns(uint64_t ns);
+
+/**
+ * @brief Convert between nanoseconds and TSC cycles
+ */
+uint64_t timer_ns_to_tsc(uint64_t ns);
+uint64_t timer_tsc_to_ns(uint64_t tsc);
+
+/**
+ * @brief Log timer counters for all CPUs
+ */
+void timer_log_stats(void);
+
+#endif // SHIPOS_TIMER_H
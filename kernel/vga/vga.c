@@ -8,15 +8,20 @@
 
 #include "vga.h"
 #include "../lib/include/memset.h"
+#include "../lib/include/x86_64.h"
+#include "../paging/paging.h"
+#include "../memlayout.h"
 
 /**
  * @brief VGA text mode buffer address.
  * 
- * The VGA text mode memory starts at physical address 0xB8000.
+ * The VGA text mode memory starts at physical address 0xB8000 and is
+ * accessed through the direct map.
  * Each character cell is represented by a struct char_with_color.
+ * Switched to a write-combining mapping by vga_enable_write_combining().
  */
 struct vga_char;
-struct char_with_color *const VGA_ADDRESS = (void *)0xB8000;
+static struct char_with_color *VGA_ADDRESS = (void *)(DIRECT_MAP_BASE + VGA_PHYS_ADDRESS);
 
 /**
  * @brief Current cursor position (line and column)
@@ -37,8 +42,28 @@ void clear_vga() {
 }
 
 void write_buffer(struct char_with_color *tty_buffer) {
-    for (int i = 0; i < VGA_HEIGHT * VGA_WIDTH; i++) {
-        VGA_ADDRESS[i] = tty_buffer[i];
+    // Copy four cells per store so write-combining can merge them into full lines
+    void *vga = VGA_ADDRESS;
+    void *tty = tty_buffer;
+    volatile uint64_t *dst = vga;
+    const uint64_t *src = tty;
+    for (int i = 0; i < VGA_BUFFER_SIZE / sizeof(uint64_t); i++) {
+        dst[i] = src[i];
     }
+    // Drain the write-combining buffers so the frame is visible immediately
+    sfence();
+}
+
+int vga_enable_write_combining() {
+    struct char_with_color *buffer = map_mmio_wc(VGA_PHYS_ADDRESS, VGA_BUFFER_SIZE);
+    if (buffer == 0) {
+        return -1;
+    }
+    VGA_ADDRESS = buffer;
+    return 0;
+}
+
+struct char_with_color *vga_buffer() {
+    return VGA_ADDRESS;
 }
 
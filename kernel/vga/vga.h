@@ -16,6 +16,12 @@
 #define VGA_WIDTH 80    // Number of columns
 #define VGA_HEIGHT 25   // Number of rows
 
+/**
+ * @brief Physical location and size of the VGA text buffer
+ */
+#define VGA_PHYS_ADDRESS 0xB8000
+#define VGA_BUFFER_SIZE (VGA_WIDTH * VGA_HEIGHT * 2)
+
 /**
  * @brief Default VGA color used for initialization
  */
@@ -81,5 +87,21 @@ void clear_vga();
  */
 void write_buffer(struct char_with_color *tty_buffer);
 
+/**
+ * @brief Remaps the VGA buffer as write-combining memory.
+ * 
+ * Full-screen redraws done by write_buffer() are then merged into burst
+ * transactions instead of one uncached bus cycle per store.
+ * Requires pat_init() to have run on every CPU.
+ * 
+ * @return 0 on success, -1 if the buffer could not be remapped
+ */
+int vga_enable_write_combining();
+
+/**
+ * @brief Returns the address the VGA buffer is currently accessed through.
+ */
+struct char_with_color *vga_buffer();
+
 #endif // UNTITLED_OS_PRINT_H
 
@@ -0,0 +1,291 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Virtual memory areas and the page-fault handler.
+//
+
+#include "vma.h"
+#include "../memlayout.h"
+#include "../kalloc/kalloc.h"
+#include "../lib/include/memset.h"
+#include "../lib/include/x86_64.h"
+#include "../lib/include/logging.h"
+
+// Frames freed per TLB shootdown by vm_unmap_anon()
+#define VM_UNMAP_BATCH 64
+
+static struct address_space kernel_address_space;
+static struct vm_fault_stats fault_stats;
+static uint32_t fault_around_pages = VM_FAULT_AROUND_DEFAULT;
+
+void vm_init(void)
+{
+    init_spinlock(&kernel_address_space.lock, "kernel_as");
+    kernel_address_space.pgtbl = current_pagetable();
+    LOG_SERIAL("VM", "Anonymous memory window 0x%llx-0x%llx, fault-around %d pages",
+               ANON_BASE, ANON_END, fault_around_pages);
+}
+
+struct address_space *current_address_space(void)
+{
+    // All threads run in the kernel page table for now
+    return &kernel_address_space;
+}
+
+struct vma *vma_find(struct address_space *as, uint64_t addr)
+{
+    for (int i = 0; i < VMA_MAX_REGIONS; i++)
+    {
+        struct vma *vma = &as->regions[i];
+        if (vma->used && !vma->unmapping && vma->start <= addr && addr < vma->end)
+        {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief First-fit search for a free range in the anonymous window
+ *
+ * Regions are separated by an unmapped guard page so that an overrun
+ * faults instead of silently landing in the next region.
+ */
+static uint64_t find_free_range(struct address_space *as, uint64_t size)
+{
+    uint64_t candidate = ANON_BASE;
+    bool moved = true;
+
+    while (moved)
+    {
+        moved = false;
+        for (int i = 0; i < VMA_MAX_REGIONS; i++)
+        {
+            struct vma *vma = &as->regions[i];
+            if (vma->used && vma->start < candidate + size + PGSIZE && candidate < vma->end + PGSIZE)
+            {
+                candidate = vma->end + PGSIZE;
+                moved = true;
+            }
+        }
+        if (candidate + size > ANON_END)
+        {
+            return 0;
+        }
+    }
+    return candidate;
+}
+
+void *vm_map_anon(struct address_space *as, uint64_t size, int prot)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+    size = PGROUNDUP(size);
+
+    acquire_spinlock(&as->lock);
+
+    struct vma *slot = NULL;
+    for (int i = 0; i < VMA_MAX_REGIONS; i++)
+    {
+        if (!as->regions[i].used)
+        {
+            slot = &as->regions[i];
+            break;
+        }
+    }
+
+    uint64_t start = slot != NULL ? find_free_range(as, size) : 0;
+    if (start != 0)
+    {
+        slot->start = start;
+        slot->end = start + size;
+        slot->prot = prot;
+        slot->used = true;
+        slot->unmapping = false;
+    }
+
+    release_spinlock(&as->lock);
+
+    if (start == 0)
+    {
+        LOG_SERIAL("VM", "Cannot reserve an anonymous region of %llu bytes", size);
+    }
+    return (void *)start;
+}
+
+int vm_unmap_anon(struct address_space *as, void *addr)
+{
+    acquire_spinlock(&as->lock);
+
+    struct vma *vma = vma_find(as, (uint64_t)addr);
+    if (vma == NULL || vma->start != (uint64_t)addr)
+    {
+        release_spinlock(&as->lock);
+        return -1;
+    }
+
+    // Faults in the region fail from here on, but the range stays
+    // reserved until its frames are back in kalloc
+    vma->unmapping = true;
+    uint64_t va = vma->start;
+    uint64_t end = vma->end;
+    release_spinlock(&as->lock);
+
+    void *frames[VM_UNMAP_BATCH];
+    while (va < end)
+    {
+        uint64_t chunk = va;
+        int count = 0;
+
+        acquire_spinlock(&as->lock);
+        for (; va < end && count < VM_UNMAP_BATCH; va += PGSIZE)
+        {
+            uint64_t pa = va_to_pa(as->pgtbl, va);
+            if (pa != 0)
+            {
+                frames[count++] = P2V(pa);
+            }
+        }
+        unmap_pages(as->pgtbl, chunk, va - chunk);
+        release_spinlock(&as->lock);
+
+        // Other CPUs that touched the region may still cache translations
+        // to these frames; they must drop them before the frames are reused
+        if (count != 0)
+        {
+            tlb_shootdown();
+        }
+        for (int i = 0; i < count; i++)
+        {
+            kfree(frames[i]);
+        }
+    }
+
+    acquire_spinlock(&as->lock);
+    vma->used = false;
+    vma->unmapping = false;
+    release_spinlock(&as->lock);
+    return 0;
+}
+
+/**
+ * @brief Back one page of a region with a zeroed frame
+ *
+ * @return 0 on success, -1 if no frame or page table could be allocated
+ */
+static int map_anon_page(struct address_space *as, struct vma *vma, uint64_t va)
+{
+    void *frame = kalloc();
+    if (frame == NULL)
+    {
+        return -1;
+    }
+    memset(frame, 0, PGSIZE);
+
+    int flags = (vma->prot & VMA_WRITE) ? PTE_W : 0;
+    if (map_page(as->pgtbl, va, V2P(frame), flags) != 0)
+    {
+        kfree(frame);
+        return -1;
+    }
+    return 0;
+}
+
+int handle_page_fault(uint64_t addr, uint64_t error_code)
+{
+    uint64_t start_tsc = rdtsc();
+    struct address_space *as = current_address_space();
+    uint64_t page = PGROUNDDOWN(addr);
+    int resolved = 0;
+
+    acquire_spinlock(&as->lock);
+
+    struct vma *vma = vma_find(as, addr);
+    if (vma == NULL || (error_code & (PF_PRESENT | PF_RSVD | PF_INSTR)) ||
+        ((error_code & PF_WRITE) && !(vma->prot & VMA_WRITE)))
+    {
+        fault_stats.failures++;
+        goto out;
+    }
+
+    // Another CPU may have mapped the page while we waited for the lock
+    if (mapping_size(as->pgtbl, page) != 0)
+    {
+        resolved = 1;
+        goto out;
+    }
+
+    if (map_anon_page(as, vma, page) != 0)
+    {
+        LOG_SERIAL("VM", "Out of memory resolving fault at 0x%llx", addr);
+        fault_stats.failures++;
+        goto out;
+    }
+    fault_stats.pages_mapped++;
+
+    // Fault-around: populate the rest of the aligned window inside the region
+    uint64_t window = (uint64_t)fault_around_pages * PGSIZE;
+    uint64_t around_start = page - (page - vma->start) % window;
+    uint64_t around_end = around_start + window;
+    if (around_end > vma->end)
+    {
+        around_end = vma->end;
+    }
+
+    for (uint64_t va = around_start; va < around_end; va += PGSIZE)
+    {
+        if (va == page || mapping_size(as->pgtbl, va) != 0)
+        {
+            continue;
+        }
+        if (map_anon_page(as, vma, va) != 0)
+        {
+            break;
+        }
+        fault_stats.pages_mapped++;
+        fault_stats.around_mapped++;
+    }
+
+    uint64_t cycles = rdtsc() - start_tsc;
+    fault_stats.faults++;
+    fault_stats.total_cycles += cycles;
+    if (cycles > fault_stats.max_cycles)
+    {
+        fault_stats.max_cycles = cycles;
+    }
+    resolved = 1;
+
+out:
+    release_spinlock(&as->lock);
+    return resolved;
+}
+
+void vm_set_fault_around(uint32_t pages)
+{
+    if (pages < 1)
+    {
+        pages = 1;
+    }
+    if (pages > VM_FAULT_AROUND_MAX)
+    {
+        pages = VM_FAULT_AROUND_MAX;
+    }
+    fault_around_pages = pages;
+}
+
+struct vm_fault_stats get_vm_fault_stats(void)
+{
+    return fault_stats;
+}
+
+void log_vm_fault_stats(void)
+{
+    uint64_t avg = fault_stats.faults ? fault_stats.total_cycles / fault_stats.faults : 0;
+    LOG_SERIAL("VM", "faults: %llu, failures: %llu, pages mapped: %llu (%llu ahead), "
+               "cycles avg/max: %llu/%llu",
+               fault_stats.faults, fault_stats.failures, fault_stats.pages_mapped,
+               fault_stats.around_mapped, avg, fault_stats.max_cycles);
+}
@@ -0,0 +1,148 @@
+//
+// Created by ShipOS developers on 18.10.26.
+// Copyright (c) 2026 SHIPOS. All rights reserved.
+//
+// Virtual memory areas (VMAs) and demand-paged anonymous memory.
+// An address space keeps a list of regions; frames for a region are
+// allocated and mapped by the page-fault handler on first touch.
+//
+
+#ifndef SHIPOS_VMA_H
+#define SHIPOS_VMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../paging/paging.h"
+#include "../sync/spinlock.h"
+
+// Maximum number of regions per address space
+#define VMA_MAX_REGIONS 64
+
+// Default number of pages mapped per fault (1 disables fault-around)
+#define VM_FAULT_AROUND_DEFAULT 8
+
+// Upper bound for vm_set_fault_around()
+#define VM_FAULT_AROUND_MAX 64
+
+// Region protection flags
+#define VMA_READ  0x1
+#define VMA_WRITE 0x2
+
+// Page-fault error code bits pushed by the CPU
+#define PF_PRESENT 0x01   // Fault on a present page (protection violation)
+#define PF_WRITE   0x02   // Faulting access was a write
+#define PF_USER    0x04   // Fault happened in user mode
+#define PF_RSVD    0x08   // Reserved bit set in a paging entry
+#define PF_INSTR   0x10   // Fault on instruction fetch
+
+/**
+ * @brief A contiguous range of virtual addresses [start, end)
+ */
+struct vma
+{
+    uint64_t start;
+    uint64_t end;
+    int prot;   // VMA_READ / VMA_WRITE
+    bool used;
+    bool unmapping; // Being torn down by vm_unmap_anon(), no longer faulted in
+};
+
+/**
+ * @brief Set of regions sharing one page table
+ */
+struct address_space
+{
+    pagetable_t pgtbl;
+    struct spinlock lock;
+    struct vma regions[VMA_MAX_REGIONS];
+};
+
+/**
+ * @brief Page-fault counters
+ */
+struct vm_fault_stats
+{
+    uint64_t faults;          // Faults resolved by mapping a frame
+    uint64_t failures;        // Faults outside any region or with bad access
+    uint64_t pages_mapped;    // Frames mapped, including fault-around
+    uint64_t around_mapped;   // Frames mapped ahead of the faulting page
+    uint64_t total_cycles;    // TSC cycles spent servicing resolved faults
+    uint64_t max_cycles;      // Slowest resolved fault
+};
+
+/**
+ * @brief Initialize the kernel address space
+ *
+ * Must be called after kvminit(), before the first vm_map_anon().
+ */
+void vm_init(void);
+
+/**
+ * @brief Address space used to resolve faults on this CPU
+ */
+struct address_space *current_address_space(void);
+
+/**
+ * @brief Reserve a demand-paged anonymous region
+ *
+ * Only the region descriptor is created; frames are allocated on first
+ * touch and come back zero-filled.
+ *
+ * @param as Address space to add the region to
+ * @param size Size of the region in bytes (rounded up to pages)
+ * @param prot VMA_READ and/or VMA_WRITE
+ * @return Start of the region, or NULL if no space is left
+ */
+void *vm_map_anon(struct address_space *as, uint64_t size, int prot);
+
+/**
+ * @brief Remove a region and release every frame faulted into it
+ *
+ * Frames are freed only after every CPU has flushed its TLB, so this
+ * waits for the others and must be called with interrupts enabled.
+ *
+ * @param as Address space the region belongs to
+ * @param addr Start address returned by vm_map_anon()
+ * @return 0 on success, -1 if no region starts at addr
+ */
+int vm_unmap_anon(struct address_space *as, void *addr);
+
+/**
+ * @brief Find the region containing an address
+ *
+ * The caller must hold as->lock.
+ *
+ * @return Region, or NULL if addr is not covered
+ */
+struct vma *vma_find(struct address_space *as, uint64_t addr);
+
+/**
+ * @brief Resolve a page fault
+ *
+ * Called from the vector 14 stub. Maps a zeroed frame for the faulting
+ * page and up to fault-around - 1 neighbouring pages of the same region.
+ *
+ * @param addr Faulting address (CR2)
+ * @param error_code Error code pushed by the CPU
+ * @return 1 if the fault was resolved, 0 if it is fatal
+ */
+int handle_page_fault(uint64_t addr, uint64_t error_code);
+
+/**
+ * @brief Set the number of pages mapped per fault
+ *
+ * @param pages Window size in pages, clamped to [1, VM_FAULT_AROUND_MAX]
+ */
+void vm_set_fault_around(uint32_t pages);
+
+/**
+ * @brief Get a snapshot of the page-fault counters
+ */
+struct vm_fault_stats get_vm_fault_stats(void);
+
+/**
+ * @brief Log the page-fault counters to serial
+ */
+void log_vm_fault_stats(void);
+
+#endif // SHIPOS_VMA_H
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Set of tests to check if scheduler functions are working fine
+
+check() {
+    if grep -q "$1 - Skipped" tests.log; then
+        echo "$1 - Skipped"
+    else 
+        if grep -q "$1 - OK" tests.log; then
+            echo "✅ $1 - OK"
+        else 
+            echo "❌ $1 - Failed"
+            exit 1
+        fi
+    fi
+}
+
+check "SCHED: Spinlocks disable preemption"
+check "SCHED: Priority pick order"
+check "SCHED: Run queue without allocation"
+check "SCHED: Wakelist drain"
+check "SCHED: Fair pick order"
+check "SCHED: Class pick order"
+check "SCHED: Deadline admission control"
+check "SCHED: Calibrated tick rate"
+check "SCHED: Topology domains"
+check "SCHED: Periodic deadline tasks"
+check "SCHED: CPU affinity"
+check "SCHED: Cache-hot wakeup placement"
+check "SCHED: Thread recycling"
+check "SCHED: Fiber yield benchmark"
+check "SCHED: Lazy FPU state"
+check "SCHED: Scheduler statistics"
+check "SCHED: Wait queues and mutex"
+check "SCHED: Timer wheel sleeps"
+check "SCHED: Softirq and workqueue"
+check "SCHED: Parallel for"
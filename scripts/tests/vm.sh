@@ -29,3 +29,8 @@ check "VM: map_page works"
 check "VM: va_to_pa translation"
 check "VM: unmap_page works"
 check "VM: map_pages range"
+check "VM: unmap frees page tables"
+check "VM: ioremap registry"
+check "VM: Console write-combining"
+check "VM: Direct map"
+check "VM: Demand paging"
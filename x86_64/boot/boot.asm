@@ -1,50 +1,84 @@
 global start
+global multiboot_info_phys
 extern kernel_main
 extern check_multiboot
 extern check_cpuid
 extern check_long_mode
-section .text
+
+; Virtual base of the kernel image, must match KERNBASE in memlayout.h
+KERNEL_OFFSET equ 0xFFFFFFFF80000000
+
+; 32-bit code runs before paging, so it lives in .boot_text at its physical
+; address and reaches higher-half symbols by subtracting KERNEL_OFFSET
+section .boot_text progbits alloc exec nowrite align=16
 bits 32
 start:
-    mov esp, stack_top
+    mov esp, stack_top - KERNEL_OFFSET
+    ; GRUB passes the multiboot2 information structure in ebx; the checks
+    ; below clobber it
+    mov [multiboot_info_phys - KERNEL_OFFSET], ebx
     call check_multiboot
     call check_cpuid
     call check_long_mode
     jmp page_tables_setup
 
 page_tables_setup:
-    ; point first entry of p4 table to the first entry in p3 table
-    mov eax, p3_table
+    ; one p3 -> p2 chain maps the first 1 GB of physical memory:
+    ;   p4[0]   - identity map, used until the jump to the higher half
+    ;             and by the AP trampoline; dropped after AP bring-up
+    ;   p4[256] - direct map at 0xFFFF800000000000
     ; make first two bits 1
     ; present bit - page is currently in memory
     ; writable bit - page allowed to be written to
+    mov eax, p3_table - KERNEL_OFFSET
+    or eax, 0b11
+    mov dword [p4_table - KERNEL_OFFSET + 0], eax
+    mov dword [p4_table - KERNEL_OFFSET + 256 * 8], eax
+
+    ; p4[511] -> p3_kernel[510] - kernel image at 0xFFFFFFFF80000000
+    mov eax, p3_kernel_table - KERNEL_OFFSET
     or eax, 0b11
-    mov dword [p4_table + 0], eax
-    mov eax, p2_table
+    mov dword [p4_table - KERNEL_OFFSET + 511 * 8], eax
+
+    mov eax, p2_table - KERNEL_OFFSET
     or eax, 0b11
-    mov dword [p3_table + 0], eax
+    mov dword [p3_table - KERNEL_OFFSET + 0], eax
+    mov dword [p3_kernel_table - KERNEL_OFFSET + 510 * 8], eax
 
-    mov eax, p1_table
+    ; first 2 MB use 4 KB pages, so low memory (VGA buffer, AP trampoline)
+    ; can be given its own attributes
+    mov eax, p1_table - KERNEL_OFFSET
     or eax, 0b11
-    mov dword [p2_table + 0], eax
+    mov dword [p2_table - KERNEL_OFFSET + 0], eax
 
     mov ecx, 0 ; counter
 .map_p1_table:
     mov eax, 0x1000  ; Physical address for this page
     mul ecx
-    or eax, 0b11       ; Set Present (P), Read/Write (R/W), and User (U/S) flags
-    mov [p1_table + ecx * 8], eax
+    or eax, 0b11       ; Set Present (P), Read/Write (R/W) flags
+    mov [p1_table - KERNEL_OFFSET + ecx * 8], eax
     inc ecx
     cmp ecx, 512        ; 512 entries in a page table
     jl .map_p1_table
 
+    ; the rest of the first 1 GB uses 2 MB pages
+    mov ecx, 1
+.map_p2_table:
+    mov eax, 0x200000  ; Physical address for this large page
+    mul ecx
+    or eax, 0b10000011 ; Present, Read/Write, Page Size
+    mov [p2_table - KERNEL_OFFSET + ecx * 8], eax
+    inc ecx
+    cmp ecx, 512
+    jl .map_p2_table
+
 
 
 .setup_page_register:
     ; move page table address to cr3
     ; using eax because we can move data to control register
     ; only from another register
-    mov eax, p4_table
+    mov eax, p4_table - KERNEL_OFFSET
     mov cr3, eax
 
 .enable_pae:
@@ -66,7 +100,7 @@ page_tables_setup:
 
 
 .update_lgdr_register:
-    lgdt [gdt64.pointer]
+    lgdt [gdt64.pointer_low - KERNEL_OFFSET]
 
 .update_selectors:
     mov ax, gdt64.data
@@ -78,14 +112,21 @@ page_tables_setup:
     jmp gdt64.code:long_mode_start
     hlt
 
+    ; LONG MODE, still running from the identity map
+bits 64
+long_mode_start:
+    mov rax, higher_half_start
+    jmp rax
+
 
-section .bss
-align 4096
+section .bss nobits alloc noexec write align=4096
 
 p4_table:
     resb 4096
 p3_table:
     resb 4096
+p3_kernel_table:
+    resb 4096
 p2_table:
     resb 4096
 p1_table:
@@ -93,6 +134,8 @@ p1_table:
 stack_bottom:
     resb 4096*8
 stack_top:
+multiboot_info_phys:
+    resd 1
 
 section .rodata
 gdt64:
@@ -104,15 +147,21 @@ gdt64:
 .data: equ $ - gdt64
     dq (1<<44) | (1<<47) | (1<<41)
 
+; loaded by 32-bit code before paging, so the base is physical
+.pointer_low:
+    dw .pointer_low - gdt64 - 1
+    dq gdt64 - KERNEL_OFFSET
+
 .pointer:
-    dw .pointer - gdt64 - 1
+    dw .pointer_low - gdt64 - 1
     dq gdt64
 
-    ; LONG MODE
+    ; LONG MODE, HIGHER HALF
 section .text
 bits 64
-long_mode_start:
+higher_half_start:
     mov rsp, stack_top
+    lgdt [rel gdt64.pointer]
 
     call kernel_main
 
@@ -1,6 +1,9 @@
 global check_multiboot
 global check_cpuid
 global check_long_mode
+
+; Runs before paging is enabled, see boot.asm
+section .boot_text
 bits 32
 check_multiboot:
     cmp eax, 0x36d76289 ; magic value (if multiboot comparable)
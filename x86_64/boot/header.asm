@@ -1,3 +1,4 @@
+section .multiboot_header progbits alloc noexec nowrite align=8
 header_start:
     dd 0xe85250d6                ; magic number
     dd 0                         ; zero code tells grub to boot into protected mode